@@ -32,13 +32,27 @@ void Floor::initialize(glm::vec3 position, glm::vec3 scale, const char* textureP
     glGenVertexArrays(1, &vertexArrayID);
     glBindVertexArray(vertexArrayID);
 
+    // Packed vertices: UNORM16 positions in the quad bounds and half float UVs
+    PositionQuantization quantization = PositionQuantization::fromBounds(glm::vec3(-1.0f, 0.0f, -1.0f),
+                                                                         glm::vec3(1.0f, 0.0f, 1.0f));
+    positionDequantize = quantization.dequantize();
+    uint16_t packed_vertex_data[16];
+    uint16_t packed_uv_data[8];
+    for (int i = 0; i < 4; ++i) {
+        quantization.encode(glm::vec3(vertex_buffer_data[3 * i], vertex_buffer_data[3 * i + 1],
+                                      vertex_buffer_data[3 * i + 2]), &packed_vertex_data[4 * i]);
+        packed_uv_data[2 * i] = glm::packHalf1x16(uv_buffer_data[2 * i]);
+        packed_uv_data[2 * i + 1] = glm::packHalf1x16(uv_buffer_data[2 * i + 1]);
+    }
+    VertexFormatStats::add(4, 20, 12);
+
     glGenBuffers(1, &vertexBufferID);
     glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(packed_vertex_data), packed_vertex_data, GL_STATIC_DRAW);
 
     glGenBuffers(1, &uvBufferID);
     glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(uv_buffer_data), uv_buffer_data, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(packed_uv_data), packed_uv_data, GL_STATIC_DRAW);
 
     glGenBuffers(1, &indexBufferID);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
@@ -48,7 +62,7 @@ void Floor::initialize(glm::vec3 position, glm::vec3 scale, const char* textureP
     textureID = LoadTextureTileBox(texturePath);
 
     // Load shaders
-    programID = LoadShadersFromFile("../street/floor.vert", "../street/floor.frag");
+    programID = LoadShadersFromFile("../street/floor.vert", "../street/floor.frag", "../street/clusterLighting.glsl");
     if (programID == 0) {
         std::cerr << "Failed to load floor shaders." << std::endl;
     }
@@ -61,18 +75,28 @@ void Floor::initialize(glm::vec3 position, glm::vec3 scale, const char* textureP
     cameraPositionID = glGetUniformLocation(programID, "cameraPosition");
     lightSpaceMatrixID = glGetUniformLocation(programID, "lightSpaceMatrix");
     shadowMapID = glGetUniformLocation(programID, "shadowMap");
+    aoMapID = glGetUniformLocation(programID, "aoMap");
+    aoTileID = glGetUniformLocation(programID, "aoTile");
 }
 
-void Floor::render(glm::mat4 cameraMatrix,glm::mat4 lightSpaceMatrix, GLuint depthMap, Light light, glm::vec3 cameraPosition) {
+void Floor::setAmbientOcclusion(GLuint aoTexture, glm::vec4 aoTile) {
+    this->aoTextureID = aoTexture;
+    this->aoTile = aoTile;
+}
+
+void Floor::render(glm::mat4 cameraMatrix,glm::mat4 lightSpaceMatrix, GLuint depthMap, Light light, glm::vec3 cameraPosition,
+                   const LightClusters &clusters) {
     glUseProgram(programID);
 
+    glBindVertexArray(vertexArrayID);
+
     glEnableVertexAttribArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, 4 * sizeof(uint16_t), 0);
 
     glEnableVertexAttribArray(1);
     glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, 0, 0);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
 
@@ -84,13 +108,21 @@ void Floor::render(glm::mat4 cameraMatrix,glm::mat4 lightSpaceMatrix, GLuint dep
     glBindTexture(GL_TEXTURE_2D, depthMap);
     glUniform1i(shadowMapID, 1);
 
+    // Bind the baked ambient occlusion to texture unit 2
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, aoTextureID);
+    glUniform1i(aoMapID, 2);
+    glUniform4fv(aoTileID, 1, &aoTile[0]);
+
     glm::mat4 modelMatrix = glm::mat4(1.0f);
     modelMatrix = glm::translate(modelMatrix, position);
     modelMatrix = glm::scale(modelMatrix, scale);
 
-    glUniformMatrix4fv(glGetUniformLocation(programID, "modelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
+    // The normal matrix stays without the dequantize matrix, its y scale is zero
     glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelMatrix)));
     glUniformMatrix3fv(glGetUniformLocation(programID, "normalMatrix"), 1, GL_FALSE, &normalMatrix[0][0]);
+    modelMatrix = modelMatrix * positionDequantize;
+    glUniformMatrix4fv(glGetUniformLocation(programID, "modelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
 
     glm::mat4 mvp = cameraMatrix * modelMatrix;
     glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
@@ -108,6 +140,7 @@ void Floor::render(glm::mat4 cameraMatrix,glm::mat4 lightSpaceMatrix, GLuint dep
 
     // Pass light direction to the shader
     glUniform3fv(glGetUniformLocation(programID, "lightDirection"), 1, &light.direction[0]);
+    clusters.applyUniforms(programID);
 
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
@@ -118,20 +151,20 @@ void Floor::render(glm::mat4 cameraMatrix,glm::mat4 lightSpaceMatrix, GLuint dep
 void Floor::renderDepth(GLuint shaderProgramID, glm::mat4 lightSpaceMatrix) {
     glUseProgram(shaderProgramID);
 
-    // Set uniforms
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "lightSpaceMatrix"), 1, GL_FALSE, &lightSpaceMatrix[0][0]);
-
     glm::mat4 modelMatrix = glm::mat4(1.0f);
     modelMatrix = glm::translate(modelMatrix, position);
     modelMatrix = glm::scale(modelMatrix, scale);
+    modelMatrix = modelMatrix * positionDequantize;
 
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "modelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
+    // Built like the MVP of render, so the depth pre-pass matches it exactly
+    glm::mat4 mvp = lightSpaceMatrix * modelMatrix;
+    glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "MVP"), 1, GL_FALSE, &mvp[0][0]);
 
     glBindVertexArray(vertexArrayID);
 
     glEnableVertexAttribArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, 4 * sizeof(uint16_t), 0);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
 
@@ -3,6 +3,8 @@
 
 #include <glm/glm.hpp>
 #include "lightInfo.h"
+#include "lightCluster.h"
+#include "vertexQuantization.h"
 #include <glm/gtc/matrix_transform.hpp>
 #include <glad/gl.h>
 #include <iostream>
@@ -16,8 +18,11 @@ public:
     glm::vec3 scale;    // Size of the floor
 
     void initialize(glm::vec3 position, glm::vec3 scale, const char* texturePath);
-    void render(glm::mat4 cameraMatrix,glm::mat4 lightSpaceMatrix, GLuint depthMap, Light light, glm::vec3 cameraPosition);
+    void render(glm::mat4 cameraMatrix,glm::mat4 lightSpaceMatrix, GLuint depthMap, Light light, glm::vec3 cameraPosition,
+                const LightClusters &clusters);
     void renderDepth(GLuint shaderProgramID, glm::mat4 lightSpaceMatrix);
+    // Baked ambient occlusion, aoTile is the (offset, size) of this quad in the atlas
+    void setAmbientOcclusion(GLuint aoTexture, glm::vec4 aoTile);
     void cleanup();
 
 private:
@@ -44,6 +49,11 @@ private:
     GLuint mvpMatrixID, textureSamplerID, lightPositionID, lightColorID, lightIntensityID, lightDirectionID, cameraPositionID;
     GLuint lightSpaceMatrixID;
     GLuint shadowMapID;
+    GLuint aoMapID, aoTileID;
+    GLuint aoTextureID = 0;
+    glm::vec4 aoTile = glm::vec4(0.0f);
+    // Positions are uploaded as UNORM16 in the quad bounds, this maps them back
+    glm::mat4 positionDequantize = glm::mat4(1.0f);
 
 
     GLuint LoadTextureTileBox(const char* texture_file_path);
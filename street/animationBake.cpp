@@ -0,0 +1,68 @@
+#include "animationBake.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+void AnimationBake::bake(const Bot &bot, float framesPerSecond) {
+    auto startTime = std::chrono::high_resolution_clock::now();
+    joints = bot.jointCount();
+    float duration = bot.clipDuration();
+    frames = std::max(1, static_cast<int>(std::round(duration * framesPerSecond)));
+    rate = duration > 0.0f ? frames / duration : framesPerSecond;
+    rows.resize(static_cast<size_t>(frames + 1) * joints * 3);
+
+    Bot::AnimationScratch scratch;
+    bot.prepareScratch(scratch);
+    std::vector<int> keyCursors(bot.channelCount(), 0);
+    std::vector<glm::mat4> jointMatrices(joints);
+    for (int frame = 0; frame <= frames; ++frame) {
+        // Playback wraps at the duration, so the closing frame is sampled just before it
+        float time = frame < frames ? frame / rate : std::nextafter(duration, 0.0f);
+        bot.evaluate(time, keyCursors.data(), scratch, jointMatrices.data());
+        glm::vec4 *frameRows = &rows[static_cast<size_t>(frame) * joints * 3];
+        for (int j = 0; j < joints; ++j) {
+            const glm::mat4 &m = jointMatrices[j];
+            frameRows[j * 3 + 0] = glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+            frameRows[j * 3 + 1] = glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+            frameRows[j * 3 + 2] = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+        }
+    }
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    lastBakeMs = std::chrono::duration<float, std::milli>(endTime - startTime).count();
+    std::cout << "Baked animation: " << frames << " frames of " << joints << " joints at " << rate << " Hz, "
+              << byteSize() / 1024.0f << " KB, " << lastBakeMs << " ms" << std::endl;
+}
+
+glm::mat4 AnimationBake::sample(int joint, float time) const {
+    float frame = std::fmod(time * rate, static_cast<float>(frames));
+    int frame0 = std::min(static_cast<int>(frame), frames - 1);
+    int frame1 = frame0 + 1;
+    float blend = frame - frame0;
+
+    glm::mat4 m(1.0f);
+    for (int r = 0; r < 3; ++r) {
+        glm::vec4 row = glm::mix(rows[(static_cast<size_t>(frame0) * joints + joint) * 3 + r],
+                                 rows[(static_cast<size_t>(frame1) * joints + joint) * 3 + r], blend);
+        m[0][r] = row.x;
+        m[1][r] = row.y;
+        m[2][r] = row.z;
+        m[3][r] = row.w;
+    }
+    return m;
+}
+
+GLuint AnimationBake::createTexture() const {
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, joints * 3, frames + 1, 0, GL_RGBA, GL_FLOAT, rows.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return textureID;
+}
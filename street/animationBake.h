@@ -0,0 +1,39 @@
+#ifndef ANIMATIONBAKE_H
+#define ANIMATIONBAKE_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "bot.h"
+
+// The first clip of a Bot, sampled once at load time at a fixed rate. Every
+// frame holds the joint matrices as three RGBA32F rows each, so a vertex shader
+// can play the clip back by fetching two frames and blending them, and
+// background characters need no animation work on the CPU at all. The rate is
+// rounded so the clip holds a whole number of frames, and one more frame holds
+// the end of the clip, so the last interval never blends into the first pose.
+class AnimationBake {
+public:
+    // Samples the clip at about framesPerSecond, no GL calls
+    void bake(const Bot &bot, float framesPerSecond);
+    // jointCount * 3 texels wide, frameCount + 1 rows
+    GLuint createTexture() const;
+
+    int frameCount() const { return frames; }
+    int jointCount() const { return joints; }
+    float frameRate() const { return rate; }
+    size_t byteSize() const { return rows.size() * sizeof(glm::vec4); }
+    float bakeMs() const { return lastBakeMs; }
+    // Joint matrix j of the clip at time, blended like the shader does, for checks on the CPU
+    glm::mat4 sample(int joint, float time) const;
+
+private:
+    int frames = 0;
+    int joints = 0;
+    float rate = 0.0f;
+    float lastBakeMs = 0.0f;
+    std::vector<glm::vec4> rows;
+};
+
+#endif // ANIMATIONBAKE_H
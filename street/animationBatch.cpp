@@ -0,0 +1,263 @@
+#include "animationBatch.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define BATCH_SSE 1
+#endif
+
+// std::min takes it by reference, unoptimized builds need the definition
+const int AnimationBatch::LANES;
+
+// Writes the three rows of an affine matrix
+static void storeRows(const glm::mat4 &m, glm::vec4 *rows) {
+    rows[0] = glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+    rows[1] = glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+    rows[2] = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+}
+
+void AnimationBatch::prepare(const Bot &bot) {
+    this->bot = &bot;
+    slotCount = static_cast<int>(bot.skeleton.nodes.size());
+    jointCount = bot.jointCount();
+    channelCount = bot.channelCount();
+
+    inverseBindRows.resize(jointCount * 3);
+    affine = true;
+    for (int j = 0; j < jointCount; ++j) {
+        const glm::mat4 &m = bot.skinObjects[0].inverseBindMatrices[j];
+        storeRows(m, &inverseBindRows[j * 3]);
+        affine = affine && std::abs(m[0][3]) < 1e-6f && std::abs(m[1][3]) < 1e-6f &&
+                 std::abs(m[2][3]) < 1e-6f && std::abs(m[3][3] - 1.0f) < 1e-6f;
+    }
+}
+
+bool AnimationBatch::isSimd() const {
+#ifdef BATCH_SSE
+    return simd && affine;
+#else
+    return false;
+#endif
+}
+
+void AnimationBatch::evaluateScalar(int count, const int *skeletons, const float *times,
+                                    const glm::mat4 *modelMatrices, int *keyCursors, glm::vec4 *paletteRows) const {
+    // Sized on the first call of each thread, reused after that
+    thread_local Bot::AnimationScratch scratch;
+    thread_local std::vector<glm::mat4> jointMatrices;
+    bot->prepareScratch(scratch);
+    jointMatrices.resize(jointCount);
+
+    for (int i = 0; i < count; ++i) {
+        int s = skeletons ? skeletons[i] : i;
+        bot->evaluate(times[s], &keyCursors[s * channelCount], scratch, jointMatrices.data());
+        glm::vec4 *rows = &paletteRows[static_cast<size_t>(s) * jointCount * 3];
+        for (int j = 0; j < jointCount; ++j) {
+            storeRows(modelMatrices[s] * jointMatrices[j], &rows[j * 3]);
+        }
+    }
+}
+
+#ifdef BATCH_SSE
+namespace {
+
+// Four 3x4 affine matrices, element [row * 4 + column] holds that entry of every lane
+struct Affine4 {
+    __m128 m[12];
+};
+
+inline __m128 madd(__m128 a, __m128 b, __m128 c) {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+
+// a * b for affine matrices, the missing bottom rows are (0, 0, 0, 1)
+inline void multiply(const Affine4 &a, const Affine4 &b, Affine4 &result) {
+    for (int row = 0; row < 3; ++row) {
+        __m128 a0 = a.m[row * 4 + 0], a1 = a.m[row * 4 + 1], a2 = a.m[row * 4 + 2];
+        for (int column = 0; column < 4; ++column) {
+            __m128 sum = madd(a0, b.m[column], madd(a1, b.m[4 + column], _mm_mul_ps(a2, b.m[8 + column])));
+            result.m[row * 4 + column] = column == 3 ? _mm_add_ps(sum, a.m[row * 4 + 3]) : sum;
+        }
+    }
+}
+
+// a * b where b is the same matrix in every lane, given as three rows
+inline void multiplyUniform(const Affine4 &a, const glm::vec4 *b, Affine4 &result) {
+    for (int row = 0; row < 3; ++row) {
+        __m128 a0 = a.m[row * 4 + 0], a1 = a.m[row * 4 + 1], a2 = a.m[row * 4 + 2];
+        for (int column = 0; column < 4; ++column) {
+            __m128 sum = madd(a0, _mm_set1_ps(b[0][column]),
+                              madd(a1, _mm_set1_ps(b[1][column]), _mm_mul_ps(a2, _mm_set1_ps(b[2][column]))));
+            result.m[row * 4 + column] = column == 3 ? _mm_add_ps(sum, a.m[row * 4 + 3]) : sum;
+        }
+    }
+}
+
+// Local pose of one slot for four lanes
+struct Pose4 {
+    __m128 translation[3];
+    __m128 rotation[4]; // x, y, z, w
+    __m128 scale[3];
+};
+
+// T * R * S, the rotation is a unit quaternion
+inline void compose(const Pose4 &pose, Affine4 &result) {
+    __m128 two = _mm_set1_ps(2.0f), one = _mm_set1_ps(1.0f);
+    __m128 x = pose.rotation[0], y = pose.rotation[1], z = pose.rotation[2], w = pose.rotation[3];
+    __m128 x2 = _mm_mul_ps(x, two), y2 = _mm_mul_ps(y, two), z2 = _mm_mul_ps(z, two);
+    __m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+    __m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+    __m128 wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+    __m128 sx = pose.scale[0], sy = pose.scale[1], sz = pose.scale[2];
+
+    result.m[0] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx);
+    result.m[1] = _mm_mul_ps(_mm_sub_ps(xy, wz), sy);
+    result.m[2] = _mm_mul_ps(_mm_add_ps(xz, wy), sz);
+    result.m[3] = pose.translation[0];
+    result.m[4] = _mm_mul_ps(_mm_add_ps(xy, wz), sx);
+    result.m[5] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy);
+    result.m[6] = _mm_mul_ps(_mm_sub_ps(yz, wx), sz);
+    result.m[7] = pose.translation[1];
+    result.m[8] = _mm_mul_ps(_mm_sub_ps(xz, wy), sx);
+    result.m[9] = _mm_mul_ps(_mm_add_ps(yz, wx), sy);
+    result.m[10] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz);
+    result.m[11] = pose.translation[2];
+}
+
+} // namespace
+#endif
+
+void AnimationBatch::evaluate(int count, const int *skeletons, const float *times, const glm::mat4 *modelMatrices,
+                              int *keyCursors, glm::vec4 *paletteRows) const {
+    if (count <= 0 || jointCount == 0) {
+        return;
+    }
+#ifdef BATCH_SSE
+    if (!isSimd()) {
+        evaluateScalar(count, skeletons, times, modelMatrices, keyCursors, paletteRows);
+        return;
+    }
+
+    const Bot::AnimationObject &clip = bot->animationObjects[0];
+    const Bot::SkeletonObject &skeleton = bot->skeleton;
+
+    // Sized on the first call of each thread, reused after that
+    thread_local std::vector<Pose4> poses;
+    thread_local std::vector<Affine4> globals;
+    poses.resize(slotCount);
+    globals.resize(slotCount);
+
+    for (int group = 0; group < count; group += LANES) {
+        // A partial last group repeats its last skeleton in the spare lanes and drops their results
+        int lane[LANES];
+        int laneCount = std::min(LANES, count - group);
+        for (int l = 0; l < LANES; ++l) {
+            int i = group + std::min(l, laneCount - 1);
+            lane[l] = skeletons ? skeletons[i] : i;
+        }
+
+        // Rest pose, overwritten below by the animated components
+        for (int slot = 0; slot < slotCount; ++slot) {
+            const Bot::TransformComponents &rest = skeleton.restPose[slot];
+            Pose4 &pose = poses[slot];
+            for (int k = 0; k < 3; ++k) {
+                pose.translation[k] = _mm_set1_ps(rest.translation[k]);
+                pose.scale[k] = _mm_set1_ps(rest.scale[k]);
+            }
+            pose.rotation[0] = _mm_set1_ps(rest.rotation.x);
+            pose.rotation[1] = _mm_set1_ps(rest.rotation.y);
+            pose.rotation[2] = _mm_set1_ps(rest.rotation.z);
+            pose.rotation[3] = _mm_set1_ps(rest.rotation.w);
+        }
+
+        for (int c = 0; c < channelCount; ++c) {
+            const Bot::ChannelObject &channel = clip.channels[c];
+            const float *keyTimes = &clip.times[channel.firstKey];
+            const glm::vec4 *values = &clip.values[channel.firstKey];
+
+            // Key search per lane, then the two keys of every lane transposed into x, y, z, w vectors
+            float factors[LANES];
+            __m128 from[4], to[4];
+            for (int l = 0; l < LANES; ++l) {
+                int s = lane[l];
+                int key = Bot::sampleKeys(keyTimes, channel.keyCount, times[s], keyCursors[s * channelCount + c],
+                                          factors[l]);
+                from[l] = _mm_loadu_ps(&values[key][0]);
+                to[l] = _mm_loadu_ps(&values[std::min(key + 1, channel.keyCount - 1)][0]);
+            }
+            _MM_TRANSPOSE4_PS(from[0], from[1], from[2], from[3]);
+            _MM_TRANSPOSE4_PS(to[0], to[1], to[2], to[3]);
+            __m128 factor = _mm_loadu_ps(factors);
+
+            Pose4 &pose = poses[channel.targetSlot];
+            if (channel.path == Bot::PATH_ROTATION) {
+                // Normalized lerp along the shorter arc
+                __m128 dot = madd(from[0], to[0], madd(from[1], to[1],
+                                  madd(from[2], to[2], _mm_mul_ps(from[3], to[3]))));
+                __m128 flip = _mm_and_ps(_mm_cmplt_ps(dot, _mm_setzero_ps()), _mm_set1_ps(-0.0f));
+                __m128 q[4];
+                for (int k = 0; k < 4; ++k) {
+                    q[k] = madd(_mm_sub_ps(_mm_xor_ps(to[k], flip), from[k]), factor, from[k]);
+                }
+                __m128 lengthSquared = madd(q[0], q[0], madd(q[1], q[1], madd(q[2], q[2], _mm_mul_ps(q[3], q[3]))));
+                __m128 inverseLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lengthSquared));
+                for (int k = 0; k < 4; ++k) {
+                    pose.rotation[k] = _mm_mul_ps(q[k], inverseLength);
+                }
+            } else {
+                __m128 *target = channel.path == Bot::PATH_TRANSLATION ? pose.translation : pose.scale;
+                for (int k = 0; k < 3; ++k) {
+                    target[k] = madd(_mm_sub_ps(to[k], from[k]), factor, from[k]);
+                }
+            }
+        }
+
+        // Hierarchy, parents always come before their children
+        for (int slot = 0; slot < slotCount; ++slot) {
+            int parent = skeleton.parents[slot];
+            if (parent < 0) {
+                compose(poses[slot], globals[slot]);
+            } else {
+                Affine4 local;
+                compose(poses[slot], local);
+                multiply(globals[parent], local, globals[slot]);
+            }
+        }
+
+        // Model matrices of the four lanes, transposed into the same layout
+        Affine4 model;
+        for (int row = 0; row < 3; ++row) {
+            __m128 r[4];
+            for (int l = 0; l < LANES; ++l) {
+                const glm::mat4 &m = modelMatrices[lane[l]];
+                r[l] = _mm_setr_ps(m[0][row], m[1][row], m[2][row], m[3][row]);
+            }
+            _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+            for (int column = 0; column < 4; ++column) {
+                model.m[row * 4 + column] = r[column];
+            }
+        }
+
+        // model * global * inverse bind, transposed back to three rows per lane
+        for (int j = 0; j < jointCount; ++j) {
+            Affine4 joint, world;
+            multiplyUniform(globals[skeleton.jointSlots[j]], &inverseBindRows[j * 3], joint);
+            multiply(model, joint, world);
+            for (int row = 0; row < 3; ++row) {
+                __m128 r0 = world.m[row * 4 + 0], r1 = world.m[row * 4 + 1];
+                __m128 r2 = world.m[row * 4 + 2], r3 = world.m[row * 4 + 3];
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                __m128 rows[LANES] = {r0, r1, r2, r3};
+                for (int l = 0; l < laneCount; ++l) {
+                    _mm_storeu_ps(&paletteRows[(static_cast<size_t>(lane[l]) * jointCount + j) * 3 + row][0],
+                                  rows[l]);
+                }
+            }
+        }
+    }
+#else
+    evaluateScalar(count, skeletons, times, modelMatrices, keyCursors, paletteRows);
+#endif
+}
@@ -0,0 +1,47 @@
+#ifndef ANIMATIONBATCH_H
+#define ANIMATIONBATCH_H
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "bot.h"
+
+// Evaluates the first clip of one Bot for many skeletons at once. Skeletons go
+// through in groups of four, one per SSE lane: the key search stays scalar per
+// lane, while key blending, quaternion nlerp, the TRS to matrix rebuild, the
+// hierarchy and the skinning products all run on structure of arrays data,
+// four skeletons per instruction. All matrices are kept as 3x4 affine rows,
+// which is also the palette layout the crowd shaders read.
+//
+// Callers split the skeletons into ranges across threads, evaluate only reads
+// the Bot and writes the cursors and palette rows of its own range.
+class AnimationBatch {
+public:
+    static const int LANES = 4;
+
+    void prepare(const Bot &bot);
+    // For count skeletons s, skeletons[i] or i when skeletons is null: plays the clip at times[s],
+    // applies modelMatrices[s] and writes three rows per joint from paletteRows[s * jointCount * 3].
+    // keyCursors holds channelCount entries per skeleton.
+    void evaluate(int count, const int *skeletons, const float *times, const glm::mat4 *modelMatrices,
+                  int *keyCursors, glm::vec4 *paletteRows) const;
+
+    // One skeleton at a time through Bot::evaluate instead of SSE, for benchmarks
+    void setSimd(bool enabled) { simd = enabled; }
+    bool isSimd() const;
+
+private:
+    const Bot *bot = nullptr;
+    int slotCount = 0;
+    int jointCount = 0;
+    int channelCount = 0;
+    bool simd = true;
+    // Every inverse bind matrix has (0, 0, 0, 1) as its bottom row
+    bool affine = true;
+    std::vector<glm::vec4> inverseBindRows; // Three rows per joint
+
+    void evaluateScalar(int count, const int *skeletons, const float *times, const glm::mat4 *modelMatrices,
+                        int *keyCursors, glm::vec4 *paletteRows) const;
+};
+
+#endif // ANIMATIONBATCH_H
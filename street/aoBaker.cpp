@@ -0,0 +1,323 @@
+#include "aoBaker.h"
+#include "jobSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+int AmbientOcclusionBaker::addBox(glm::vec3 center, glm::vec3 halfExtent) {
+    Box box;
+    box.min = center - halfExtent;
+    box.max = center + halfExtent;
+    boxes.push_back(box);
+    return static_cast<int>(boxes.size()) - 1;
+}
+
+void AmbientOcclusionBaker::setGround(glm::vec3 center, glm::vec2 halfExtent) {
+    hasGround = true;
+    groundCenter = center;
+    groundHalfExtent = halfExtent;
+}
+
+glm::vec2 AmbientOcclusionBaker::faceCoordinates(int face, glm::vec3 p) {
+    glm::vec3 t = (p + 1.0f) * 0.5f;
+    if (face < 2) return glm::vec2(t.x, t.y);  // Front, back
+    if (face < 4) return glm::vec2(t.z, t.y);  // Left, right
+    return glm::vec2(t.x, t.z);                // Top, bottom
+}
+
+void AmbientOcclusionBaker::buildNode(int nodeIndex, int begin, int end) {
+    glm::vec3 lo(1e30f), hi(-1e30f);
+    for (int i = begin; i < end; ++i) {
+        lo = glm::min(lo, boxes[boxOrder[i]].min);
+        hi = glm::max(hi, boxes[boxOrder[i]].max);
+    }
+    nodes[nodeIndex].min = lo;
+    nodes[nodeIndex].max = hi;
+
+    if (end - begin <= 2) {
+        nodes[nodeIndex].firstBox = begin;
+        nodes[nodeIndex].boxCount = end - begin;
+        return;
+    }
+
+    // Median split on the centroids along the longest axis
+    glm::vec3 extent = hi - lo;
+    int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+    int mid = (begin + end) / 2;
+    std::nth_element(boxOrder.begin() + begin, boxOrder.begin() + mid, boxOrder.begin() + end, [&](int a, int b) {
+        return boxes[a].min[axis] + boxes[a].max[axis] < boxes[b].min[axis] + boxes[b].max[axis];
+    });
+
+    nodes[nodeIndex].boxCount = 0;
+    int left = static_cast<int>(nodes.size());
+    nodes.push_back(BVHNode());
+    buildNode(left, begin, mid);
+    int right = static_cast<int>(nodes.size());
+    nodes.push_back(BVHNode());
+    nodes[nodeIndex].firstBox = right;
+    buildNode(right, mid, end);
+}
+
+// Slab test, returns the entry distance or a negative value on a miss
+static float intersectBox(glm::vec3 origin, glm::vec3 inverseDirection, glm::vec3 lo, glm::vec3 hi, float maxDistance) {
+    glm::vec3 t0 = (lo - origin) * inverseDirection;
+    glm::vec3 t1 = (hi - origin) * inverseDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    float tEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+    return tEnter <= tExit ? tEnter : -1.0f;
+}
+
+bool AmbientOcclusionBaker::occluded(glm::vec3 origin, glm::vec3 direction, float maxDistance) const {
+    if (hasGround && direction.y < 0.0f && origin.y > groundCenter.y) {
+        if ((groundCenter.y - origin.y) / direction.y < maxDistance) {
+            return true;
+        }
+    }
+    if (nodes.empty()) {
+        return false;
+    }
+
+    glm::vec3 inverseDirection = 1.0f / direction;
+    int stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        const BVHNode &node = nodes[stack[--stackSize]];
+        if (intersectBox(origin, inverseDirection, node.min, node.max, maxDistance) < 0.0f) {
+            continue;
+        }
+        if (node.boxCount > 0) {
+            for (int i = node.firstBox; i < node.firstBox + node.boxCount; ++i) {
+                const Box &box = boxes[boxOrder[i]];
+                if (intersectBox(origin, inverseDirection, box.min, box.max, maxDistance) >= 0.0f) {
+                    return true;
+                }
+            }
+        } else {
+            int nodeIndex = static_cast<int>(&node - nodes.data());
+            stack[stackSize++] = node.firstBox;
+            stack[stackSize++] = nodeIndex + 1;
+        }
+    }
+    return false;
+}
+
+static float radicalInverse(unsigned int bits) {
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return static_cast<float>(bits) * 2.3283064365386963e-10f;
+}
+
+static float hashToFloat(unsigned int x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return (x & 0xFFFFFF) / 16777216.0f;
+}
+
+void AmbientOcclusionBaker::bakeTile(const Tile &tile, glm::vec3 origin, glm::vec3 axisU, glm::vec3 axisV,
+                                     glm::vec3 normal, int raysPerTexel, float maxDistance) {
+    glm::vec3 tangent = glm::normalize(axisU);
+    glm::vec3 bitangent = glm::normalize(axisV);
+    const float twoPi = 6.28318530718f;
+
+    for (int j = 0; j < tile.size; ++j) {
+        for (int i = 0; i < tile.size; ++i) {
+            // Texels sit on the tile edges so sampling at the inset tile rectangle matches exactly
+            float s = static_cast<float>(i) / (tile.size - 1);
+            float t = static_cast<float>(j) / (tile.size - 1);
+            glm::vec3 position = origin + s * axisU + t * axisV + normal * 0.1f;
+
+            // Hammersley points, rotated per texel to turn banding into noise
+            unsigned int seed = static_cast<unsigned int>((tile.y + j) * atlasWidth + tile.x + i);
+            glm::vec2 rotation(hashToFloat(seed * 2u), hashToFloat(seed * 2u + 1u));
+            int hits = 0;
+            for (int k = 0; k < raysPerTexel; ++k) {
+                float u1 = std::fmod(static_cast<float>(k) / raysPerTexel + rotation.x, 1.0f);
+                float u2 = std::fmod(radicalInverse(k) + rotation.y, 1.0f);
+
+                // Cosine weighted hemisphere direction
+                float r = std::sqrt(u1);
+                float phi = twoPi * u2;
+                glm::vec3 direction = r * std::cos(phi) * tangent + r * std::sin(phi) * bitangent +
+                                      std::sqrt(std::max(0.0f, 1.0f - u1)) * normal;
+                if (occluded(position, direction, maxDistance)) {
+                    hits++;
+                }
+            }
+
+            float visibility = 1.0f - static_cast<float>(hits) / raysPerTexel;
+            atlas[(tile.y + j) * atlasWidth + tile.x + i] = static_cast<unsigned char>(visibility * 255.0f + 0.5f);
+        }
+    }
+}
+
+void AmbientOcclusionBaker::bake(int faceTileSize, int groundTileSize, int raysPerTexel, float maxDistance,
+                                 const char *cachePath) {
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    // BVH over all boxes
+    boxOrder.resize(boxes.size());
+    for (size_t i = 0; i < boxes.size(); ++i) {
+        boxOrder[i] = static_cast<int>(i);
+    }
+    nodes.clear();
+    if (!boxes.empty()) {
+        nodes.push_back(BVHNode());
+        buildNode(0, 0, static_cast<int>(boxes.size()));
+    }
+
+    // Atlas layout: ground tile and an unoccluded tile on the first shelf,
+    // then one row after another of face tiles
+    atlasWidth = std::max(1024, groundTileSize + 4);
+    int tilesPerRow = atlasWidth / faceTileSize;
+    int faceCount = static_cast<int>(boxes.size()) * 6;
+    int rows = (faceCount + tilesPerRow - 1) / tilesPerRow;
+    atlasHeight = groundTileSize + rows * faceTileSize;
+    atlas.assign(atlasWidth * atlasHeight, 255);
+
+    groundTileRect = {0, 0, groundTileSize};
+    whiteTileRect = {groundTileSize, 0, 4};
+    faceTiles.resize(faceCount);
+    for (int f = 0; f < faceCount; ++f) {
+        faceTiles[f] = {(f % tilesPerRow) * faceTileSize, groundTileSize + (f / tilesPerRow) * faceTileSize,
+                        faceTileSize};
+    }
+
+    unsigned long long hash = inputHash(raysPerTexel, maxDistance);
+    if (cachePath && loadCache(cachePath, hash)) {
+        std::cout << "Loaded ambient occlusion from " << cachePath << std::endl;
+        return;
+    }
+
+    // One job per tile
+    struct TileJob {
+        Tile tile;
+        glm::vec3 origin, axisU, axisV, normal;
+    };
+    std::vector<TileJob> jobs;
+    if (hasGround) {
+        glm::vec3 origin = groundCenter - glm::vec3(groundHalfExtent.x, 0.0f, groundHalfExtent.y);
+        jobs.push_back({groundTileRect, origin, glm::vec3(2.0f * groundHalfExtent.x, 0.0f, 0.0f),
+                        glm::vec3(0.0f, 0.0f, 2.0f * groundHalfExtent.y), glm::vec3(0.0f, 1.0f, 0.0f)});
+    }
+    for (size_t b = 0; b < boxes.size(); ++b) {
+        glm::vec3 lo = boxes[b].min, hi = boxes[b].max;
+        glm::vec3 size = hi - lo;
+        glm::vec3 dx(size.x, 0.0f, 0.0f), dy(0.0f, size.y, 0.0f), dz(0.0f, 0.0f, size.z);
+        const Tile *tiles = &faceTiles[b * 6];
+        jobs.push_back({tiles[0], glm::vec3(lo.x, lo.y, hi.z), dx, dy, glm::vec3(0.0f, 0.0f, 1.0f)});
+        jobs.push_back({tiles[1], lo, dx, dy, glm::vec3(0.0f, 0.0f, -1.0f)});
+        jobs.push_back({tiles[2], lo, dz, dy, glm::vec3(-1.0f, 0.0f, 0.0f)});
+        jobs.push_back({tiles[3], glm::vec3(hi.x, lo.y, lo.z), dz, dy, glm::vec3(1.0f, 0.0f, 0.0f)});
+        jobs.push_back({tiles[4], glm::vec3(lo.x, hi.y, lo.z), dx, dz, glm::vec3(0.0f, 1.0f, 0.0f)});
+        jobs.push_back({tiles[5], lo, dx, dz, glm::vec3(0.0f, -1.0f, 0.0f)});
+    }
+
+    parallelFor(static_cast<int>(jobs.size()), 1, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            const TileJob &job = jobs[i];
+            bakeTile(job.tile, job.origin, job.axisU, job.axisV, job.normal, raysPerTexel, maxDistance);
+        }
+    });
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+    std::cout << "Baked ambient occlusion: " << boxes.size() << " boxes, " << nodes.size() << " BVH nodes, "
+              << atlasWidth << "x" << atlasHeight << " atlas, " << raysPerTexel << " rays per texel, "
+              << ms << " ms" << std::endl;
+
+    if (cachePath) {
+        saveCache(cachePath, hash);
+    }
+}
+
+// FNV-1a over everything that affects the baked atlas
+unsigned long long AmbientOcclusionBaker::inputHash(int raysPerTexel, float maxDistance) const {
+    unsigned long long hash = 14695981039346656037ULL;
+    auto mix = [&hash](const void *data, size_t size) {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+    };
+    for (const Box &box: boxes) {
+        mix(&box.min[0], sizeof(glm::vec3));
+        mix(&box.max[0], sizeof(glm::vec3));
+    }
+    mix(&hasGround, sizeof(hasGround));
+    mix(&groundCenter[0], sizeof(glm::vec3));
+    mix(&groundHalfExtent[0], sizeof(glm::vec2));
+    mix(&atlasWidth, sizeof(atlasWidth));
+    mix(&atlasHeight, sizeof(atlasHeight));
+    mix(&groundTileRect.size, sizeof(int));
+    for (const Tile &tile: faceTiles) {
+        mix(&tile, sizeof(Tile));
+    }
+    mix(&raysPerTexel, sizeof(raysPerTexel));
+    mix(&maxDistance, sizeof(maxDistance));
+    return hash;
+}
+
+bool AmbientOcclusionBaker::loadCache(const char *cachePath, unsigned long long hash) {
+    std::ifstream file(cachePath, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    unsigned long long fileHash = 0;
+    file.read(reinterpret_cast<char *>(&fileHash), sizeof(fileHash));
+    if (!file || fileHash != hash) {
+        return false;
+    }
+    std::vector<unsigned char> cached(atlas.size());
+    file.read(reinterpret_cast<char *>(cached.data()), cached.size());
+    if (!file) {
+        return false;
+    }
+    atlas.swap(cached);
+    return true;
+}
+
+void AmbientOcclusionBaker::saveCache(const char *cachePath, unsigned long long hash) const {
+    std::ofstream file(cachePath, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Failed to write ambient occlusion cache " << cachePath << std::endl;
+        return;
+    }
+    file.write(reinterpret_cast<const char *>(&hash), sizeof(hash));
+    file.write(reinterpret_cast<const char *>(atlas.data()), atlas.size());
+}
+
+GLuint AmbientOcclusionBaker::createTexture() const {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, atlasWidth, atlasHeight, 0, GL_RED, GL_UNSIGNED_BYTE, atlas.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    return texture;
+}
+
+glm::vec4 AmbientOcclusionBaker::faceTile(int box, int face) const {
+    return tileRect(faceTiles[box * 6 + face]);
+}
+
+glm::vec4 AmbientOcclusionBaker::tileRect(const Tile &tile) const {
+    return glm::vec4((tile.x + 0.5f) / atlasWidth, (tile.y + 0.5f) / atlasHeight,
+                     (tile.size - 1.0f) / atlasWidth, (tile.size - 1.0f) / atlasHeight);
+}
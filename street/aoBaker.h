@@ -0,0 +1,68 @@
+#ifndef AOBAKER_H
+#define AOBAKER_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Startup-time ambient occlusion bake for the static city. Every box face and
+// the ground get a tile in one R8 lightmap atlas; each texel is traced with
+// cosine-distributed rays against a BVH over the boxes and the ground plane.
+// Faces are numbered like the Building vertex data: front (+Z), back (-Z),
+// left (-X), right (+X), top (+Y), bottom (-Y).
+class AmbientOcclusionBaker {
+public:
+    // Boxes span center - halfExtent to center + halfExtent, like Building
+    int addBox(glm::vec3 center, glm::vec3 halfExtent);
+    // Horizontal ground quad that receives occlusion and blocks rays below it
+    void setGround(glm::vec3 center, glm::vec2 halfExtent);
+    // Traces the atlas, or loads it from cachePath when the cache was baked from the same input
+    void bake(int faceTileSize, int groundTileSize, int raysPerTexel, float maxDistance, const char *cachePath);
+    GLuint createTexture() const;
+
+    // Atlas rectangles as (offset, size) in texture coordinates, inset by half a texel
+    glm::vec4 faceTile(int box, int face) const;
+    glm::vec4 groundTile() const { return tileRect(groundTileRect); }
+    glm::vec4 unoccludedTile() const { return tileRect(whiteTileRect); }
+
+    // Position of a canonical [-1, 1] box vertex inside its face tile, in [0, 1]
+    static glm::vec2 faceCoordinates(int face, glm::vec3 canonicalPosition);
+
+private:
+    struct Box {
+        glm::vec3 min, max;
+    };
+    struct BVHNode {
+        glm::vec3 min, max;
+        int firstBox; // Leaves: first entry in boxOrder, inner nodes: right child
+        int boxCount; // 0 for inner nodes, the left child directly follows its parent
+    };
+    struct Tile {
+        int x, y, size;
+    };
+
+    std::vector<Box> boxes;
+    std::vector<int> boxOrder;
+    std::vector<BVHNode> nodes;
+
+    bool hasGround = false;
+    glm::vec3 groundCenter;
+    glm::vec2 groundHalfExtent;
+
+    int atlasWidth = 0, atlasHeight = 0;
+    std::vector<unsigned char> atlas;
+    std::vector<Tile> faceTiles;
+    Tile groundTileRect = {0, 0, 0};
+    Tile whiteTileRect = {0, 0, 0};
+
+    void buildNode(int nodeIndex, int begin, int end);
+    bool occluded(glm::vec3 origin, glm::vec3 direction, float maxDistance) const;
+    void bakeTile(const Tile &tile, glm::vec3 origin, glm::vec3 axisU, glm::vec3 axisV, glm::vec3 normal,
+                  int raysPerTexel, float maxDistance);
+    glm::vec4 tileRect(const Tile &tile) const;
+    unsigned long long inputHash(int raysPerTexel, float maxDistance) const;
+    bool loadCache(const char *cachePath, unsigned long long hash);
+    void saveCache(const char *cachePath, unsigned long long hash) const;
+};
+
+#endif // AOBAKER_H
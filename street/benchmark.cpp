@@ -0,0 +1,666 @@
+// CPU benchmarks for the simulation code, run without a window or GL context.
+// Usage: street_benchmark [name ...], runs every benchmark when no name is given.
+
+#include "particle.h"
+#include "particleManager.h"
+#include "jobSystem.h"
+#include "radixSort.h"
+#include "sdfGrid.h"
+#include "flock.h"
+#include "bot.h"
+#include "animationBake.h"
+#include "animationBatch.h"
+#include "botCrowd.h"
+#include "vertexQuantization.h"
+#include "meshOptimizer.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Every heap allocation of the process goes through here, so benchmarks can check
+// that a steady-state update allocates nothing
+static std::atomic<long long> allocationCount{0};
+
+// The replacements below pair malloc with free through these two only, so the
+// compiler never sees free applied to the result of a new expression
+static void *countedAllocate(size_t size, size_t alignment) {
+    allocationCount++;
+    size = size ? size : 1;
+    void *pointer;
+    if (alignment <= alignof(std::max_align_t)) {
+        pointer = std::malloc(size);
+    } else {
+#ifdef _WIN32
+        pointer = _aligned_malloc(size, alignment);
+#else
+        // aligned_alloc wants a size that is a multiple of the alignment
+        pointer = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+    }
+    if (!pointer) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+static void countedFree(void *pointer, size_t alignment) {
+#ifdef _WIN32
+    if (alignment > alignof(std::max_align_t)) {
+        _aligned_free(pointer);
+        return;
+    }
+#endif
+    std::free(pointer);
+}
+
+void *operator new(size_t size) {
+    return countedAllocate(size, alignof(std::max_align_t));
+}
+
+void operator delete(void *pointer) noexcept {
+    countedFree(pointer, alignof(std::max_align_t));
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    countedFree(pointer, alignof(std::max_align_t));
+}
+
+#ifdef __cpp_aligned_new
+void *operator new(size_t size, std::align_val_t alignment) {
+    return countedAllocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *pointer, std::align_val_t alignment) noexcept {
+    countedFree(pointer, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *pointer, size_t, std::align_val_t alignment) noexcept {
+    countedFree(pointer, static_cast<size_t>(alignment));
+}
+#endif
+
+// Runs the function repeatedly for at least minMs and returns the average ms per call
+static double timeMs(const std::function<void()> &function, double minMs = 200.0) {
+    function(); // Warm up
+    int iterations = 0;
+    auto startTime = std::chrono::high_resolution_clock::now();
+    double elapsed = 0.0;
+    do {
+        function();
+        iterations++;
+        elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+    } while (elapsed < minMs);
+    return elapsed / iterations;
+}
+
+// Loads the bot model the bot benchmarks share, relative to the build directory
+static bool prepareBot(Bot &bot) {
+    if (!bot.prepare("../street/model/bot/bot.gltf")) {
+        std::cout << "  bot.gltf not found, run from the build directory" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static float randomFloat() {
+    return static_cast<float>(rand()) / RAND_MAX;
+}
+
+// The array-of-structures layout the particle system used before, kept for comparison
+struct LegacyParticle {
+    glm::vec3 position;
+    glm::vec4 color;
+    glm::vec3 velocity;
+    float size;
+    float lifeTime;
+    glm::vec3 randomOffset;
+};
+
+static void benchmarkParticles() {
+    std::cout << "Particle update (ms per frame, bytes streamed per particle)" << std::endl;
+    const glm::vec3 start(0.0f), end(0.0f, 50.0f, 0.0f);
+    const float deltaTime = 1.0f / 60.0f;
+
+    for (int count: {200, 100000, 1000000}) {
+        std::vector<LegacyParticle> legacy(count);
+        ParticleArrays particles;
+        particles.resize(count);
+        for (int i = 0; i < count; ++i) {
+            float t = static_cast<float>(i) / count;
+            glm::vec3 offset((rand() / (float) RAND_MAX - 0.5f) * 200.0f, (rand() / (float) RAND_MAX - 0.5f) * 50.0f,
+                             (rand() / (float) RAND_MAX - 0.5f) * 200.0f);
+            legacy[i].lifeTime = t;
+            legacy[i].randomOffset = offset;
+            particles.lifeTime[i] = t;
+            particles.offsetX[i] = offset.x;
+            particles.offsetY[i] = offset.y;
+            particles.offsetZ[i] = offset.z;
+        }
+
+        // Includes the copy into a staging buffer to stand in for the upload
+        std::vector<char> staging(sizeof(LegacyParticle) * count);
+        double legacyMs = timeMs([&]() {
+            for (auto &particle: legacy) {
+                particle.lifeTime += deltaTime * 0.1f;
+                if (particle.lifeTime >= 1.0f) {
+                    particle.lifeTime -= 1.0f;
+                }
+                particle.position = glm::mix(start, end, particle.lifeTime) + particle.randomOffset;
+            }
+            memcpy(staging.data(), legacy.data(), sizeof(LegacyParticle) * count);
+        });
+        double scalarMs = timeMs([&]() {
+            updateParticlesScalar(particles, 0, deltaTime, start, end);
+            memcpy(staging.data(), particles.positions.data(), sizeof(float) * 3 * count);
+        });
+        double simdMs = timeMs([&]() {
+            updateParticles(particles, deltaTime, start, end);
+            memcpy(staging.data(), particles.positions.data(), sizeof(float) * 3 * count);
+        });
+
+        std::cout << "  " << count << " particles: AoS scalar " << legacyMs << " ms (" << sizeof(LegacyParticle)
+                  << " B), SoA scalar " << scalarMs << " ms, SoA SIMD " << simdMs << " ms (" << sizeof(float) * 3
+                  << " B), speedup " << legacyMs / simdMs << "x" << std::endl;
+    }
+}
+
+static void benchmarkEmitters() {
+    std::cout << "Particle manager, 64k particles split across emitters (ms per frame)" << std::endl;
+    const int totalParticles = 65536;
+    for (int emitterCount: {1, 16, 256, 4096}) {
+        ParticleManager manager;
+        manager.reserve(totalParticles + totalParticles / 8);
+        for (int i = 0; i < emitterCount; ++i) {
+            ParticleEmitter emitter;
+            emitter.start = glm::vec3(i * 10.0f, 0.0f, 0.0f);
+            emitter.end = emitter.start + glm::vec3(0.0f, 50.0f, 0.0f);
+            emitter.lifeTime = 2.0f;
+            emitter.spawnRate = static_cast<float>(totalParticles) / emitterCount / emitter.lifeTime;
+            manager.addEmitter(emitter);
+        }
+        double ms = timeMs([&]() { manager.simulate(1.0f / 60.0f); });
+        std::cout << "  " << emitterCount << " emitters: " << ms << " ms, " << manager.aliveCount() << " alive, "
+                  << manager.droppedCount() << " dropped spawns" << std::endl;
+    }
+
+    // 256 emitters on a 16x16 grid seen from one corner, so some are culled and some are distant
+    std::cout << "  with culling and LOD:" << std::endl;
+    for (bool withView: {false, true}) {
+        ParticleManager manager;
+        manager.reserve(totalParticles + totalParticles / 8);
+        for (int i = 0; i < 256; ++i) {
+            ParticleEmitter emitter;
+            emitter.start = glm::vec3((i % 16) * 150.0f, 0.0f, (i / 16) * 150.0f);
+            emitter.end = emitter.start + glm::vec3(0.0f, 50.0f, 0.0f);
+            emitter.lifeTime = 2.0f;
+            emitter.spawnRate = static_cast<float>(totalParticles) / 256 / emitter.lifeTime;
+            manager.addEmitter(emitter);
+        }
+        glm::vec3 camera(-100.0f, 100.0f, -100.0f);
+        glm::mat4 vp = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 5000.0f) *
+                       glm::lookAt(camera, glm::vec3(1000.0f, 0.0f, 300.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        double ms = timeMs([&]() {
+            if (withView) {
+                manager.setView(vp, camera);
+            }
+            manager.simulate(1.0f / 60.0f);
+        });
+        std::cout << "    " << (withView ? "view" : "no view") << ": " << ms << " ms, "
+                  << manager.visibleEmitterCount() << "/256 emitters visible, " << manager.simulatedCount()
+                  << " simulated, " << manager.aliveCount() << " drawn" << std::endl;
+    }
+}
+
+// Synthetic ALU load, each item costs the same so the ideal speedup is the thread count
+static float syntheticWork(int item) {
+    float value = static_cast<float>(item);
+    for (int i = 0; i < 2000; ++i) {
+        value = std::sin(value) * 0.5f + std::cos(value * 1.3f);
+    }
+    return value;
+}
+
+static void benchmarkJobs() {
+    std::cout << "Job system core scaling, 4096 synthetic items (ms per run)" << std::endl;
+    const int items = 4096;
+    std::vector<float> results(items);
+    int hardwareThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    double singleMs = 0.0;
+
+    for (int threads = 1; threads <= hardwareThreads; threads *= 2) {
+        JobSystem::initialize(threads - 1);
+
+        // Two dependent stages: the second only starts after every job of the first finished
+        double ms = timeMs([&]() {
+            JobCounter firstStage, secondStage;
+            for (int chunk = 0; chunk < 16; ++chunk) {
+                JobSystem::run(firstStage, [&results, chunk]() {
+                    for (int i = chunk * items / 32; i < (chunk + 1) * items / 32; ++i) {
+                        results[i] = syntheticWork(i);
+                    }
+                });
+            }
+            JobSystem::runAfter(firstStage, secondStage, [&results]() {
+                parallelFor(items / 2, 64, [&results](int begin, int end) {
+                    for (int i = items / 2 + begin; i < items / 2 + end; ++i) {
+                        results[i] = syntheticWork(i) + results[i - items / 2];
+                    }
+                });
+            });
+            JobSystem::wait(secondStage);
+        });
+
+        JobSystem::shutdown();
+        if (threads == 1) {
+            singleMs = ms;
+        }
+        std::cout << "  " << threads << " threads: " << ms << " ms, speedup " << singleMs / ms << "x" << std::endl;
+        if (threads < hardwareThreads && threads * 2 > hardwareThreads) {
+            threads = hardwareThreads / 2; // Always measure all hardware threads last
+        }
+    }
+}
+
+static void benchmarkSort() {
+    std::cout << "Depth sort of 16 bit keys (ms per sort)" << std::endl;
+    JobSystem::initialize();
+    for (int count: {1000, 10000, 100000, 1000000}) {
+        std::vector<uint16_t> randomKeys(count), keys, keyScratch;
+        std::vector<uint32_t> order, orderScratch;
+        for (int i = 0; i < count; ++i) {
+            randomKeys[i] = static_cast<uint16_t>(rand() & 0xFFFF);
+        }
+        double radixMs = timeMs([&]() {
+            keys = randomKeys;
+            radixSort16(keys, order, keyScratch, orderScratch);
+        });
+        std::vector<std::pair<uint16_t, uint32_t>> pairs(count);
+        double stdMs = timeMs([&]() {
+            for (int i = 0; i < count; ++i) {
+                pairs[i] = std::make_pair(randomKeys[i], static_cast<uint32_t>(i));
+            }
+            std::stable_sort(pairs.begin(), pairs.end(),
+                             [](const std::pair<uint16_t, uint32_t> &a, const std::pair<uint16_t, uint32_t> &b) {
+                                 return a.first < b.first;
+                             });
+        });
+        bool same = true;
+        for (int i = 0; i < count; ++i) {
+            same = same && pairs[i].second == order[i];
+        }
+        std::cout << "  " << count << " keys: radix " << radixMs << " ms, std::stable_sort " << stdMs << " ms"
+                  << (same ? "" : " (ORDER MISMATCH)") << std::endl;
+    }
+    JobSystem::shutdown();
+}
+
+// Collision cost per particle should not depend on how many boxes were baked
+static void benchmarkCollision() {
+    std::cout << "Particle collision against a distance grid (ns per particle)" << std::endl;
+    const int particleCount = 100000;
+    std::vector<glm::vec3> positions(particleCount);
+    for (glm::vec3 &position: positions) {
+        position = glm::vec3(randomFloat() * 2000.0f - 1000.0f, randomFloat() * 700.0f - 130.0f,
+                             randomFloat() * 2000.0f - 1000.0f);
+    }
+
+    for (int boxCount: {25, 400}) {
+        SignedDistanceGrid grid;
+        for (int i = 0; i < boxCount; ++i) {
+            glm::vec3 halfExtent(15.0f + randomFloat() * 10.0f, 50.0f + randomFloat() * 100.0f,
+                                 15.0f + randomFloat() * 10.0f);
+            grid.addBox(glm::vec3(randomFloat() * 1800.0f - 900.0f, -130.0f + halfExtent.y,
+                                  randomFloat() * 1800.0f - 900.0f), halfExtent);
+        }
+        grid.setGround(-130.0f);
+        grid.build(glm::vec3(-1000.0f, -150.0f, -1000.0f), glm::vec3(1000.0f, 620.0f, 1000.0f), 20.0f, 60.0f);
+
+        std::vector<glm::vec3> moved(particleCount);
+        int contacts = 0;
+        double ms = timeMs([&]() {
+            contacts = 0;
+            for (int i = 0; i < particleCount; ++i) {
+                moved[i] = positions[i];
+                contacts += grid.collide(moved[i], 4.0f) ? 1 : 0;
+            }
+        });
+        std::cout << "  " << boxCount << " boxes: " << ms * 1e6 / particleCount << " ns, " << contacts
+                  << " contacts" << std::endl;
+    }
+}
+
+// Boids at a fixed density, so the neighbours per bird stay the same at every count
+static void benchmarkFlock() {
+    JobSystem::initialize();
+    std::cout << "Boids on a hashed grid, " << JobSystem::threadCount() << " threads (ms per step)" << std::endl;
+    for (int count: {10000, 100000, 1000000}) {
+        FlockSettings settings;
+        float side = std::cbrt(count * 3000.0f);
+        settings.boundsMin = glm::vec3(-0.5f * side);
+        settings.boundsMax = glm::vec3(0.5f * side);
+        Flock flock;
+        flock.reserve(count, settings);
+        for (int i = 0; i < 30; ++i) {
+            flock.simulate(1.0f / 60.0f); // Let the flocks form
+        }
+
+        double simdMs = timeMs([&]() { flock.simulate(1.0f / 60.0f); });
+        flock.setSimd(false);
+        double scalarMs = timeMs([&]() { flock.simulate(1.0f / 60.0f); });
+        std::cout << "  " << count << " birds: SSE " << simdMs << " ms, scalar " << scalarMs << " ms, "
+                  << flock.averageNeighbours() << " neighbours per bird, "
+                  << simdMs * 1e6 / count << " ns per bird" << std::endl;
+    }
+    JobSystem::shutdown();
+}
+
+static void benchmarkSkeleton() {
+    std::cout << "Bot skeleton update (us per update)" << std::endl;
+    Bot bot;
+    if (!prepareBot(bot)) {
+        return;
+    }
+    float time = 0.0f;
+    bot.update(time);
+
+    long long allocationsBefore = allocationCount;
+    const int updates = 1000;
+    for (int i = 0; i < updates; ++i) {
+        time += 1.0f / 60.0f;
+        bot.update(time);
+    }
+    long long allocations = allocationCount - allocationsBefore;
+
+    double ms = timeMs([&]() {
+        time += 1.0f / 60.0f;
+        bot.update(time);
+    });
+    std::cout << "  " << ms * 1000.0 << " us, " << allocations << " heap allocations in " << updates << " updates"
+              << std::endl;
+
+    // Clip sampling alone: playing forward steps the key cursors, random times search every channel
+    const int samples = 1000;
+    std::vector<float> randomTimes(samples);
+    for (float &randomTime: randomTimes) {
+        randomTime = randomFloat() * 45.0f;
+    }
+    double forwardMs = timeMs([&]() {
+        for (int i = 0; i < samples; ++i) {
+            time += 1.0f / 60.0f;
+            bot.samplePose(time);
+        }
+    });
+    double randomMs = timeMs([&]() {
+        for (float randomTime: randomTimes) {
+            bot.samplePose(randomTime);
+        }
+    });
+    double channelSamples = static_cast<double>(samples) * bot.channelCount();
+    std::cout << "  clip sampling, " << bot.channelCount() << " channels: forward "
+              << channelSamples / (forwardMs * 1000.0) << " M channels/s, random seek "
+              << channelSamples / (randomMs * 1000.0) << " M channels/s" << std::endl;
+}
+
+static void benchmarkCrowd() {
+    JobSystem::initialize();
+    std::cout << "Bot crowd palettes, " << JobSystem::threadCount() << " threads (ms per frame)" << std::endl;
+    Bot bot;
+    if (!prepareBot(bot)) {
+        JobSystem::shutdown();
+        return;
+    }
+    for (int count: {1000, 10000}) {
+        BotCrowd crowd;
+        crowd.reserve(bot, count);
+        float time = 0.0f;
+        auto step = [&]() {
+            time += 1.0f / 60.0f;
+            crowd.simulate(time);
+        };
+        double simdMs = timeMs(step);
+        crowd.setSimd(false);
+        double scalarMs = timeMs(step);
+        std::cout << "  " << count << " bots: SSE " << simdMs << " ms, " << count * bot.jointCount() / simdMs
+                  << " joints/ms, scalar " << scalarMs << " ms, " << count * bot.jointCount() / scalarMs
+                  << " joints/ms, " << crowd.paletteBytes() / (1024.0 * 1024.0) << " MB palette" << std::endl;
+    }
+
+    // Animation LOD, camera in the middle of a 10000 bot crowd
+    {
+        BotCrowd crowd;
+        crowd.reserve(bot, 10000);
+        crowd.setView(glm::perspective(glm::radians(90.0f), 16.0f / 9.0f, 10.0f, 5000.0f), glm::vec3(0.0f, -100.0f, 0.0f));
+        float time = 0.0f;
+        int minEvaluated = 10000, maxEvaluated = 0;
+        for (int frame = 0; frame < 16; ++frame) {
+            time += 1.0f / 60.0f;
+            crowd.simulate(time);
+            if (frame > 0) {
+                minEvaluated = std::min(minEvaluated, crowd.evaluatedCount());
+                maxEvaluated = std::max(maxEvaluated, crowd.evaluatedCount());
+            }
+        }
+        double lodMs = timeMs([&]() {
+            time += 1.0f / 60.0f;
+            crowd.simulate(time);
+        });
+        std::cout << "  LOD, 10000 bots: " << crowd.lodCount(BotCrowd::LOD_FULL) << " full, "
+                  << crowd.lodCount(BotCrowd::LOD_HALF) << " half, " << crowd.lodCount(BotCrowd::LOD_QUARTER)
+                  << " quarter, " << crowd.lodCount(BotCrowd::LOD_BAKED) << " baked, " << minEvaluated << "-"
+                  << maxEvaluated << " evaluated per frame, " << lodMs << " ms, "
+                  << crowd.paletteBytes() / (1024.0 * 1024.0) << " MB palette" << std::endl;
+    }
+
+    // Batched against one at a time: nlerp instead of slerp is the only difference
+    const int skeletons = 256;
+    AnimationBatch batch;
+    batch.prepare(bot);
+    std::vector<float> clipTimes(skeletons);
+    std::vector<glm::mat4> modelMatrices(skeletons, glm::mat4(1.0f));
+    std::vector<int> batchCursors(skeletons * bot.channelCount(), 0), scalarCursors = batchCursors;
+    std::vector<glm::vec4> batchRows(skeletons * bot.jointCount() * 3), scalarRows = batchRows;
+    for (float &clipTime: clipTimes) {
+        clipTime = randomFloat() * bot.clipDuration();
+    }
+    batch.evaluate(skeletons, nullptr, clipTimes.data(), modelMatrices.data(), batchCursors.data(), batchRows.data());
+    batch.setSimd(false);
+    batch.evaluate(skeletons, nullptr, clipTimes.data(), modelMatrices.data(), scalarCursors.data(), scalarRows.data());
+    float maxDifference = 0.0f;
+    for (size_t i = 0; i < batchRows.size(); ++i) {
+        maxDifference = std::max(maxDifference, glm::length(batchRows[i] - scalarRows[i]));
+    }
+    std::cout << "  batched vs scalar palette rows: " << maxDifference << " max difference" << std::endl;
+
+    // Baked playback costs nothing per frame on the CPU, check what the fixed rate loses against evaluation
+    Bot::AnimationScratch scratch;
+    bot.prepareScratch(scratch);
+    std::vector<int> keyCursors(bot.channelCount(), 0);
+    std::vector<glm::mat4> jointMatrices(bot.jointCount());
+    std::vector<float> times(1000);
+    for (float &time: times) {
+        time = randomFloat() * bot.clipDuration();
+    }
+    for (float framesPerSecond: {15.0f, 30.0f, 60.0f}) {
+        AnimationBake bake;
+        bake.bake(bot, framesPerSecond);
+        float maxError = 0.0f;
+        double totalError = 0.0;
+        for (float time: times) {
+            bot.evaluate(time, keyCursors.data(), scratch, jointMatrices.data());
+            for (int j = 0; j < bot.jointCount(); ++j) {
+                float error = glm::length(glm::vec3(bake.sample(j, time)[3] - jointMatrices[j][3]));
+                maxError = std::max(maxError, error);
+                totalError += error;
+            }
+        }
+        std::cout << "  baked at " << bake.frameRate() << " Hz: " << bake.frameCount() << " frames, "
+                  << bake.byteSize() / 1024.0 << " KB, " << bake.bakeMs() << " ms to bake, joint offset error "
+                  << totalError / (times.size() * bot.jointCount()) << " mean, " << maxError << " max" << std::endl;
+    }
+    JobSystem::shutdown();
+}
+
+static void benchmarkVertices() {
+    std::cout << "Packed vertex formats" << std::endl;
+    Bot bot;
+    if (!prepareBot(bot)) {
+        return;
+    }
+    const Bot::VertexPackingReport &report = bot.vertexPacking();
+    std::cout << "  bot, " << report.vertexCount << " vertices: " << report.loadedBytesPerVertex << " bytes as loaded, "
+              << report.packedBytesPerVertex << " packed" << std::endl;
+    std::cout << "  max error: position " << report.maxPositionError << ", normal " << report.maxNormalError
+              << " degrees, uv " << report.maxUVError << ", weight " << report.maxWeightError << std::endl;
+
+    // Every instance fetches its vertices again, this is what the crowd reads per frame at most
+    for (int count: {1000, 10000}) {
+        double loadedMB = static_cast<double>(count) * report.vertexCount * report.loadedBytesPerVertex / (1024.0 * 1024.0);
+        double packedMB = static_cast<double>(count) * report.vertexCount * report.packedBytesPerVertex / (1024.0 * 1024.0);
+        std::cout << "  " << count << " bots: " << loadedMB << " MB of vertex fetch per frame as loaded, " << packedMB
+                  << " MB packed" << std::endl;
+    }
+
+    // Encoders against their decoders over the ranges the meshes use
+    float maxHalfError = 0.0f, maxNormalDegrees = 0.0f;
+    for (int i = 0; i < 100000; ++i) {
+        float value = randomFloat() * 8.0f - 4.0f;
+        maxHalfError = std::max(maxHalfError, std::abs(glm::unpackHalf1x16(glm::packHalf1x16(value)) - value));
+        glm::vec3 normal = glm::normalize(glm::vec3(randomFloat(), randomFloat(), randomFloat()) * 2.0f - 1.0f);
+        glm::vec4 decoded = glm::unpackSnorm3x10_1x2(glm::packSnorm3x10_1x2(glm::vec4(normal, 0.0f)));
+        float cosine = glm::dot(normal, glm::normalize(glm::vec3(decoded)));
+        maxNormalDegrees = std::max(maxNormalDegrees, glm::degrees(std::acos(std::min(cosine, 1.0f))));
+    }
+    std::cout << "  half float in [-4, 4]: " << maxHalfError << " max error, 2_10_10_10 normals: "
+              << maxNormalDegrees << " degrees max" << std::endl;
+}
+
+static void benchmarkMeshes() {
+    std::cout << "Vertex cache optimization (FIFO 16)" << std::endl;
+
+    // A regular grid with its triangles shuffled, the worst case input
+    const int size = 200;
+    std::vector<uint32_t> grid;
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            uint32_t corner = y * (size + 1) + x;
+            uint32_t quad[6] = {corner, corner + 1, corner + size + 1, corner + 1, corner + size + 2, corner + size + 1};
+            grid.insert(grid.end(), quad, quad + 6);
+        }
+    }
+    size_t gridVertices = (size + 1) * (size + 1);
+    for (size_t t = grid.size() / 3 - 1; t > 0; --t) {
+        size_t other = static_cast<size_t>(randomFloat() * (t + 1)) % (t + 1);
+        std::swap_ranges(grid.begin() + t * 3, grid.begin() + t * 3 + 3, grid.begin() + other * 3);
+    }
+    VertexCacheStats before = analyzeVertexCache(grid, gridVertices);
+    std::vector<uint32_t> optimized;
+    double ms = timeMs([&]() {
+        optimized = grid;
+        optimizeVertexCache(optimized, gridVertices);
+    });
+    VertexCacheStats after = analyzeVertexCache(optimized, gridVertices);
+    std::cout << "  shuffled grid, " << grid.size() / 3 << " triangles: ACMR " << before.acmr << " -> " << after.acmr
+              << ", ATVR " << before.atvr << " -> " << after.atvr << ", " << ms << " ms, "
+              << grid.size() / 3 / (ms * 1000.0) << " M triangles/s" << std::endl;
+
+    Bot bot;
+    if (!prepareBot(bot)) {
+        return;
+    }
+    for (const Bot::MeshOptimizationReport &mesh: bot.meshOptimization()) {
+        std::cout << "  bot mesh " << mesh.mesh << ", " << mesh.triangleCount << " triangles, " << mesh.vertexCount
+                  << " vertices: ACMR " << mesh.before.acmr << " -> " << mesh.after.acmr << ", ATVR "
+                  << mesh.before.atvr << " -> " << mesh.after.atvr
+                  << (mesh.overdrawSorted ? ", sorted for overdraw" : ", overdraw sort dropped") << std::endl;
+    }
+}
+
+static void benchmarkLod() {
+    JobSystem::initialize();
+    std::cout << "Mesh LOD chain" << std::endl;
+    Bot bot;
+    if (!prepareBot(bot)) {
+        JobSystem::shutdown();
+        return;
+    }
+    for (const Bot::MeshLodReport &lod: bot.meshLods()) {
+        std::cout << "  bot mesh " << lod.mesh << " LOD " << lod.level << ": " << lod.triangleCount
+                  << " triangles, error " << lod.error << std::endl;
+    }
+    std::cout << "  model:";
+    for (int level = 0; level < bot.lodLevelCount(); ++level) {
+        std::cout << " " << bot.lodTriangleCount(level);
+    }
+    std::cout << " triangles, built in " << bot.lodBuildMs() << " ms" << std::endl;
+
+    // Camera in the middle of a 10000 bot crowd, swaying back and forth by a few units
+    BotCrowd crowd;
+    crowd.reserve(bot, 10000);
+    glm::mat4 projection = glm::perspective(glm::radians(90.0f), 16.0f / 9.0f, 10.0f, 5000.0f);
+    float time = 0.0f;
+    int frame = 0, changes = 0;
+    auto step = [&]() {
+        time += 1.0f / 60.0f;
+        crowd.setView(projection, glm::vec3(4.0f * std::sin(frame * 0.5f), -100.0f, 0.0f));
+        crowd.simulate(time);
+        if (frame++ > 0) {
+            changes += crowd.meshLodChanges();
+        }
+    };
+    for (int i = 0; i < 64; ++i) {
+        step();
+    }
+    std::cout << "  10000 bots, levels";
+    for (int level = 0; level < bot.lodLevelCount(); ++level) {
+        std::cout << " " << crowd.meshLodCount(level);
+    }
+    std::cout << ": " << crowd.triangleCount() / 1e6 << " M triangles drawn, " << crowd.fullTriangleCount() / 1e6
+              << " M without LOD, " << changes / 63.0f << " level changes per frame with a swaying camera" << std::endl;
+    JobSystem::shutdown();
+}
+
+int main(int argc, char *argv[]) {
+    struct Benchmark {
+        const char *name;
+        void (*run)();
+    };
+    const Benchmark benchmarks[] = {
+            {"particles", benchmarkParticles},
+            {"emitters", benchmarkEmitters},
+            {"jobs", benchmarkJobs},
+            {"sort", benchmarkSort},
+            {"collision", benchmarkCollision},
+            {"flock", benchmarkFlock},
+            {"skeleton", benchmarkSkeleton},
+            {"crowd", benchmarkCrowd},
+            {"vertices", benchmarkVertices},
+            {"meshes", benchmarkMeshes},
+            {"lod", benchmarkLod},
+    };
+
+    for (const Benchmark &benchmark: benchmarks) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i) {
+            selected = selected || std::string(argv[i]) == benchmark.name;
+        }
+        if (selected) {
+            benchmark.run();
+        }
+    }
+    return 0;
+}
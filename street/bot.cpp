@@ -1,8 +1,14 @@
 
 #include "bot.h"
 #include <render/shader.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <limits>
 #define TINYGLTF_IMPLEMENTATION
 #include <tinygltf-2.9.3/tiny_gltf.h>
 
@@ -10,9 +16,21 @@
 
 static glm::vec3 lightIntensity(5e6f, 5e6f, 5e6f);
 static glm::vec3 lightPosition(-275.0f, 500.0f, 800.0f);
-
-
-Bot::Bot() : mvpMatrixID(0), jointMatricesID(0), lightPositionID(0), lightIntensityID(0), programID(0) {}
+// Skinned position and normal, interleaved as botSkin.vert writes them
+static const int SKINNED_VERTEX_SIZE = 6 * sizeof(float);
+// Mesh LOD levels, level 0 being the full mesh: share of its triangles aimed for,
+// and the error allowed on the way there, relative to the size of the model
+static const int LOD_LEVEL_COUNT = 4;
+static const float LOD_TRIANGLE_RATIOS[LOD_LEVEL_COUNT] = {1.0f, 0.5f, 0.25f, 0.1f};
+static const float LOD_MAX_ERRORS[LOD_LEVEL_COUNT] = {0.0f, 0.004f, 0.01f, 0.03f};
+// Scale of UVs and skin weights against position error while simplifying, a
+// collapse between two vertices bound to different joints costs about this much
+static const float LOD_UV_WEIGHT = 0.05f;
+static const float LOD_SKIN_WEIGHT = 0.02f;
+
+
+Bot::Bot() : mvpMatrixID(0), lightPositionID(0), lightIntensityID(0), modelMatrixID(0),
+             normalMatrixID(0), cameraPositionID(0), programID(0) {}
 
 Bot::~Bot() {
     cleanup();
@@ -20,21 +38,15 @@ Bot::~Bot() {
 
 void Bot::initialize() {
     // Modify your path if needed
-    if (!loadModel(model, "../street/model/bot/bot.gltf")) {
+    if (!prepare("../street/model/bot/bot.gltf")) {
         return;
     }
 
     // Prepare buffers for rendering
-    primitiveObjects = bindModel(model);
-
-    // Prepare joint matrices
-    skinObjects = prepareSkinning(model);
-
-    // Prepare animation data
-    animationObjects = prepareAnimation(model);
+    bindModel(model);
 
     // Create and compile our GLSL program from the shaders
-    programID = LoadShadersFromFile("../street/bot.vert", "../street/bot.frag");
+    programID = LoadShadersFromFile("../street/bot.vert", "../street/bot.frag", "../street/clusterLighting.glsl");
     if (programID == 0)
     {
         std::cerr << "Failed to load shaders." << std::endl;
@@ -44,121 +56,239 @@ void Bot::initialize() {
     mvpMatrixID = glGetUniformLocation(programID, "MVP");
     lightPositionID = glGetUniformLocation(programID, "lightPosition");
     lightIntensityID = glGetUniformLocation(programID, "lightIntensity");
-    jointMatricesID = glGetUniformLocation(programID, "jointMatrices");
+    modelMatrixID = glGetUniformLocation(programID, "modelMatrix");
+    normalMatrixID = glGetUniformLocation(programID, "normalMatrix");
+    cameraPositionID = glGetUniformLocation(programID, "cameraPosition");
+
+    // Skinning runs once per frame into buffers shared by every pass
+    const char *skinVaryings[] = {"skinnedPosition", "skinnedNormal"};
+    skinProgramID = LoadTransformFeedbackShaderFromFile("../street/botSkin.vert", skinVaryings, 2);
+    if (skinProgramID == 0)
+    {
+        std::cerr << "Failed to load skinning shader." << std::endl;
+    }
+    skinJointMatricesID = glGetUniformLocation(skinProgramID, "jointMatrices");
+    skinDequantizeID = glGetUniformLocation(skinProgramID, "positionDequantize");
 }
 
-void Bot::update(float time) {
+bool Bot::prepare(const char *filename) {
+    if (!loadModel(model, filename)) {
+        return false;
+    }
 
-    // -------------------------------------------------
-    // TODO: your code here
-    // -------------------------------------------------
-    if (model.animations.size() > 0) {
-        const tinygltf::Animation &animation = model.animations[0];
-        const AnimationObject &animationObject = animationObjects[0];
+    // Flatten the skeleton and size the per-update scratch buffers
+    if (!model.skins.empty()) {
+        skeleton = prepareSkeleton(model, model.skins[0].joints[0]);
+        prepareScratch(scratch);
+    }
 
-        const tinygltf::Skin &skin = model.skins[0];
-        std::vector<glm::mat4> localTransforms(model.nodes.size(), glm::mat4(1.0f));
-        int rootNodeIndex = skin.joints[0];
+    // Prepare joint matrices
+    skinObjects = prepareSkinning(model);
 
-        // Initialize localTransforms with initial node transforms
-        computeLocalNodeTransform(model, rootNodeIndex, localTransforms);
+    // Prepare animation data
+    animationObjects = prepareAnimation(model);
+    if (!animationObjects.empty()) {
+        keyCursors.assign(animationObjects[0].channels.size(), 0);
+    }
 
-        // Update local transforms with animation data
-        updateAnimation(model, animation, animationObject, time, localTransforms);
+    // Flatten the scene into its primitives and pack their vertices
+    scenePrimitives.clear();
+    const tinygltf::Scene &scene = model.scenes[model.defaultScene];
+    for (size_t i = 0; i < scene.nodes.size(); ++i) {
+        collectPrimitives(model, scene.nodes[i]);
+    }
+    packedVertices = packVertices(model);
+    return true;
+}
 
-        // Recompute global transforms
-        std::vector<glm::mat4> globalTransforms(model.nodes.size(), glm::mat4(1.0f));
-        computeGlobalNodeTransform(model, localTransforms, rootNodeIndex, glm::mat4(1.0f), globalTransforms);
+void Bot::prepareScratch(AnimationScratch &scratch) const {
+    scratch.pose.resize(skeleton.nodes.size());
+    scratch.globalTransforms.resize(skeleton.nodes.size());
+}
 
-        // Update skinning
-        updateSkinning(model.skins[0], globalTransforms);
+float Bot::clipDuration() const {
+    float duration = 0.0f;
+    if (!animationObjects.empty()) {
+        const AnimationObject &animationObject = animationObjects[0];
+        for (const ChannelObject &channel: animationObject.channels) {
+            duration = std::max(duration, animationObject.times[channel.firstKey + channel.keyCount - 1]);
+        }
     }
+    return duration;
+}
 
+void Bot::samplePose(float time) {
+    // Start from the rest pose, then overwrite the animated components
+    std::copy(skeleton.restPose.begin(), skeleton.restPose.end(), scratch.pose.begin());
+    updateAnimation(animationObjects[0], time, keyCursors.data(), scratch.pose);
 }
 
-void Bot::render(glm::mat4 cameraMatrix) {
+void Bot::evaluate(float time, int *keyCursors, AnimationScratch &scratch, glm::mat4 *jointMatrices) const {
+    std::copy(skeleton.restPose.begin(), skeleton.restPose.end(), scratch.pose.begin());
+    updateAnimation(animationObjects[0], time, keyCursors, scratch.pose);
+    computeGlobalTransforms(scratch.pose, scratch.globalTransforms);
+    updateSkinning(scratch.globalTransforms, jointMatrices);
+}
+
+void Bot::update(float time) {
+    if (!animationObjects.empty() && !skeleton.nodes.empty()) {
+        evaluate(time, keyCursors.data(), scratch, skinObjects[0].jointMatrices.data());
+    }
+}
+
+void Bot::render(glm::mat4 cameraMatrix, glm::mat4 modelMatrix, const LightClusters &clusters, glm::vec3 cameraPosition) {
     glUseProgram(programID);
 
     // Set camera
-    glm::mat4 mvp = cameraMatrix;
+    glm::mat4 mvp = cameraMatrix * modelMatrix;
     glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
+    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelMatrix)));
+    glUniformMatrix4fv(modelMatrixID, 1, GL_FALSE, &modelMatrix[0][0]);
+    glUniformMatrix3fv(normalMatrixID, 1, GL_FALSE, &normalMatrix[0][0]);
+    glUniform3fv(cameraPositionID, 1, &cameraPosition[0]);
 
-    // -----------------------------------------------------------------
-    // TODO: Set animation data for linear blend skinning in shader
-    // -----------------------------------------------------------------
-    glUniformMatrix4fv(jointMatricesID, skinObjects[0].jointMatrices.size(), GL_FALSE, glm::value_ptr(skinObjects[0].jointMatrices[0]));
+    // Set light data
+    glUniform3fv(lightPositionID, 1, &lightPosition[0]);
+    glUniform3fv(lightIntensityID, 1, &lightIntensity[0]);
+    clusters.applyUniforms(programID);
 
+    // Draw the GLTF model, skinned by skin() this frame
+    drawSkinned();
+}
 
+void Bot::renderDepth(GLuint programID, glm::mat4 matrix, glm::mat4 modelMatrix) {
+    glUseProgram(programID);
+    // The same product as render, so the pre-pass depth matches the main pass exactly
+    glm::mat4 mvp = matrix * modelMatrix;
+    glUniformMatrix4fv(glGetUniformLocation(programID, "MVP"), 1, GL_FALSE, &mvp[0][0]);
+    drawSkinned();
+}
 
-    // -----------------------------------------------------------------
+void Bot::skin() {
+    lastSkinnedPasses = skinnedPasses;
+    skinnedPasses = 0;
+    if (skinProgramID == 0 || skinObjects.empty()) {
+        return;
+    }
 
-    // Set light data
-    glUniform3fv(lightPositionID, 1, &lightPosition[0]);
-    glUniform3fv(lightIntensityID, 1, &lightIntensity[0]);
+    glUseProgram(skinProgramID);
+    glUniformMatrix4fv(skinJointMatricesID, skinObjects[0].jointMatrices.size(), GL_FALSE,
+                       glm::value_ptr(skinObjects[0].jointMatrices[0]));
+    glm::mat4 dequantize = positionDequantize();
+    glUniformMatrix4fv(skinDequantizeID, 1, GL_FALSE, &dequantize[0][0]);
+    const std::vector<DrawRecord> &sources = packedVertices ? packedDrawRecords : drawRecords;
+
+    // One point per vertex, nothing is rasterized
+    glEnable(GL_RASTERIZER_DISCARD);
+    for (size_t i = 0; i < skinFeeds.size(); ++i) {
+        glBindVertexArray(sources[i].vao);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, skinFeeds[i].feedbackBufferID);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, skinFeeds[i].vertexCount);
+        glEndTransformFeedback();
+    }
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(0);
+}
+
+int Bot::skinnedVertexCount() const {
+    int count = 0;
+    for (const SkinFeed &feed : skinFeeds) {
+        count += feed.vertexCount;
+    }
+    return count;
+}
 
-    // Draw the GLTF model
-    drawModel(primitiveObjects, model);
+void Bot::drawSkinned() {
+    drawRecordList(packedVertices ? skinnedPackedDrawRecords : skinnedDrawRecords, 0);
+    skinnedPasses++;
 }
 
 void Bot::cleanup() {
-    glDeleteProgram(programID);
+    if (programID) {
+        glDeleteProgram(programID);
+        programID = 0;
+    }
+    if (skinProgramID) {
+        glDeleteProgram(skinProgramID);
+        skinProgramID = 0;
+    }
+    // Nothing below exists when only prepare ran, as in the benchmarks
+    for (size_t i = 0; i < drawRecords.size(); ++i) {
+        glDeleteVertexArrays(1, &drawRecords[i].vao);
+        glDeleteVertexArrays(1, &skinnedDrawRecords[i].vao);
+        glDeleteBuffers(1, &skinFeeds[i].feedbackBufferID);
+    }
+    for (size_t i = 0; i < packedDrawRecords.size(); ++i) {
+        glDeleteVertexArrays(1, &packedDrawRecords[i].vao);
+        glDeleteVertexArrays(1, &skinnedPackedDrawRecords[i].vao);
+    }
+    if (!packedBufferObjects.empty()) {
+        glDeleteBuffers(static_cast<GLsizei>(packedBufferObjects.size()), packedBufferObjects.data());
+        glDeleteBuffers(static_cast<GLsizei>(packedIndexBufferObjects.size()), packedIndexBufferObjects.data());
+    }
+    if (!bufferObjects.empty()) {
+        glDeleteBuffers(static_cast<GLsizei>(bufferObjects.size()), bufferObjects.data());
+    }
+    drawRecords.clear();
+    skinnedDrawRecords.clear();
+    packedDrawRecords.clear();
+    lodDrawRecords.clear();
+    skinnedPackedDrawRecords.clear();
+    skinFeeds.clear();
+    packedBufferObjects.clear();
+    packedIndexBufferObjects.clear();
+    bufferObjects.clear();
 }
 
-glm::mat4 Bot::getNodeTransform(const tinygltf::Node& node) {
-    glm::mat4 transform(1.0f);
+Bot::SkeletonObject Bot::prepareSkeleton(const tinygltf::Model &model, int rootNodeIndex) {
+    SkeletonObject skeleton;
+    skeleton.nodeSlots.assign(model.nodes.size(), -1);
+
+    // Breadth first from the root, so every parent gets its slot before its children
+    skeleton.nodes.push_back(rootNodeIndex);
+    skeleton.parents.push_back(-1);
+    skeleton.nodeSlots[rootNodeIndex] = 0;
+    for (size_t slot = 0; slot < skeleton.nodes.size(); ++slot) {
+        for (int childIndex : model.nodes[skeleton.nodes[slot]].children) {
+            skeleton.nodeSlots[childIndex] = static_cast<int>(skeleton.nodes.size());
+            skeleton.nodes.push_back(childIndex);
+            skeleton.parents.push_back(static_cast<int>(slot));
+        }
+    }
 
-    if (node.matrix.size() == 16) {
-        transform = glm::make_mat4(node.matrix.data());
-    } else {
+    skeleton.restPose.resize(skeleton.nodes.size());
+    for (size_t slot = 0; slot < skeleton.nodes.size(); ++slot) {
+        const tinygltf::Node &node = model.nodes[skeleton.nodes[slot]];
+        TransformComponents &rest = skeleton.restPose[slot];
         if (node.translation.size() == 3) {
-            transform = glm::translate(transform, glm::vec3(node.translation[0], node.translation[1], node.translation[2]));
+            rest.translation = glm::vec3(node.translation[0], node.translation[1], node.translation[2]);
         }
         if (node.rotation.size() == 4) {
-            glm::quat q(node.rotation[3], node.rotation[0], node.rotation[1], node.rotation[2]);
-            transform *= glm::mat4_cast(q);
+            rest.rotation = glm::quat(node.rotation[3], node.rotation[0], node.rotation[1], node.rotation[2]);
         }
         if (node.scale.size() == 3) {
-            transform = glm::scale(transform, glm::vec3(node.scale[0], node.scale[1], node.scale[2]));
+            rest.scale = glm::vec3(node.scale[0], node.scale[1], node.scale[2]);
         }
     }
-    return transform;
-}
-
-void Bot::computeLocalNodeTransform(const tinygltf::Model& model,
-        int nodeIndex,
-        std::vector<glm::mat4> &localTransforms)
-{
-    // ---------------------------------------
-    // TODO: your code here
-    // ---------------------------------------
-    const tinygltf::Node& node = model.nodes[nodeIndex];
-
-    // Compute the local transformation using the provided helper function.
-    localTransforms[nodeIndex] = getNodeTransform(node);
 
-    // Recursively compute the local transform for each child node.
-    for (int childIndex : node.children) {
-        computeLocalNodeTransform(model, childIndex, localTransforms);
+    for (int jointIndex : model.skins[0].joints) {
+        assert(skeleton.nodeSlots[jointIndex] >= 0);
+        skeleton.jointSlots.push_back(skeleton.nodeSlots[jointIndex]);
     }
-
+    return skeleton;
 }
 
-void Bot::computeGlobalNodeTransform(const tinygltf::Model& model,
-        const std::vector<glm::mat4> &localTransforms,
-        int nodeIndex, const glm::mat4& parentTransform,
-        std::vector<glm::mat4> &globalTransforms)
-{
-    // ----------------------------------------
-    // TODO: your code here
-    // ----------------------------------------
-    // Combine the parent's transform with the node's local transform.
-    globalTransforms[nodeIndex] = parentTransform * localTransforms[nodeIndex];
-
-    const tinygltf::Node& node = model.nodes[nodeIndex];
-
-    // Recursively compute the global transforms for child nodes.
-    for (int childIndex : node.children) {
-        computeGlobalNodeTransform(model, localTransforms, childIndex, globalTransforms[nodeIndex], globalTransforms);
+void Bot::computeGlobalTransforms(const std::vector<TransformComponents> &pose,
+                                  std::vector<glm::mat4> &globalTransforms) const {
+    // One linear pass, the parent of a slot is always already done
+    for (size_t slot = 0; slot < skeleton.nodes.size(); ++slot) {
+        glm::mat4 local = glm::translate(glm::mat4(1.0f), pose[slot].translation) *
+                          glm::mat4_cast(pose[slot].rotation) *
+                          glm::scale(glm::mat4(1.0f), pose[slot].scale);
+        int parent = skeleton.parents[slot];
+        globalTransforms[slot] = parent < 0 ? local : globalTransforms[parent] * local;
     }
 }
 
@@ -192,59 +322,24 @@ std::vector<Bot::SkinObject> Bot::prepareSkinning(const tinygltf::Model &model)
 			skinObject.globalJointTransforms.resize(skin.joints.size());
 			skinObject.jointMatrices.resize(skin.joints.size());
 
-			// ----------------------------------------------
-			// TODO: your code here to compute joint matrices
-			// ----------------------------------------------
-
-			// Prepare to compute node transforms
-			std::vector<glm::mat4> localTransforms(model.nodes.size(), glm::mat4(1.0f));
-			std::vector<glm::mat4> globalTransforms(model.nodes.size(), glm::mat4(1.0f));
-
-
-			// Compute transforms starting from the root node of the skeleton
-			int rootNodeIndex = 24;
-			computeLocalNodeTransform(model, rootNodeIndex, localTransforms);
-			// Compute global transforms starting from root nodes
-			computeGlobalNodeTransform(model, localTransforms,rootNodeIndex, glm::mat4(1.0f), globalTransforms);
-			// Step 3: Compute joint matrices
-			for (size_t j = 0; j < skin.joints.size(); j++) {
-				int jointIndex = skin.joints[j];
-				skinObject.jointMatrices[j] = globalTransforms[jointIndex] * skinObject.inverseBindMatrices[j];
+			// Joint matrices of the rest pose, only the first skin has a skeleton
+			if (i == 0) {
+				computeGlobalTransforms(skeleton.restPose, scratch.globalTransforms);
+				for (size_t j = 0; j < skin.joints.size(); j++) {
+					skinObject.jointMatrices[j] = scratch.globalTransforms[skeleton.jointSlots[j]] * skinObject.inverseBindMatrices[j];
+				}
 			}
 
-
-
-
-
-
-			// ----------------------------------------------
-
 			skinObjects.push_back(skinObject);
 		}
 		return skinObjects;
 	}
 
-int Bot::findKeyframeIndex(const std::vector<float>& times, float animationTime)
+// Last key at or before animationTime, clamped so that a next key always exists
+int Bot::findKeyframeIndex(const float* times, int count, float animationTime)
 {
-	int left = 0;
-	int right = times.size() - 1;
-
-	while (left <= right) {
-		int mid = (left + right) / 2;
-
-		if (mid + 1 < times.size() && times[mid] <= animationTime && animationTime < times[mid + 1]) {
-			return mid;
-		}
-		else if (times[mid] > animationTime) {
-			right = mid - 1;
-		}
-		else { // animationTime >= times[mid + 1]
-			left = mid + 1;
-		}
-	}
-
-	// Target not found
-	return times.size() - 2;
+	int index = static_cast<int>(std::upper_bound(times, times + count, animationTime) - times) - 1;
+	return std::max(0, std::min(index, count - 2));
 }
 
 std::vector<Bot::AnimationObject> Bot::prepareAnimation(const tinygltf::Model &model)
@@ -253,9 +348,27 @@ std::vector<Bot::AnimationObject> Bot::prepareAnimation(const tinygltf::Model &m
 		for (const auto &anim : model.animations) {
 			AnimationObject animationObject;
 
-			for (const auto &sampler : anim.samplers) {
-				SamplerObject samplerObject;
+			for (const auto &channel : anim.channels) {
+				// Channels of nodes outside the skeleton never affect the skin
+				int targetSlot = channel.target_node >= 0 ? skeleton.nodeSlots[channel.target_node] : -1;
+				if (targetSlot < 0) {
+					continue;
+				}
 
+				ChannelObject channelObject;
+				channelObject.targetSlot = targetSlot;
+				if (channel.target_path == "translation") {
+					channelObject.path = PATH_TRANSLATION;
+				} else if (channel.target_path == "rotation") {
+					channelObject.path = PATH_ROTATION;
+				} else if (channel.target_path == "scale") {
+					channelObject.path = PATH_SCALE;
+				} else {
+					std::cout << "Unsupported animation path " << channel.target_path << std::endl;
+					continue;
+				}
+
+				const tinygltf::AnimationSampler &sampler = anim.samplers[channel.sampler];
 				const tinygltf::Accessor &inputAccessor = model.accessors[sampler.input];
 				const tinygltf::BufferView &inputBufferView = model.bufferViews[inputAccessor.bufferView];
 				const tinygltf::Buffer &inputBuffer = model.buffers[inputBufferView.buffer];
@@ -263,45 +376,37 @@ std::vector<Bot::AnimationObject> Bot::prepareAnimation(const tinygltf::Model &m
 				assert(inputAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
 				assert(inputAccessor.type == TINYGLTF_TYPE_SCALAR);
 
-				// Input (time) values
-				samplerObject.input.resize(inputAccessor.count);
-
-				const unsigned char *inputPtr = &inputBuffer.data[inputBufferView.byteOffset + inputAccessor.byteOffset];
-				const float *inputBuf = reinterpret_cast<const float*>(inputPtr);
-
-				// Read input (time) values
-				int stride = inputAccessor.ByteStride(inputBufferView);
-				for (size_t i = 0; i < inputAccessor.count; ++i) {
-					samplerObject.input[i] = *reinterpret_cast<const float*>(inputPtr + i * stride);
-				}
-
 				const tinygltf::Accessor &outputAccessor = model.accessors[sampler.output];
 				const tinygltf::BufferView &outputBufferView = model.bufferViews[outputAccessor.bufferView];
 				const tinygltf::Buffer &outputBuffer = model.buffers[outputBufferView.buffer];
 
 				assert(outputAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
+				assert(outputAccessor.count == inputAccessor.count);
+				if (outputAccessor.type != TINYGLTF_TYPE_VEC3 && outputAccessor.type != TINYGLTF_TYPE_VEC4) {
+					std::cout << "Unsupport accessor type ..." << std::endl;
+					continue;
+				}
 
-				const unsigned char *outputPtr = &outputBuffer.data[outputBufferView.byteOffset + outputAccessor.byteOffset];
-				const float *outputBuf = reinterpret_cast<const float*>(outputPtr);
-
-				int outputStride = outputAccessor.ByteStride(outputBufferView);
+				// Keys are appended to the clip arrays
+				channelObject.firstKey = static_cast<int>(animationObject.times.size());
+				channelObject.keyCount = static_cast<int>(inputAccessor.count);
 
-				// Output values
-				samplerObject.output.resize(outputAccessor.count);
+				const unsigned char *inputPtr = &inputBuffer.data[inputBufferView.byteOffset + inputAccessor.byteOffset];
+				int stride = inputAccessor.ByteStride(inputBufferView);
+				for (size_t i = 0; i < inputAccessor.count; ++i) {
+					animationObject.times.push_back(*reinterpret_cast<const float*>(inputPtr + i * stride));
+				}
 
+				const unsigned char *outputPtr = &outputBuffer.data[outputBufferView.byteOffset + outputAccessor.byteOffset];
+				int outputStride = outputAccessor.ByteStride(outputBufferView);
+				size_t componentCount = outputAccessor.type == TINYGLTF_TYPE_VEC3 ? 3 : 4;
 				for (size_t i = 0; i < outputAccessor.count; ++i) {
-
-					if (outputAccessor.type == TINYGLTF_TYPE_VEC3) {
-						memcpy(&samplerObject.output[i], outputPtr + i * 3 * sizeof(float), 3 * sizeof(float));
-					} else if (outputAccessor.type == TINYGLTF_TYPE_VEC4) {
-						memcpy(&samplerObject.output[i], outputPtr + i * 4 * sizeof(float), 4 * sizeof(float));
-					} else {
-						std::cout << "Unsupport accessor type ..." << std::endl;
-					}
-
+					glm::vec4 value(0.0f);
+					memcpy(&value[0], outputPtr + i * outputStride, componentCount * sizeof(float));
+					animationObject.values.push_back(value);
 				}
 
-				animationObject.samplers.push_back(samplerObject);
+				animationObject.channels.push_back(channelObject);
 			}
 
 			animationObjects.push_back(animationObject);
@@ -309,109 +414,67 @@ std::vector<Bot::AnimationObject> Bot::prepareAnimation(const tinygltf::Model &m
 		return animationObjects;
 	}
 
-void Bot::updateAnimation(
-		const tinygltf::Model &model,
-		const tinygltf::Animation &anim,
-		const AnimationObject &animationObject,
-		float time,
-		std::vector<glm::mat4> &nodeTransforms)
-{
-	// For each node, store separate components
-	struct TransformComponents {
-		glm::vec3 translation = glm::vec3(0.0f);
-		glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
-		glm::vec3 scale = glm::vec3(1.0f);
-	};
-
-std::vector<TransformComponents> nodeComponents(model.nodes.size());
-
-    // Initialize with initial node transforms
-    for (size_t i = 0; i < model.nodes.size(); ++i) {
-        const tinygltf::Node &node = model.nodes[i];
-
-        if (node.translation.size() == 3) {
-            nodeComponents[i].translation = glm::vec3(
-                node.translation[0], node.translation[1], node.translation[2]);
-        }
-        if (node.rotation.size() == 4) {
-            nodeComponents[i].rotation = glm::quat(
-                node.rotation[3], node.rotation[0], node.rotation[1], node.rotation[2]);
-        }
-        if (node.scale.size() == 3) {
-            nodeComponents[i].scale = glm::vec3(
-                node.scale[0], node.scale[1], node.scale[2]);
-        }
+int Bot::sampleKeys(const float *times, int keyCount, float time, int &cursor, float &factor) {
+    factor = 0.0f;
+    if (keyCount < 2) {
+        return 0;
     }
+    // Calculate current animation time (wrap if necessary)
+    float animationTime = fmod(time, times[keyCount - 1]);
 
-    // Apply animation data
-    for (const auto &channel : anim.channels) {
-        int targetNodeIndex = channel.target_node;
-        const auto &sampler = anim.samplers[channel.sampler];
-
-        // Calculate current animation time (wrap if necessary)
-        const std::vector<float> &times = animationObject.samplers[channel.sampler].input;
-        float animationTime = fmod(time, times.back());
-
-        // Find keyframes
-        int keyframeIndex = findKeyframeIndex(times, animationTime);
-        int nextKeyframeIndex = (keyframeIndex + 1) % times.size();
-
-        // Calculate interpolation factor
-        float t0 = times[keyframeIndex];
-        float t1 = times[nextKeyframeIndex];
-        float factor = (animationTime - t0) / (t1 - t0);
-
-        // Get output data
-        const std::vector<glm::vec4> &outputs = animationObject.samplers[channel.sampler].output;
-
-        if (channel.target_path == "translation") {
-            glm::vec3 translation0 = glm::vec3(outputs[keyframeIndex]);
-            glm::vec3 translation1 = glm::vec3(outputs[nextKeyframeIndex]);
-
-            // Linearly interpolate
-            glm::vec3 translation = glm::mix(translation0, translation1, factor);
-            nodeComponents[targetNodeIndex].translation = translation;
-
-        } else if (channel.target_path == "rotation") {
-            glm::quat rotation0(outputs[keyframeIndex].w, outputs[keyframeIndex].x,
-                                outputs[keyframeIndex].y, outputs[keyframeIndex].z);
-            glm::quat rotation1(outputs[nextKeyframeIndex].w, outputs[nextKeyframeIndex].x,
-                                outputs[nextKeyframeIndex].y, outputs[nextKeyframeIndex].z);
-
-            // Spherical linear interpolation
-            glm::quat rotation = glm::slerp(rotation0, rotation1, factor);
-            nodeComponents[targetNodeIndex].rotation = rotation;
+    // Playing forward the cursor only ever steps to the next key, a jump back searches again
+    if (cursor > keyCount - 2 || times[cursor] > animationTime) {
+        cursor = findKeyframeIndex(times, keyCount, animationTime);
+    }
+    while (cursor < keyCount - 2 && times[cursor + 1] <= animationTime) {
+        cursor++;
+    }
 
-        } else if (channel.target_path == "scale") {
-            glm::vec3 scale0 = glm::vec3(outputs[keyframeIndex]);
-            glm::vec3 scale1 = glm::vec3(outputs[nextKeyframeIndex]);
+    float t0 = times[cursor];
+    float t1 = times[cursor + 1];
+    factor = glm::clamp((animationTime - t0) / (t1 - t0), 0.0f, 1.0f);
+    return cursor;
+}
 
-            // Linearly interpolate
-            glm::vec3 scale = glm::mix(scale0, scale1, factor);
-            nodeComponents[targetNodeIndex].scale = scale;
+void Bot::updateAnimation(
+		const AnimationObject &animationObject,
+		float time,
+		int *keyCursors,
+		std::vector<TransformComponents> &pose) const
+{
+    for (size_t c = 0; c < animationObject.channels.size(); ++c) {
+        const ChannelObject &channel = animationObject.channels[c];
+        const float *times = &animationObject.times[channel.firstKey];
+        const glm::vec4 *values = &animationObject.values[channel.firstKey];
+
+        float factor = 0.0f;
+        int keyframeIndex = sampleKeys(times, channel.keyCount, time, keyCursors[c], factor);
+        int nextKeyframeIndex = std::min(keyframeIndex + 1, channel.keyCount - 1);
+        const glm::vec4 &value0 = values[keyframeIndex];
+        const glm::vec4 &value1 = values[nextKeyframeIndex];
+
+        TransformComponents &target = pose[channel.targetSlot];
+        switch (channel.path) {
+            case PATH_TRANSLATION:
+                target.translation = glm::mix(glm::vec3(value0), glm::vec3(value1), factor);
+                break;
+            case PATH_ROTATION:
+                // Spherical linear interpolation
+                target.rotation = glm::slerp(glm::quat(value0.w, value0.x, value0.y, value0.z),
+                                             glm::quat(value1.w, value1.x, value1.y, value1.z), factor);
+                break;
+            case PATH_SCALE:
+                target.scale = glm::mix(glm::vec3(value0), glm::vec3(value1), factor);
+                break;
         }
     }
-
-    // Reconstruct node transforms
-    for (size_t i = 0; i < model.nodes.size(); ++i) {
-        nodeTransforms[i] = glm::translate(glm::mat4(1.0f), nodeComponents[i].translation) *
-                            glm::mat4_cast(nodeComponents[i].rotation) *
-                            glm::scale(glm::mat4(1.0f), nodeComponents[i].scale);
-    }
 }
 
-void Bot::updateSkinning(const tinygltf:: Skin &skin, const std::vector<glm::mat4> &nodeTransforms) {
-
-	// -------------------------------------------------
-	// TODO: Recompute joint matrices
-	// -------------------------------------------------
-	for (SkinObject &skinObject : skinObjects) {
-		// Loop through each joint in the skin
-		for (size_t i = 0; i < skinObject.jointMatrices.size(); ++i) {
-			int jointIndex = skin.joints[i];
-			// Compute the joint matrix: Global transform * Inverse bind matrix
-			skinObject.jointMatrices[i] = nodeTransforms[jointIndex] * skinObject.inverseBindMatrices[i];
-		}
+void Bot::updateSkinning(const std::vector<glm::mat4> &globalTransforms, glm::mat4 *jointMatrices) const {
+	const SkinObject &skinObject = skinObjects[0];
+	for (size_t i = 0; i < skinObject.inverseBindMatrices.size(); ++i) {
+		// Compute the joint matrix: Global transform * Inverse bind matrix
+		jointMatrices[i] = globalTransforms[skeleton.jointSlots[i]] * skinObject.inverseBindMatrices[i];
 	}
 }
 
@@ -429,6 +492,14 @@ bool Bot::loadModel(tinygltf::Model &model, const char *filename) {
 		std::cout << "ERR: " << err << std::endl;
 	}
 
+	// Quantized attributes are read through their accessor types, any other required extension is not
+	for (const std::string &extension : model.extensionsRequired) {
+		if (extension != "KHR_mesh_quantization") {
+			std::cout << "ERR: unsupported required extension " << extension << std::endl;
+			res = false;
+		}
+	}
+
 	if (!res)
 		std::cout << "Failed to load glTF: " << filename << std::endl;
 	else
@@ -437,165 +508,524 @@ bool Bot::loadModel(tinygltf::Model &model, const char *filename) {
 	return res;
 }
 
-void Bot::bindMesh(std::vector<PrimitiveObject> &primitiveObjects,
-				tinygltf::Model &model, tinygltf::Mesh &mesh) {
-
-		std::map<int, GLuint> vbos;
-		for (size_t i = 0; i < model.bufferViews.size(); ++i) {
-			const tinygltf::BufferView &bufferView = model.bufferViews[i];
-
-			int target = bufferView.target;
-
-			if (bufferView.target == 0) {
-				// The bufferView with target == 0 in our model refers to
-				// the skinning weights, for 25 joints, each 4x4 matrix (16 floats), totaling to 400 floats or 1600 bytes.
-				// So it is considered safe to skip the warning.
-				//std::cout << "WARN: bufferView.target is zero" << std::endl;
-				continue;
-			}
-
-			const tinygltf::Buffer &buffer = model.buffers[bufferView.buffer];
-			GLuint vbo;
-			glGenBuffers(1, &vbo);
-			glBindBuffer(target, vbo);
-			glBufferData(target, bufferView.byteLength,
-						&buffer.data.at(0) + bufferView.byteOffset, GL_STATIC_DRAW);
-
-			vbos[i] = vbo;
+// One component of a glTF accessor element, KHR_mesh_quantization allows
+// integer types for positions, normals and texture coordinates
+static float readComponent(const unsigned char *data, int componentType, bool normalized) {
+	switch (componentType) {
+		case TINYGLTF_COMPONENT_TYPE_BYTE: {
+			int8_t value;
+			memcpy(&value, data, sizeof(value));
+			return normalized ? std::max(value / 127.0f, -1.0f) : value;
 		}
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+			return normalized ? data[0] / 255.0f : data[0];
+		case TINYGLTF_COMPONENT_TYPE_SHORT: {
+			int16_t value;
+			memcpy(&value, data, sizeof(value));
+			return normalized ? std::max(value / 32767.0f, -1.0f) : value;
+		}
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+			uint16_t value;
+			memcpy(&value, data, sizeof(value));
+			return normalized ? value / 65535.0f : value;
+		}
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: {
+			uint32_t value;
+			memcpy(&value, data, sizeof(value));
+			return static_cast<float>(value);
+		}
+		default: {
+			float value;
+			memcpy(&value, data, sizeof(value));
+			return value;
+		}
+	}
+}
 
-		// Each mesh can contain several primitives (or parts), each we need to
-		// bind to an OpenGL vertex array object
-		for (size_t i = 0; i < mesh.primitives.size(); ++i) {
-
-			tinygltf::Primitive primitive = mesh.primitives[i];
-			tinygltf::Accessor indexAccessor = model.accessors[primitive.indices];
+static glm::vec4 readAccessor(const tinygltf::Model &model, const tinygltf::Accessor &accessor, size_t index) {
+	const tinygltf::BufferView &bufferView = model.bufferViews[accessor.bufferView];
+	const tinygltf::Buffer &buffer = model.buffers[bufferView.buffer];
+	const unsigned char *element = buffer.data.data() + bufferView.byteOffset + accessor.byteOffset +
+								   index * accessor.ByteStride(bufferView);
+	int componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+	int components = accessor.type == TINYGLTF_TYPE_SCALAR ? 1 : std::min(accessor.type, 4);
+
+	glm::vec4 value(0.0f);
+	for (int c = 0; c < components; ++c) {
+		value[c] = readComponent(element + c * componentSize, accessor.componentType, accessor.normalized);
+	}
+	return value;
+}
 
-			GLuint vao;
-			glGenVertexArrays(1, &vao);
-			glBindVertexArray(vao);
+static uint32_t readIndex(const tinygltf::Model &model, const tinygltf::Accessor &accessor, size_t index) {
+	const tinygltf::BufferView &bufferView = model.bufferViews[accessor.bufferView];
+	const unsigned char *data = model.buffers[bufferView.buffer].data.data() + bufferView.byteOffset +
+								accessor.byteOffset;
+	switch (accessor.componentType) {
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+			return data[index];
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+			uint16_t value;
+			memcpy(&value, data + index * sizeof(value), sizeof(value));
+			return value;
+		}
+		default: {
+			uint32_t value;
+			memcpy(&value, data + index * sizeof(value), sizeof(value));
+			return value;
+		}
+	}
+}
 
-			for (auto &attrib : primitive.attributes) {
-				tinygltf::Accessor accessor = model.accessors[attrib.second];
-				int byteStride =
-					accessor.ByteStride(model.bufferViews[accessor.bufferView]);
-				glBindBuffer(GL_ARRAY_BUFFER, vbos[accessor.bufferView]);
+void Bot::collectPrimitives(const tinygltf::Model &model, int nodeIndex) {
+	const tinygltf::Node &node = model.nodes[nodeIndex];
+	if ((node.mesh >= 0) && (node.mesh < model.meshes.size())) {
+		for (size_t i = 0; i < model.meshes[node.mesh].primitives.size(); ++i) {
+			scenePrimitives.push_back({node.mesh, static_cast<int>(i), nodeIndex});
+		}
+	}
 
-				int size = 1;
-				if (accessor.type != TINYGLTF_TYPE_SCALAR) {
-					size = accessor.type;
-				}
+	// Recursive into children nodes
+	for (size_t i = 0; i < node.children.size(); i++) {
+		assert((node.children[i] >= 0) && (node.children[i] < model.nodes.size()));
+		collectPrimitives(model, node.children[i]);
+	}
+}
 
+bool Bot::packVertices(const tinygltf::Model &model) {
+	packedPrimitives.clear();
+	packingReport = VertexPackingReport();
+	optimizationReports.clear();
+	lodReports.clear();
+	lodTriangleCounts.assign(LOD_LEVEL_COUNT, 0);
+	lodMs = 0.0f;
+
+	// One position range for the whole model, so every draw shares the dequantize matrix
+	glm::vec3 minimum(std::numeric_limits<float>::max()), maximum(-std::numeric_limits<float>::max());
+	for (const ScenePrimitive &scenePrimitive : scenePrimitives) {
+		const tinygltf::Primitive &primitive = model.meshes[scenePrimitive.mesh].primitives[scenePrimitive.primitive];
+		auto position = primitive.attributes.find("POSITION");
+		if (position == primitive.attributes.end()) {
+			return false;
+		}
+		const tinygltf::Accessor &accessor = model.accessors[position->second];
+		for (size_t v = 0; v < accessor.count; ++v) {
+			glm::vec3 p = glm::vec3(readAccessor(model, accessor, v));
+			minimum = glm::min(minimum, p);
+			maximum = glm::max(maximum, p);
+		}
+	}
+	positionQuantization = PositionQuantization::fromBounds(minimum, maximum);
+
+	long long loadedBytes = 0;
+	for (const ScenePrimitive &scenePrimitive : scenePrimitives) {
+		const tinygltf::Primitive &primitive = model.meshes[scenePrimitive.mesh].primitives[scenePrimitive.primitive];
+		const tinygltf::Accessor &positions = model.accessors[primitive.attributes.at("POSITION")];
+		PackedPrimitive packed;
+		std::vector<PackedVertex> &vertices = packed.vertices;
+		vertices.resize(positions.count);
+
+		for (auto &attrib : primitive.attributes) {
+			const tinygltf::Accessor &accessor = model.accessors[attrib.second];
+			int components = accessor.type == TINYGLTF_TYPE_SCALAR ? 1 : accessor.type;
+			loadedBytes += static_cast<long long>(accessor.count) * components *
+						   tinygltf::GetComponentSizeInBytes(accessor.componentType);
+
+			for (size_t v = 0; v < accessor.count && v < vertices.size(); ++v) {
+				glm::vec4 value = readAccessor(model, accessor, v);
+				PackedVertex &vertex = vertices[v];
 				if (attrib.first.compare("POSITION") == 0) {
-					int vaa = 0;
-					glEnableVertexAttribArray(vaa);
-					glVertexAttribPointer(vaa, size, accessor.componentType,
-										  accessor.normalized ? GL_TRUE : GL_FALSE,
-										  byteStride, BUFFER_OFFSET(accessor.byteOffset));
+					positionQuantization.encode(glm::vec3(value), vertex.position);
+					float error = glm::length(positionQuantization.decode(vertex.position) - glm::vec3(value));
+					packingReport.maxPositionError = std::max(packingReport.maxPositionError, error);
 				} else if (attrib.first.compare("NORMAL") == 0) {
-					int vaa = 1;
-					glEnableVertexAttribArray(vaa);
-					glVertexAttribPointer(vaa, size, accessor.componentType,
-										  accessor.normalized ? GL_TRUE : GL_FALSE,
-										  byteStride, BUFFER_OFFSET(accessor.byteOffset));
+					glm::vec3 normal = glm::normalize(glm::vec3(value));
+					vertex.normal = glm::packSnorm3x10_1x2(glm::vec4(normal, 0.0f));
+					glm::vec3 decoded = glm::vec3(glm::unpackSnorm3x10_1x2(vertex.normal));
+					float cosine = glm::clamp(glm::dot(normal, glm::normalize(decoded)), -1.0f, 1.0f);
+					packingReport.maxNormalError = std::max(packingReport.maxNormalError, glm::degrees(std::acos(cosine)));
 				} else if (attrib.first.compare("TEXCOORD_0") == 0) {
-					int vaa = 2;
-					glEnableVertexAttribArray(vaa);
-					glVertexAttribPointer(vaa, size, accessor.componentType,
-										  accessor.normalized ? GL_TRUE : GL_FALSE,
-										  byteStride, BUFFER_OFFSET(accessor.byteOffset));
+					for (int c = 0; c < 2; ++c) {
+						vertex.uv[c] = glm::packHalf1x16(value[c]);
+						float error = std::abs(glm::unpackHalf1x16(vertex.uv[c]) - value[c]);
+						packingReport.maxUVError = std::max(packingReport.maxUVError, error);
+					}
 				} else if (attrib.first.compare("JOINTS_0") == 0) {
-					int vaa = 3; // Attribute location for JOINTS_0
-					glEnableVertexAttribArray(vaa);
-					glVertexAttribIPointer(vaa, size, accessor.componentType,
-										   byteStride, BUFFER_OFFSET(accessor.byteOffset));
+					for (int c = 0; c < 4; ++c) {
+						if (value[c] > 255.0f) {
+							std::cout << "Bot joints above 255, vertices left unpacked" << std::endl;
+							packedPrimitives.clear();
+							lodTriangleCounts.clear();
+							return false;
+						}
+						vertex.joints[c] = static_cast<uint8_t>(value[c]);
+					}
 				} else if (attrib.first.compare("WEIGHTS_0") == 0) {
-					int vaa = 4; // Attribute location for WEIGHTS_0
-					glEnableVertexAttribArray(vaa);
-					glVertexAttribPointer(vaa, size, accessor.componentType,
-										  accessor.normalized ? GL_TRUE : GL_FALSE,
-										  byteStride, BUFFER_OFFSET(accessor.byteOffset));
-				} else {
-					std::cout << "Unrecognized attribute: " << attrib.first << std::endl;
+					packWeights(value, vertex.weights);
+					glm::vec4 normalized = value / std::max(value.x + value.y + value.z + value.w, 1e-6f);
+					for (int c = 0; c < 4; ++c) {
+						float error = std::abs(vertex.weights[c] / 255.0f - normalized[c]);
+						packingReport.maxWeightError = std::max(packingReport.maxWeightError, error);
+					}
 				}
 			}
+		}
+		packingReport.vertexCount += static_cast<int>(vertices.size());
 
-			// Record VAO for later use
-			PrimitiveObject primitiveObject;
-			primitiveObject.vao = vao;
-			primitiveObject.vbos = vbos;
-			primitiveObjects.push_back(primitiveObject);
-
-			glBindVertexArray(0);
+		const tinygltf::Accessor &indexAccessor = model.accessors[primitive.indices];
+		packed.indices.resize(indexAccessor.count);
+		for (size_t i = 0; i < indexAccessor.count; ++i) {
+			packed.indices[i] = readIndex(model, indexAccessor, i);
 		}
+		if (primitive.mode == TINYGLTF_MODE_TRIANGLES) {
+			optimizePrimitive(packed, scenePrimitive.mesh);
+		}
+		auto lodStart = std::chrono::high_resolution_clock::now();
+		buildLods(packed, scenePrimitive.mesh, primitive.mode);
+		lodMs += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - lodStart).count();
+		for (int level = 0; level < LOD_LEVEL_COUNT; ++level) {
+			lodTriangleCounts[level] += static_cast<int>(packed.lods[level].count / 3);
+		}
+		packedPrimitives.push_back(std::move(packed));
 	}
 
-void Bot::bindModelNodes(std::vector<PrimitiveObject> &primitiveObjects,
-						tinygltf::Model &model,
-						tinygltf::Node &node) {
-	// Bind buffers for the current mesh at the node
-	if ((node.mesh >= 0) && (node.mesh < model.meshes.size())) {
-		bindMesh(primitiveObjects, model, model.meshes[node.mesh]);
+	packingReport.packedBytesPerVertex = sizeof(PackedVertex);
+	if (packingReport.vertexCount > 0) {
+		packingReport.loadedBytesPerVertex = static_cast<int>(loadedBytes / packingReport.vertexCount);
 	}
+	return true;
+}
 
-	// Recursive into children nodes
-	for (size_t i = 0; i < node.children.size(); i++) {
-		assert((node.children[i] >= 0) && (node.children[i] < model.nodes.size()));
-		bindModelNodes(primitiveObjects, model, model.nodes[node.children[i]]);
+void Bot::optimizePrimitive(PackedPrimitive &packed, int mesh) {
+	MeshOptimizationReport report;
+	report.mesh = mesh;
+	report.triangleCount = static_cast<int>(packed.indices.size() / 3);
+	report.vertexCount = static_cast<int>(packed.vertices.size());
+	report.before = analyzeVertexCache(packed.indices, packed.vertices.size());
+
+	// Triangles for the post-transform cache, then outward facing clusters first
+	optimizeVertexCache(packed.indices, packed.vertices.size());
+	std::vector<glm::vec3> positions(packed.vertices.size());
+	for (size_t v = 0; v < packed.vertices.size(); ++v) {
+		positions[v] = positionQuantization.decode(packed.vertices[v].position);
 	}
+	report.overdrawSorted = optimizeOverdraw(packed.indices, positions);
+
+	// Vertices in the order the triangles first use them
+	std::vector<uint32_t> order = optimizeVertexFetch(packed.indices, packed.vertices.size());
+	std::vector<PackedVertex> vertices(order.size());
+	for (size_t v = 0; v < order.size(); ++v) {
+		vertices[v] = packed.vertices[order[v]];
+	}
+	packed.vertices.swap(vertices);
+
+	report.after = analyzeVertexCache(packed.indices, packed.vertices.size());
+	optimizationReports.push_back(report);
 }
 
-std::vector<Bot::PrimitiveObject> Bot::bindModel(tinygltf::Model &model) {
-	std::vector<PrimitiveObject> primitiveObjects;
+void Bot::buildLods(PackedPrimitive &packed, int mesh, int mode) {
+	size_t fullCount = packed.indices.size();
+	packed.lods.assign(1, IndexRange{0, fullCount});
+	if (mode != TINYGLTF_MODE_TRIANGLES) {
+		// Only triangle lists simplify, every level draws the full primitive
+		packed.lods.resize(LOD_LEVEL_COUNT, packed.lods[0]);
+		return;
+	}
 
-	const tinygltf::Scene &scene = model.scenes[model.defaultScene];
-	for (size_t i = 0; i < scene.nodes.size(); ++i) {
-		assert((scene.nodes[i] >= 0) && (scene.nodes[i] < model.nodes.size()));
-		bindModelNodes(primitiveObjects, model, model.nodes[scene.nodes[i]]);
+	// Collapses between vertices that differ in UV or skinning cost extra, dense
+	// per joint weights so that two vertices on the same joints compare equal
+	int joints = jointCount();
+	for (const PackedVertex &vertex : packed.vertices) {
+		for (int c = 0; c < 4; ++c) {
+			joints = std::max(joints, vertex.joints[c] + 1);
+		}
+	}
+	int attributeCount = 2 + joints;
+	std::vector<glm::vec3> positions(packed.vertices.size());
+	std::vector<float> attributes(packed.vertices.size() * attributeCount, 0.0f);
+	for (size_t v = 0; v < packed.vertices.size(); ++v) {
+		const PackedVertex &vertex = packed.vertices[v];
+		positions[v] = positionQuantization.decode(vertex.position);
+		float *attribute = &attributes[v * attributeCount];
+		attribute[0] = glm::unpackHalf1x16(vertex.uv[0]) * LOD_UV_WEIGHT;
+		attribute[1] = glm::unpackHalf1x16(vertex.uv[1]) * LOD_UV_WEIGHT;
+		for (int c = 0; c < 4; ++c) {
+			attribute[2 + vertex.joints[c]] += vertex.weights[c] / 255.0f * LOD_SKIN_WEIGHT;
+		}
 	}
 
-	return primitiveObjects;
+	// Every level from the full mesh, so its error is against the original
+	const std::vector<uint32_t> full(packed.indices.begin(), packed.indices.end());
+	for (int level = 1; level < LOD_LEVEL_COUNT; ++level) {
+		size_t target = static_cast<size_t>(fullCount / 3 * LOD_TRIANGLE_RATIOS[level]) * 3;
+		MeshLodReport report;
+		report.mesh = mesh;
+		report.level = level;
+		std::vector<uint32_t> indices = simplifyMesh(full, positions, attributes, attributeCount, target,
+													 LOD_MAX_ERRORS[level], &report.error);
+		optimizeVertexCache(indices, packed.vertices.size());
+		report.triangleCount = static_cast<int>(indices.size() / 3);
+		lodReports.push_back(report);
+
+		packed.lods.push_back(IndexRange{packed.indices.size(), indices.size()});
+		packed.indices.insert(packed.indices.end(), indices.begin(), indices.end());
+	}
 }
 
-void Bot::drawMesh(const std::vector<PrimitiveObject> &primitiveObjects,
-				tinygltf::Model &model, tinygltf::Mesh &mesh) {
-
-	for (size_t i = 0; i < mesh.primitives.size(); ++i)
-	{
-		GLuint vao = primitiveObjects[i].vao;
-		std::map<int, GLuint> vbos = primitiveObjects[i].vbos;
+void Bot::bindPrimitive(tinygltf::Model &model, const ScenePrimitive &scenePrimitive, size_t index) {
+	const tinygltf::Primitive &primitive = model.meshes[scenePrimitive.mesh].primitives[scenePrimitive.primitive];
+	const tinygltf::Accessor &indexAccessor = model.accessors[primitive.indices];
+
+	GLuint vao;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	GLsizei vertexCount = 0;
+	int uvAccessorIndex = -1;
+	for (auto &attrib : primitive.attributes) {
+		const tinygltf::Accessor &accessor = model.accessors[attrib.second];
+		int byteStride =
+			accessor.ByteStride(model.bufferViews[accessor.bufferView]);
+		glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[accessor.bufferView]);
+
+		int size = 1;
+		if (accessor.type != TINYGLTF_TYPE_SCALAR) {
+			size = accessor.type;
+		}
 
+		if (attrib.first.compare("POSITION") == 0) {
+			vertexCount = static_cast<GLsizei>(accessor.count);
+			int vaa = 0;
+			glEnableVertexAttribArray(vaa);
+			glVertexAttribPointer(vaa, size, accessor.componentType,
+								  accessor.normalized ? GL_TRUE : GL_FALSE,
+								  byteStride, BUFFER_OFFSET(accessor.byteOffset));
+		} else if (attrib.first.compare("NORMAL") == 0) {
+			int vaa = 1;
+			glEnableVertexAttribArray(vaa);
+			glVertexAttribPointer(vaa, size, accessor.componentType,
+								  accessor.normalized ? GL_TRUE : GL_FALSE,
+								  byteStride, BUFFER_OFFSET(accessor.byteOffset));
+		} else if (attrib.first.compare("TEXCOORD_0") == 0) {
+			uvAccessorIndex = attrib.second;
+			int vaa = 2;
+			glEnableVertexAttribArray(vaa);
+			glVertexAttribPointer(vaa, size, accessor.componentType,
+								  accessor.normalized ? GL_TRUE : GL_FALSE,
+								  byteStride, BUFFER_OFFSET(accessor.byteOffset));
+		} else if (attrib.first.compare("JOINTS_0") == 0) {
+			int vaa = 3; // Attribute location for JOINTS_0
+			glEnableVertexAttribArray(vaa);
+			glVertexAttribIPointer(vaa, size, accessor.componentType,
+								   byteStride, BUFFER_OFFSET(accessor.byteOffset));
+		} else if (attrib.first.compare("WEIGHTS_0") == 0) {
+			int vaa = 4; // Attribute location for WEIGHTS_0
+			glEnableVertexAttribArray(vaa);
+			glVertexAttribPointer(vaa, size, accessor.componentType,
+								  accessor.normalized ? GL_TRUE : GL_FALSE,
+								  byteStride, BUFFER_OFFSET(accessor.byteOffset));
+		} else {
+			std::cout << "Unrecognized attribute: " << attrib.first << std::endl;
+		}
+	}
+	// The index buffer binding is part of the VAO
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferObjects[indexAccessor.bufferView]);
+	glBindVertexArray(0);
+
+	// Record everything the draw needs, nothing of the glTF is read after loading
+	DrawRecord record;
+	record.vao = vao;
+	record.mode = primitive.mode;
+	record.count = static_cast<GLsizei>(indexAccessor.count);
+	record.indexType = indexAccessor.componentType;
+	record.indexOffset = indexAccessor.byteOffset;
+	record.material = primitive.material;
+	record.node = scenePrimitive.node;
+	drawRecords.push_back(record);
+
+	// The same primitive from its packed vertices, same attribute locations
+	if (!packedBufferObjects.empty()) {
+		glGenVertexArrays(1, &vao);
 		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, packedBufferObjects[index]);
+		const GLsizei stride = sizeof(PackedVertex);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, BUFFER_OFFSET(offsetof(PackedVertex, position)));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, BUFFER_OFFSET(offsetof(PackedVertex, normal)));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, BUFFER_OFFSET(offsetof(PackedVertex, uv)));
+		glEnableVertexAttribArray(3);
+		glVertexAttribIPointer(3, 4, GL_UNSIGNED_BYTE, stride, BUFFER_OFFSET(offsetof(PackedVertex, joints)));
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, BUFFER_OFFSET(offsetof(PackedVertex, weights)));
+		// Reordered indices, they only match the packed vertices
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, packedIndexBufferObjects[index]);
+		glBindVertexArray(0);
 
-		tinygltf::Primitive primitive = mesh.primitives[i];
-		tinygltf::Accessor indexAccessor = model.accessors[primitive.indices];
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbos.at(indexAccessor.bufferView));
+		DrawRecord packedRecord = record;
+		packedRecord.vao = vao;
+		packedRecord.count = static_cast<GLsizei>(packedPrimitives[index].lods[0].count);
+		packedRecord.indexType = packedIndexTypes[index];
+		packedRecord.indexOffset = 0;
+		packedDrawRecords.push_back(packedRecord);
+
+		// Every LOD level is a range of the same index buffer
+		size_t indexSize = packedRecord.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+		for (size_t level = 0; level < lodDrawRecords.size(); ++level) {
+			const IndexRange &range = packedPrimitives[index].lods[level];
+			DrawRecord lodRecord = packedRecord;
+			lodRecord.count = static_cast<GLsizei>(range.count);
+			lodRecord.indexOffset = range.first * indexSize;
+			lodDrawRecords[level].push_back(lodRecord);
+		}
+	}
 
-		glDrawElements(primitive.mode, indexAccessor.count,
-					indexAccessor.componentType,
-					BUFFER_OFFSET(indexAccessor.byteOffset));
+	// Skinned copy: a feedback buffer written by skin() and a VAO reading it
+	SkinFeed feed;
+	feed.vertexCount = vertexCount;
+	glGenBuffers(1, &feed.feedbackBufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, feed.feedbackBufferID);
+	glBufferData(GL_ARRAY_BUFFER, vertexCount * SKINNED_VERTEX_SIZE, nullptr, GL_DYNAMIC_COPY);
+	skinFeeds.push_back(feed);
+
+	// One VAO per source format, skin() writes the feedback buffer in the vertex
+	// order of the source it ran on, so the draw must use that source's indices
+	auto bindSkinnedVAO = [&](GLuint elementBuffer) {
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, feed.feedbackBufferID);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, SKINNED_VERTEX_SIZE, BUFFER_OFFSET(0));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, SKINNED_VERTEX_SIZE, BUFFER_OFFSET(3 * sizeof(float)));
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+		return vao;
+	};
 
-		glBindVertexArray(0);
+	record.vao = bindSkinnedVAO(bufferObjects[indexAccessor.bufferView]);
+	if (uvAccessorIndex >= 0) {
+		const tinygltf::Accessor &accessor = model.accessors[uvAccessorIndex];
+		glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[accessor.bufferView]);
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, accessor.type, accessor.componentType,
+							  accessor.normalized ? GL_TRUE : GL_FALSE,
+							  accessor.ByteStride(model.bufferViews[accessor.bufferView]),
+							  BUFFER_OFFSET(accessor.byteOffset));
+	}
+	skinnedDrawRecords.push_back(record);
+
+	if (!packedBufferObjects.empty()) {
+		DrawRecord packedRecord = packedDrawRecords.back();
+		packedRecord.vao = bindSkinnedVAO(packedIndexBufferObjects[index]);
+		// Half float UVs from the packed vertices
+		glBindBuffer(GL_ARRAY_BUFFER, packedBufferObjects[index]);
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex),
+							  BUFFER_OFFSET(offsetof(PackedVertex, uv)));
+		skinnedPackedDrawRecords.push_back(packedRecord);
 	}
+
+	glBindVertexArray(0);
 }
 
-void Bot::drawModelNodes(const std::vector<PrimitiveObject>& primitiveObjects,
-						tinygltf::Model &model, tinygltf::Node &node) {
-		// Draw the mesh at the node, and recursively do so for children nodes
-		if ((node.mesh >= 0) && (node.mesh < model.meshes.size())) {
-			drawMesh(primitiveObjects, model, model.meshes[node.mesh]);
+void Bot::bindModel(tinygltf::Model &model) {
+	// Every bufferView is uploaded once and shared by all the meshes reading it
+	bufferObjects.assign(model.bufferViews.size(), 0);
+	for (size_t i = 0; i < model.bufferViews.size(); ++i) {
+		const tinygltf::BufferView &bufferView = model.bufferViews[i];
+
+		int target = bufferView.target;
+
+		if (bufferView.target == 0) {
+			// The bufferView with target == 0 in our model refers to
+			// the skinning weights, for 25 joints, each 4x4 matrix (16 floats), totaling to 400 floats or 1600 bytes.
+			// So it is considered safe to skip the warning.
+			//std::cout << "WARN: bufferView.target is zero" << std::endl;
+			continue;
 		}
-		for (size_t i = 0; i < node.children.size(); i++) {
-			drawModelNodes(primitiveObjects, model, model.nodes[node.children[i]]);
+
+		const tinygltf::Buffer &buffer = model.buffers[bufferView.buffer];
+		glGenBuffers(1, &bufferObjects[i]);
+		glBindBuffer(target, bufferObjects[i]);
+		glBufferData(target, bufferView.byteLength,
+					&buffer.data.at(0) + bufferView.byteOffset, GL_STATIC_DRAW);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	// Packed vertices and reordered indices of each primitive, prepared without GL by packVertices
+	packedBufferObjects.assign(packedPrimitives.size(), 0);
+	packedIndexBufferObjects.assign(packedPrimitives.size(), 0);
+	packedIndexTypes.assign(packedPrimitives.size(), GL_UNSIGNED_INT);
+	for (size_t i = 0; i < packedPrimitives.size(); ++i) {
+		const PackedPrimitive &packed = packedPrimitives[i];
+		glGenBuffers(1, &packedBufferObjects[i]);
+		glBindBuffer(GL_ARRAY_BUFFER, packedBufferObjects[i]);
+		glBufferData(GL_ARRAY_BUFFER, packed.vertices.size() * sizeof(PackedVertex),
+					 packed.vertices.data(), GL_STATIC_DRAW);
+
+		// 16 bit indices whenever the vertices fit
+		glGenBuffers(1, &packedIndexBufferObjects[i]);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, packedIndexBufferObjects[i]);
+		if (packed.vertices.size() <= 65536) {
+			std::vector<uint16_t> shortIndices(packed.indices.begin(), packed.indices.end());
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(uint16_t), shortIndices.data(),
+						 GL_STATIC_DRAW);
+			packedIndexTypes[i] = GL_UNSIGNED_SHORT;
+		} else {
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, packed.indices.size() * sizeof(uint32_t), packed.indices.data(),
+						 GL_STATIC_DRAW);
 		}
 	}
-	void Bot::drawModel(const std::vector<PrimitiveObject>& primitiveObjects,
-				tinygltf::Model &model) {
-		// Draw all nodes
-		const tinygltf::Scene &scene = model.scenes[model.defaultScene];
-		for (size_t i = 0; i < scene.nodes.size(); ++i) {
-			drawModelNodes(primitiveObjects, model, model.nodes[scene.nodes[i]]);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	// Draw records in scene order
+	lodDrawRecords.assign(packedPrimitives.empty() ? 0 : LOD_LEVEL_COUNT, std::vector<DrawRecord>());
+	for (size_t i = 0; i < scenePrimitives.size(); ++i) {
+		bindPrimitive(model, scenePrimitives[i], i);
+	}
+
+	VertexFormatStats::add(packingReport.vertexCount, packingReport.loadedBytesPerVertex,
+						   packedVertices ? packingReport.packedBytesPerVertex : packingReport.loadedBytesPerVertex);
+}
+
+void Bot::drawRecordList(const std::vector<DrawRecord> &records, int instanceCount) const {
+	for (const DrawRecord &record : records) {
+		glBindVertexArray(record.vao);
+		if (instanceCount > 0) {
+			glDrawElementsInstanced(record.mode, record.count, record.indexType,
+									BUFFER_OFFSET(record.indexOffset), instanceCount);
+		} else {
+			glDrawElements(record.mode, record.count, record.indexType,
+						   BUFFER_OFFSET(record.indexOffset));
 		}
 	}
+	glBindVertexArray(0);
+}
+
+void Bot::drawInstanced(int instanceCount, int lodLevel) {
+	if (instanceCount <= 0) {
+		return;
+	}
+	if (packedVertices && lodLevel > 0 && lodLevel < static_cast<int>(lodDrawRecords.size())) {
+		drawRecordList(lodDrawRecords[lodLevel], instanceCount);
+	} else {
+		drawRecordList(packedVertices ? packedDrawRecords : drawRecords, instanceCount);
+	}
+}
+
+int Bot::lodTriangleCount(int level) const {
+	if (lodTriangleCounts.empty()) {
+		return 0;
+	}
+	// As loaded the indices are the glTF's, as many as the packed full level
+	if (!packedVertices) {
+		level = 0;
+	}
+	return lodTriangleCounts[std::min(std::max(level, 0), static_cast<int>(lodTriangleCounts.size()) - 1)];
+}
+
+glm::mat4 Bot::positionDequantize() const {
+	return packedVertices ? positionQuantization.dequantize() : glm::mat4(1.0f);
+}
 
@@ -4,11 +4,14 @@
 
 in vec3 worldPosition;
 in vec3 worldNormal;
+in vec3 fragPosition;
+in vec3 fragNormal;
 
 out vec3 finalColor;
 
 uniform vec3 lightPosition;
 uniform vec3 lightIntensity;
+uniform vec3 cameraPosition;
 
 void main()
 {
@@ -17,6 +20,7 @@ vec3 lightDir = lightPosition - worldPosition;
 float lightDist = dot(lightDir, lightDir);
 lightDir = normalize(lightDir);
 vec3 v = lightIntensity * clamp(dot(lightDir, worldNormal), 0.0, 1.0) / lightDist;
+v += clusteredLighting(fragPosition, normalize(fragNormal), normalize(cameraPosition - fragPosition), 32.0);
 
 // Tone mapping
 v = v / (1.0 + v);
@@ -6,11 +6,17 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/string_cast.hpp>
 
 #include <tinygltf-2.9.3/tiny_gltf.h>
 
+#include "lightCluster.h"
+#include "meshOptimizer.h"
+#include "meshSimplifier.h"
+#include "vertexQuantization.h"
+
 
 #include <vector>
 #include <map>
@@ -18,31 +24,192 @@
 
 
 class Bot {
+    // Reads the compiled clip and skeleton to evaluate many bots at once
+    friend class AnimationBatch;
+
 public:
+    struct TransformComponents {
+        glm::vec3 translation = glm::vec3(0.0f);
+        glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+        glm::vec3 scale = glm::vec3(1.0f);
+    };
+
+    // Per-thread buffers of one pose evaluation
+    struct AnimationScratch {
+        std::vector<TransformComponents> pose;
+        std::vector<glm::mat4> globalTransforms;
+    };
+
     Bot();
     ~Bot();
 
     void initialize();
+    // Loads the model, skeleton and animations without touching GL, initialize calls it
+    bool prepare(const char *filename);
+    // Steady-state updates reuse the scratch buffers below and never allocate
     void update(float time);
-    void render(glm::mat4 cameraMatrix);
+    // Samples the first clip into the pose only, for benchmarks
+    void samplePose(float time);
+    int channelCount() const { return animationObjects.empty() ? 0 : static_cast<int>(animationObjects[0].channels.size()); }
+    int jointCount() const { return static_cast<int>(skeleton.jointSlots.size()); }
+    // Time of the last key of the first clip, where playback wraps
+    float clipDuration() const;
+
+    // Evaluation with caller-owned state, so many instances can share one Bot from
+    // several threads. keyCursors holds channelCount() entries per instance.
+    void prepareScratch(AnimationScratch &scratch) const;
+    // Writes jointCount() joint matrices of the first clip at time, without allocating
+    void evaluate(float time, int *keyCursors, AnimationScratch &scratch, glm::mat4 *jointMatrices) const;
+    // Draws every primitive instanceCount times with the program bound by the caller,
+    // from the given mesh LOD level
+    void drawInstanced(int instanceCount, int lodLevel = 0);
+    // Skins every vertex once with transform feedback into the skinned buffers,
+    // call after update and before any pass that draws the bot
+    void skin();
+    // Pre-skinned draws, neither of them skins again
+    void render(glm::mat4 cameraMatrix, glm::mat4 modelMatrix, const LightClusters &clusters, glm::vec3 cameraPosition);
+    // Positions only, for depth.vert style programs with an MVP uniform
+    void renderDepth(GLuint programID, glm::mat4 matrix, glm::mat4 modelMatrix);
     void cleanup();
 
+    // Vertices are packed to 24 bytes by prepare, and skinned and drawn from the
+    // packed copy unless disabled, then from the glTF buffers as loaded
+    void setPackedVertices(bool enabled) { packedVertices = enabled && !packedPrimitives.empty(); }
+    bool isPackedVertices() const { return packedVertices; }
+    // Maps the position attribute of drawInstanced back to model space
+    glm::mat4 positionDequantize() const;
+
+    struct VertexPackingReport {
+        int vertexCount = 0;
+        int loadedBytesPerVertex = 0; // Attributes as stored in the glTF
+        int packedBytesPerVertex = 0;
+        float maxPositionError = 0.0f; // Model units
+        float maxNormalError = 0.0f;   // Degrees
+        float maxUVError = 0.0f;
+        float maxWeightError = 0.0f;
+    };
+    const VertexPackingReport &vertexPacking() const { return packingReport; }
+
+    // Post-transform cache of each triangle primitive, glTF order against the
+    // optimized order the packed vertices are drawn in
+    struct MeshOptimizationReport {
+        int mesh = 0;
+        int triangleCount = 0;
+        int vertexCount = 0;
+        VertexCacheStats before, after;
+        bool overdrawSorted = false;
+    };
+    const std::vector<MeshOptimizationReport> &meshOptimization() const { return optimizationReports; }
+
+    // Mesh LOD: prepare simplifies every triangle primitive of the packed vertices
+    // into coarser index lists over the same vertices, level 0 is the full mesh.
+    // Without packed vertices only level 0 exists.
+    int lodLevelCount() const { return packedVertices ? static_cast<int>(lodTriangleCounts.size()) : 1; }
+    // Triangles of the whole model at a level
+    int lodTriangleCount(int level) const;
+
+    struct MeshLodReport {
+        int mesh = 0;
+        int level = 0;
+        int triangleCount = 0;
+        float error = 0.0f; // Largest collapse error, relative to the model size
+    };
+    const std::vector<MeshLodReport> &meshLods() const { return lodReports; }
+    float lodBuildMs() const { return lodMs; }
+
+    // Vertices skinned per frame, and passes that drew them since the last skin()
+    int skinnedVertexCount() const;
+    int skinnedPassCount() const { return lastSkinnedPasses; }
+
 private:
     // Shader variable IDs
     GLuint mvpMatrixID;
-    GLuint jointMatricesID;
     GLuint lightPositionID;
     GLuint lightIntensityID;
+    GLuint modelMatrixID;
+    GLuint normalMatrixID;
+    GLuint cameraPositionID;
     GLuint programID;
 
+    // Transform feedback skinning program
+    GLuint skinProgramID = 0;
+    GLuint skinJointMatricesID = 0;
+    GLuint skinDequantizeID = 0;
+
     tinygltf::Model model;
 
-    // Each VAO corresponds to each mesh primitive in the GLTF model
-    struct PrimitiveObject {
+    // One buffer object per glTF bufferView, 0 for views without a target
+    std::vector<GLuint> bufferObjects;
+
+    // The scene compiled at load time, one record per primitive in scene order.
+    // Drawing is a loop over these, the glTF is never walked again.
+    struct DrawRecord {
         GLuint vao;
-        std::map<int, GLuint> vbos;
+        GLenum mode;
+        GLsizei count;
+        GLenum indexType;
+        size_t indexOffset;
+        int material;
+        int node;
+    };
+    std::vector<DrawRecord> drawRecords;
+    // The same records drawing from the skinned buffers, skinned from the
+    // loaded or from the packed vertices
+    std::vector<DrawRecord> skinnedDrawRecords;
+    std::vector<DrawRecord> skinnedPackedDrawRecords;
+
+    // Skinning output of each record, interleaved position and normal in model space
+    struct SkinFeed {
+        GLuint feedbackBufferID;
+        GLsizei vertexCount;
+    };
+    std::vector<SkinFeed> skinFeeds;
+
+    // Primitives of the scene in draw order, found once by prepare
+    struct ScenePrimitive {
+        int mesh;
+        int primitive;
+        int node;
     };
-    std::vector<PrimitiveObject> primitiveObjects;
+    std::vector<ScenePrimitive> scenePrimitives;
+
+    // 24 bytes: UNORM16 position in the model bounds, 2_10_10_10 normal, half
+    // float UV, 8 bit joints and UNORM8 weights
+    struct PackedVertex {
+        uint16_t position[4];
+        uint32_t normal;
+        uint16_t uv[2];
+        uint8_t joints[4];
+        uint8_t weights[4];
+    };
+    // Vertices and indices of a primitive, both reordered by optimizePrimitive.
+    // The indices of every LOD level follow each other, level 0 first.
+    struct IndexRange {
+        size_t first;
+        size_t count;
+    };
+    struct PackedPrimitive {
+        std::vector<PackedVertex> vertices;
+        std::vector<uint32_t> indices;
+        std::vector<IndexRange> lods;
+    };
+    std::vector<PackedPrimitive> packedPrimitives;
+    std::vector<MeshOptimizationReport> optimizationReports;
+    std::vector<MeshLodReport> lodReports;
+    std::vector<int> lodTriangleCounts;
+    float lodMs = 0.0f;
+    PositionQuantization positionQuantization;
+    VertexPackingReport packingReport;
+    bool packedVertices = false;
+    std::vector<GLuint> packedBufferObjects;
+    std::vector<GLuint> packedIndexBufferObjects;
+    std::vector<GLenum> packedIndexTypes;
+    // The records again, drawing from the packed vertices, and per LOD level
+    // with the same VAOs, level 0 being packedDrawRecords
+    std::vector<DrawRecord> packedDrawRecords;
+    std::vector<std::vector<DrawRecord>> lodDrawRecords;
+    int skinnedPasses = 0;
+    int lastSkinnedPasses = 0;
 
     // Skinning
     struct SkinObject {
@@ -52,42 +219,60 @@ private:
     };
     std::vector<SkinObject> skinObjects;
 
-    // Animation
-    struct SamplerObject {
-        std::vector<float> input;
-        std::vector<glm::vec4> output;
-        int interpolation;
+    // Skeleton of the first skin, flattened so that every parent comes before its children
+    struct SkeletonObject {
+        std::vector<int> nodes;      // glTF node of each slot
+        std::vector<int> parents;    // Slot of the parent, -1 for the root
+        std::vector<int> nodeSlots;  // Slot of each glTF node, -1 outside the skeleton
+        std::vector<int> jointSlots; // Slot of each joint of the skin
+        std::vector<TransformComponents> restPose;
     };
+    SkeletonObject skeleton;
+
+    // Scratch buffers sized once by prepare
+    AnimationScratch scratch;
+
+    // Animation, compiled at load time. Every channel knows its skeleton slot and
+    // which component it drives, and its keys sit in the clip's shared arrays.
+    enum ChannelPath { PATH_TRANSLATION, PATH_ROTATION, PATH_SCALE };
 
     struct ChannelObject {
-        int sampler;
-        std::string targetPath;
-        int targetNode;
+        ChannelPath path;
+        int targetSlot;
+        int firstKey;
+        int keyCount;
     };
 
     struct AnimationObject {
-        std::vector<SamplerObject> samplers;
+        std::vector<ChannelObject> channels;
+        std::vector<float> times;      // Key times of all channels back to back
+        std::vector<glm::vec4> values; // Matching xyz or quaternion xyzw values
     };
     std::vector<AnimationObject> animationObjects;
+    // Key index per channel of the playing clip, advanced as time moves forward
+    std::vector<int> keyCursors;
 
     glm::mat4 inverseRootTransform;
 
     // Private member functions
-    glm::mat4 getNodeTransform(const tinygltf::Node& node);
-    void computeLocalNodeTransform(const tinygltf::Model& model, int nodeIndex, std::vector<glm::mat4>& localTransforms);
-    void computeGlobalNodeTransform(const tinygltf::Model& model, const std::vector<glm::mat4>& localTransforms, int nodeIndex, const glm::mat4& parentTransform, std::vector<glm::mat4>& globalTransforms);
+    SkeletonObject prepareSkeleton(const tinygltf::Model& model, int rootNodeIndex);
+    void computeGlobalTransforms(const std::vector<TransformComponents>& pose, std::vector<glm::mat4>& globalTransforms) const;
     std::vector<SkinObject> prepareSkinning(const tinygltf::Model& model);
-    int findKeyframeIndex(const std::vector<float>& times, float animationTime);
+    static int findKeyframeIndex(const float* times, int count, float animationTime);
+    // Key before the wrapped time and the blend factor towards the next key, steps the cursor
+    static int sampleKeys(const float* times, int keyCount, float time, int& cursor, float& factor);
     std::vector<AnimationObject> prepareAnimation(const tinygltf::Model& model);
-    void updateAnimation(const tinygltf::Model& model, const tinygltf::Animation& anim, const AnimationObject& animationObject, float time, std::vector<glm::mat4>& nodeTransforms);
-    void updateSkinning(const tinygltf::Skin& skin, const std::vector<glm::mat4>& nodeTransforms);
+    void updateAnimation(const AnimationObject& animationObject, float time, int* keyCursors, std::vector<TransformComponents>& pose) const;
+    void updateSkinning(const std::vector<glm::mat4>& globalTransforms, glm::mat4* jointMatrices) const;
     bool loadModel(tinygltf::Model& model, const char* filename);
-    void bindMesh(std::vector<PrimitiveObject>& primitiveObjects, tinygltf::Model& model, tinygltf::Mesh& mesh);
-    void bindModelNodes(std::vector<PrimitiveObject>& primitiveObjects, tinygltf::Model& model, tinygltf::Node& node);
-    std::vector<PrimitiveObject> bindModel(tinygltf::Model& model);
-    void drawMesh(const std::vector<PrimitiveObject>& primitiveObjects, tinygltf::Model& model, tinygltf::Mesh& mesh);
-    void drawModelNodes(const std::vector<PrimitiveObject>& primitiveObjects, tinygltf::Model& model, tinygltf::Node& node);
-    void drawModel(const std::vector<PrimitiveObject>& primitiveObjects, tinygltf::Model& model);
+    void collectPrimitives(const tinygltf::Model& model, int nodeIndex);
+    bool packVertices(const tinygltf::Model& model);
+    void optimizePrimitive(PackedPrimitive& packed, int mesh);
+    void buildLods(PackedPrimitive& packed, int mesh, int mode);
+    void bindPrimitive(tinygltf::Model& model, const ScenePrimitive& scenePrimitive, size_t index);
+    void bindModel(tinygltf::Model& model);
+    void drawRecordList(const std::vector<DrawRecord>& records, int instanceCount) const;
+    void drawSkinned();
 
 };
 
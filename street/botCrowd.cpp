@@ -0,0 +1,402 @@
+#include "botCrowd.h"
+#include "jobSystem.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+// Bots evaluated per job
+static const int BOTS_PER_JOB = 64;
+// Distance between neighbouring bots and the transform of a single bot
+static const float BOT_SPACING = 40.0f;
+static const glm::vec3 BOT_SCALE(2.0f, 1.5f, 2.0f);
+static const float BOT_HEIGHT = -180.0f;
+// Sample rate of the baked clip
+static const float BAKE_FRAMES_PER_SECOND = 30.0f;
+// Rough bounding radius of one bot, and the projected sizes, as a fraction of half
+// the screen height, down to which each LOD level is used
+static const float BOT_RADIUS = 50.0f;
+static const float FULL_RATE_SIZE = 0.15f;
+static const float HALF_RATE_SIZE = 0.06f;
+static const float QUARTER_RATE_SIZE = 0.03f;
+// Projected sizes below which each coarser mesh LOD level is used, and how far past
+// a threshold a bot has to get before it switches
+static const float MESH_LOD_SIZES[] = {0.1f, 0.05f, 0.025f};
+static const int MESH_LOD_SIZE_COUNT = sizeof(MESH_LOD_SIZES) / sizeof(MESH_LOD_SIZES[0]);
+static const float MESH_LOD_HYSTERESIS = 0.15f;
+
+// Same sun as Bot
+static glm::vec3 lightIntensity(5e6f, 5e6f, 5e6f);
+static glm::vec3 lightPosition(-275.0f, 500.0f, 800.0f);
+
+static float randomFloat() {
+    return static_cast<float>(rand()) / RAND_MAX;
+}
+
+// Stable counting sort of a list of bots by mesh LOD level. firsts has one entry
+// per level and one more, and receives where every level starts.
+template <typename Index>
+static void groupByLevel(std::vector<Index> &list, std::vector<Index> &scratch, const std::vector<uint8_t> &levels,
+                         std::vector<int> &firsts) {
+    std::fill(firsts.begin(), firsts.end(), 0);
+    for (Index bot: list) {
+        firsts[levels[bot] + 1]++;
+    }
+    for (size_t level = 1; level < firsts.size(); ++level) {
+        firsts[level] += firsts[level - 1];
+    }
+    scratch.resize(list.size());
+    for (Index bot: list) {
+        scratch[firsts[levels[bot]]++] = bot;
+    }
+    // Placing the bots moved every start to where the next level starts
+    for (size_t level = firsts.size() - 1; level > 0; --level) {
+        firsts[level] = firsts[level - 1];
+    }
+    firsts[0] = 0;
+    list.swap(scratch);
+}
+
+void BotCrowd::reserve(Bot &bot, int count) {
+    this->bot = &bot;
+    batch.prepare(bot);
+    botCount = maxBots > 0 ? std::min(count, maxBots) : count;
+    jointCount = bot.jointCount();
+    channelCount = bot.channelCount();
+
+    // Square grid centred on the origin, every bot facing a random way and out of step with the others
+    int side = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(botCount))));
+    float start = -0.5f * (side - 1) * BOT_SPACING;
+    modelMatrices.resize(botCount);
+    timeOffsets.resize(botCount);
+    timeScales.resize(botCount);
+    clipTimes.resize(botCount);
+    for (int i = 0; i < botCount; ++i) {
+        glm::vec3 position(start + (i % side) * BOT_SPACING, BOT_HEIGHT, start + (i / side) * BOT_SPACING);
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+        model = glm::rotate(model, randomFloat() * 6.2831853f, glm::vec3(0.0f, 1.0f, 0.0f));
+        modelMatrices[i] = glm::scale(model, BOT_SCALE);
+        timeOffsets[i] = randomFloat() * 10.0f;
+        timeScales[i] = 0.8f + randomFloat() * 0.4f;
+    }
+    keyCursors.assign(static_cast<size_t>(botCount) * channelCount, 0);
+    // Starting out as baked makes the first frame evaluate every animated bot
+    lodLevels.assign(botCount, LOD_BAKED);
+    freshFlags.assign(botCount, 0);
+    meshLevels.assign(botCount, 0);
+    drawBlends.assign(botCount, 1.0f);
+    palette.resize(static_cast<size_t>(botCount) * jointCount * 3);
+    previousPalette.resize(palette.size());
+
+    instanceData.resize(static_cast<size_t>(botCount) * 4);
+    for (int i = 0; i < botCount; ++i) {
+        const glm::mat4 &m = modelMatrices[i];
+        instanceData[i * 4 + 0] = glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+        instanceData[i * 4 + 1] = glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+        instanceData[i * 4 + 2] = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+        instanceData[i * 4 + 3] = glm::vec4(timeOffsets[i], timeScales[i], 0.0f, 0.0f);
+    }
+    instancesDirty = true;
+}
+
+void BotCrowd::initialize(Bot &bot, int count, GLuint shaderProgramID, GLuint bakedShaderProgramID) {
+    this->shaderProgramID = shaderProgramID;
+    this->bakedShaderProgramID = bakedShaderProgramID;
+
+    // GL 3.3 only guarantees 65536 texels in a texture buffer
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    maxBots = std::max(1, maxTexels / std::max(1, bot.jointCount() * 3));
+    std::cout << "Crowd: up to " << maxBots << " bots in one texture buffer" << std::endl;
+    reserve(bot, count);
+
+    paletteStream.initialize(std::max<size_t>(palette.size() * sizeof(glm::vec4), sizeof(glm::vec4)));
+    glGenTextures(1, &paletteTextureID);
+    bakedListStream.initialize(std::max<size_t>(botCount * sizeof(uint32_t), sizeof(uint32_t)));
+    glGenTextures(1, &bakedListTextureID);
+
+    bake.bake(bot, BAKE_FRAMES_PER_SECOND);
+    bakeTextureID = bake.createTexture();
+    glGenBuffers(1, &instanceBufferID);
+    glGenTextures(1, &instanceTextureID);
+    glGenQueries(QUERY_FRAMES * 2, &timerQueryIDs[0][0]);
+}
+
+void BotCrowd::setView(glm::mat4 projectionMatrix, glm::vec3 cameraPosition) {
+    hasView = true;
+    viewPosition = cameraPosition;
+    // 1 / tan(fovY / 2)
+    screenScale = projectionMatrix[1][1];
+}
+
+float BotCrowd::projectedSize(int index) const {
+    float distance = glm::length(glm::vec3(modelMatrices[index][3]) - viewPosition);
+    return BOT_RADIUS * screenScale / std::max(distance, 1.0f);
+}
+
+BotCrowd::AnimationLod BotCrowd::chooseLod(float size) const {
+    if (baked) {
+        return LOD_BAKED;
+    }
+    if (!lod || !hasView) {
+        return LOD_FULL;
+    }
+    if (size >= FULL_RATE_SIZE) {
+        return LOD_FULL;
+    }
+    if (size >= HALF_RATE_SIZE) {
+        return LOD_HALF;
+    }
+    return size >= QUARTER_RATE_SIZE ? LOD_QUARTER : LOD_BAKED;
+}
+
+int BotCrowd::chooseMeshLod(int current, float size) const {
+    int levelCount = std::min(bot->lodLevelCount(), MESH_LOD_SIZE_COUNT + 1);
+    if (!meshLod || !hasView || levelCount <= 1) {
+        return 0;
+    }
+    // Coarser once clearly below a threshold, finer again once clearly above it
+    int level = std::min(current, levelCount - 1);
+    while (level + 1 < levelCount && size < MESH_LOD_SIZES[level] * (1.0f - MESH_LOD_HYSTERESIS)) {
+        level++;
+    }
+    while (level > 0 && size > MESH_LOD_SIZES[level - 1] * (1.0f + MESH_LOD_HYSTERESIS)) {
+        level--;
+    }
+    return level;
+}
+
+int BotCrowd::meshLodCount(int level) const {
+    return level >= 0 && level < static_cast<int>(meshLevelCounts.size()) ? meshLevelCounts[level] : 0;
+}
+
+void BotCrowd::simulate(float time) {
+    currentTime = time;
+    frameIndex++;
+    if (botCount == 0 || jointCount == 0) {
+        return;
+    }
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    // Sort the bots into this frame's lists
+    evaluateList.clear();
+    drawList.clear();
+    bakedList.clear();
+    std::fill(lodCounts, lodCounts + LOD_LEVEL_COUNT, 0);
+    int meshLevelCount = bot->lodLevelCount();
+    meshLevelCounts.assign(meshLevelCount, 0);
+    lastMeshLodChanges = 0;
+    for (int i = 0; i < botCount; ++i) {
+        float size = hasView ? projectedSize(i) : 0.0f;
+        int meshLevel = chooseMeshLod(meshLevels[i], size);
+        lastMeshLodChanges += meshLevel != meshLevels[i];
+        meshLevels[i] = static_cast<uint8_t>(meshLevel);
+        meshLevelCounts[meshLevel]++;
+
+        AnimationLod level = chooseLod(size);
+        bool fresh = lodLevels[i] == LOD_BAKED;
+        lodLevels[i] = static_cast<uint8_t>(level);
+        lodCounts[level]++;
+        if (level == LOD_BAKED) {
+            bakedList.push_back(i);
+            continue;
+        }
+
+        // Frames since this bot's last slot, slots are staggered by bot index.
+        // A bot coming back from the bake has no valid palette and is evaluated right away.
+        int divisor = 1 << level;
+        int phase = static_cast<int>((frameIndex + i) & (divisor - 1));
+        if (phase == 0 || fresh) {
+            evaluateList.push_back(i);
+            clipTimes[i] = time * timeScales[i] + timeOffsets[i];
+            freshFlags[i] = fresh;
+        }
+        drawList.push_back(i);
+        drawBlends[i] = fresh ? 1.0f : (phase + 1) / static_cast<float>(divisor);
+    }
+
+    // One instanced draw per mesh LOD level for each list
+    drawLevelFirsts.resize(meshLevelCount + 1);
+    bakedLevelFirsts.resize(meshLevelCount + 1);
+    groupByLevel(drawList, drawListScratch, meshLevels, drawLevelFirsts);
+    groupByLevel(bakedList, bakedListScratch, meshLevels, bakedLevelFirsts);
+    drawnTriangles = 0;
+    for (int level = 0; level < meshLevelCount; ++level) {
+        drawnTriangles += static_cast<long long>(meshLevelCounts[level]) * bot->lodTriangleCount(level);
+    }
+    fullTriangles = static_cast<long long>(botCount) * bot->lodTriangleCount(0);
+
+    // Evaluate, whole SSE groups per job. The last evaluation is kept to blend from.
+    size_t botRows = static_cast<size_t>(jointCount) * 3;
+    int evaluateCount = static_cast<int>(evaluateList.size());
+    parallelFor((evaluateCount + AnimationBatch::LANES - 1) / AnimationBatch::LANES,
+                BOTS_PER_JOB / AnimationBatch::LANES, [&](int groupBegin, int groupEnd) {
+        int begin = groupBegin * AnimationBatch::LANES;
+        int end = std::min(groupEnd * AnimationBatch::LANES, evaluateCount);
+        for (int k = begin; k < end; ++k) {
+            size_t first = evaluateList[k] * botRows;
+            std::copy(&palette[first], &palette[first] + botRows, &previousPalette[first]);
+        }
+        batch.evaluate(end - begin, &evaluateList[begin], clipTimes.data(), modelMatrices.data(),
+                       keyCursors.data(), palette.data());
+        for (int k = begin; k < end; ++k) {
+            if (freshFlags[evaluateList[k]]) {
+                size_t first = evaluateList[k] * botRows;
+                std::copy(&palette[first], &palette[first] + botRows, &previousPalette[first]);
+            }
+        }
+    });
+
+    // Gather the palettes to draw, blended between the last two evaluations
+    drawPalette.resize(drawList.size() * botRows);
+    parallelFor(static_cast<int>(drawList.size()), BOTS_PER_JOB * 4, [&](int begin, int end) {
+        for (int k = begin; k < end; ++k) {
+            size_t first = drawList[k] * botRows;
+            glm::vec4 *rows = &drawPalette[k * botRows];
+            float blend = drawBlends[drawList[k]];
+            if (blend >= 1.0f) {
+                std::copy(&palette[first], &palette[first] + botRows, rows);
+            } else {
+                for (size_t r = 0; r < botRows; ++r) {
+                    rows[r] = glm::mix(previousPalette[first + r], palette[first + r], blend);
+                }
+            }
+        }
+    });
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    lastAnimationMs = std::chrono::duration<float, std::milli>(endTime - startTime).count();
+}
+
+void BotCrowd::upload() {
+    if (botCount == 0 || jointCount == 0) {
+        return;
+    }
+    // Only changes with the crowd size
+    if (instancesDirty) {
+        glBindBuffer(GL_TEXTURE_BUFFER, instanceBufferID);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4) * instanceData.size(), instanceData.data(),
+                     GL_STATIC_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_BUFFER, instanceTextureID);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instanceBufferID);
+        instancesDirty = false;
+    }
+    if (!drawList.empty()) {
+        paletteStream.write(drawPalette.data(), paletteBytes());
+        glBindTexture(GL_TEXTURE_BUFFER, paletteTextureID);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, paletteStream.buffer());
+    }
+    if (!bakedList.empty()) {
+        bakedListStream.write(bakedList.data(), sizeof(uint32_t) * bakedList.size());
+        glBindTexture(GL_TEXTURE_BUFFER, bakedListTextureID);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, bakedListStream.buffer());
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void BotCrowd::render(glm::mat4 vpMatrix, const LightClusters &clusters, glm::vec3 cameraPosition) {
+    if (botCount == 0 || jointCount == 0) {
+        return;
+    }
+    // While the GPU has not finished the oldest timer its queries stay untouched and
+    // this frame goes unmeasured, reusing them would drop that sample
+    readTimer();
+    bool timed = !timerPending[currentTimer];
+    if (timed) {
+        glQueryCounter(timerQueryIDs[currentTimer][0], GL_TIMESTAMP);
+    }
+
+    glm::mat4 positionDequantize = bot->positionDequantize();
+    auto setCommonUniforms = [&](GLuint programID) {
+        glUseProgram(programID);
+        glUniformMatrix4fv(glGetUniformLocation(programID, "vpMatrix"), 1, GL_FALSE, &vpMatrix[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(programID, "positionDequantize"), 1, GL_FALSE, &positionDequantize[0][0]);
+        glUniform1i(glGetUniformLocation(programID, "jointCount"), jointCount);
+        glUniform3fv(glGetUniformLocation(programID, "cameraPosition"), 1, &cameraPosition[0]);
+        glUniform3fv(glGetUniformLocation(programID, "lightPosition"), 1, &lightPosition[0]);
+        glUniform3fv(glGetUniformLocation(programID, "lightIntensity"), 1, &lightIntensity[0]);
+        clusters.applyUniforms(programID);
+    };
+    // The instances of a level are a range of the list, the shader offsets into it
+    auto drawLevels = [&](GLuint programID, const std::vector<int> &firsts) {
+        GLint instanceBaseID = glGetUniformLocation(programID, "instanceBase");
+        for (size_t level = 0; level + 1 < firsts.size(); ++level) {
+            int instances = firsts[level + 1] - firsts[level];
+            if (instances > 0) {
+                glUniform1i(instanceBaseID, firsts[level]);
+                bot->drawInstanced(instances, static_cast<int>(level));
+            }
+        }
+    };
+
+    if (!drawList.empty()) {
+        setCommonUniforms(shaderProgramID);
+        glActiveTexture(GL_TEXTURE7);
+        glBindTexture(GL_TEXTURE_BUFFER, paletteTextureID);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(glGetUniformLocation(shaderProgramID, "jointPalette"), 7);
+        drawLevels(shaderProgramID, drawLevelFirsts);
+    }
+
+    if (!bakedList.empty()) {
+        setCommonUniforms(bakedShaderProgramID);
+        glActiveTexture(GL_TEXTURE7);
+        glBindTexture(GL_TEXTURE_BUFFER, instanceTextureID);
+        glActiveTexture(GL_TEXTURE8);
+        glBindTexture(GL_TEXTURE_2D, bakeTextureID);
+        glActiveTexture(GL_TEXTURE9);
+        glBindTexture(GL_TEXTURE_BUFFER, bakedListTextureID);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(glGetUniformLocation(bakedShaderProgramID, "instanceData"), 7);
+        glUniform1i(glGetUniformLocation(bakedShaderProgramID, "animationFrames"), 8);
+        glUniform1i(glGetUniformLocation(bakedShaderProgramID, "bakedInstances"), 9);
+        glUniform1f(glGetUniformLocation(bakedShaderProgramID, "time"), currentTime);
+        glUniform1f(glGetUniformLocation(bakedShaderProgramID, "frameRate"), bake.frameRate());
+        glUniform1i(glGetUniformLocation(bakedShaderProgramID, "frameCount"), bake.frameCount());
+        drawLevels(bakedShaderProgramID, bakedLevelFirsts);
+    }
+
+    if (timed) {
+        glQueryCounter(timerQueryIDs[currentTimer][1], GL_TIMESTAMP);
+        timerPending[currentTimer] = true;
+        timerPacked[currentTimer] = bot->isPackedVertices();
+        currentTimer = (currentTimer + 1) % QUERY_FRAMES;
+    }
+}
+
+void BotCrowd::readTimer() {
+    int oldest = currentTimer;
+    if (!timerPending[oldest]) {
+        return;
+    }
+    GLint available = 0;
+    glGetQueryObjectiv(timerQueryIDs[oldest][1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return;
+    }
+    GLuint64 begin = 0, end = 0;
+    glGetQueryObjectui64v(timerQueryIDs[oldest][0], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(timerQueryIDs[oldest][1], GL_QUERY_RESULT, &end);
+    timerPending[oldest] = false;
+    float &drawMs = gpuDrawMs[timerPacked[oldest] ? 1 : 0];
+    float elapsedMs = (end - begin) / 1.0e6f;
+    drawMs = drawMs == 0.0f ? elapsedMs : drawMs * 0.8f + elapsedMs * 0.2f;
+}
+
+void BotCrowd::cleanup() {
+    paletteStream.cleanup();
+    bakedListStream.cleanup();
+    glDeleteTextures(1, &paletteTextureID);
+    glDeleteTextures(1, &bakedListTextureID);
+    glDeleteTextures(1, &bakeTextureID);
+    glDeleteTextures(1, &instanceTextureID);
+    glDeleteBuffers(1, &instanceBufferID);
+    paletteTextureID = bakedListTextureID = bakeTextureID = instanceTextureID = instanceBufferID = 0;
+    if (timerQueryIDs[0][0] != 0) {
+        glDeleteQueries(QUERY_FRAMES * 2, &timerQueryIDs[0][0]);
+    }
+}
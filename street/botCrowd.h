@@ -0,0 +1,157 @@
+#ifndef BOTCROWD_H
+#define BOTCROWD_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+#include "animationBake.h"
+#include "animationBatch.h"
+#include "bot.h"
+#include "lightCluster.h"
+#include "streamBuffer.h"
+
+// Many copies of one skinned Bot, drawn with one instanced call per primitive.
+// Every frame the joint matrices of the animated bots are evaluated four at a
+// time by an AnimationBatch on the job system, with the instance's model matrix
+// already applied, and streamed into a single texture buffer. The vertex shader
+// fetches its palette at gl_InstanceID * jointCount + joint, so the draw cost no
+// longer grows with the number of uniform uploads. Matrices are stored as three
+// RGBA32F rows.
+//
+// Bots far away are played back from an AnimationBake instead: the vertex
+// shader blends two baked frames at the bot's own time and applies its model
+// matrix, and nothing is evaluated or streamed for them on the CPU.
+//
+// Animation LOD picks the path per bot from its projected size on screen. Near
+// bots are evaluated every frame, mid range bots every second or fourth frame
+// and blended between their last two evaluations, the rest use the bake. The
+// reduced rate updates are staggered by bot index, so every frame evaluates
+// about the same number of skeletons.
+//
+// Mesh LOD picks one of the Bot's simplified index lists from the same
+// projected size, with hysteresis so bots near a threshold keep their level.
+// Both the palette and the baked lists are grouped by level, every level is
+// one instanced draw over its range of the list.
+//
+// The GPU time of the draw is measured with a pair of GL_TIMESTAMP queries,
+// since the frame's GL_TIME_ELAPSED query is already running, and read back a
+// few frames late; frames whose timer is still in flight go unmeasured. It is
+// kept apart for the packed and the loaded vertices of the Bot.
+class BotCrowd {
+public:
+    enum AnimationLod { LOD_FULL, LOD_HALF, LOD_QUARTER, LOD_BAKED, LOD_LEVEL_COUNT };
+
+    // Places count bots on a grid around the origin, no GL calls. Can be called
+    // again to change the crowd size, initialize caps it to what one texture buffer holds.
+    void reserve(Bot &bot, int count);
+    void initialize(Bot &bot, int count, GLuint shaderProgramID, GLuint bakedShaderProgramID);
+    // Camera for the animation LOD, without a view every bot runs at full rate
+    void setView(glm::mat4 projectionMatrix, glm::vec3 cameraPosition);
+    // Picks the LOD of every bot and evaluates the ones due this frame, no GL calls
+    void simulate(float time);
+    void upload();
+    void render(glm::mat4 vpMatrix, const LightClusters &clusters, glm::vec3 cameraPosition);
+    void cleanup();
+
+    // Every bot on the baked path, whatever its size
+    void setBaked(bool enabled) { baked = enabled; }
+    bool isBaked() const { return baked; }
+    void setLod(bool enabled) { lod = enabled; }
+    bool isLod() const { return lod; }
+    void setMeshLod(bool enabled) { meshLod = enabled; }
+    bool isMeshLod() const { return meshLod; }
+    // Scalar evaluation one bot at a time, for benchmarks
+    void setSimd(bool enabled) { batch.setSimd(enabled); }
+    const AnimationBake &animationBake() const { return bake; }
+
+    int count() const { return botCount; }
+    float animationMs() const { return lastAnimationMs; }
+    // Skeletons evaluated in the last frame, and bots at each LOD level
+    int evaluatedCount() const { return static_cast<int>(evaluateList.size()); }
+    int lodCount(AnimationLod level) const { return lodCounts[level]; }
+    // Bots at each mesh LOD level in the last frame, and how many changed level
+    int meshLodCount(int level) const;
+    int meshLodChanges() const { return lastMeshLodChanges; }
+    // Triangles drawn in the last frame, and what full detail would have drawn
+    long long triangleCount() const { return drawnTriangles; }
+    long long fullTriangleCount() const { return fullTriangles; }
+    // Bytes streamed to the palette buffer in the last frame
+    size_t paletteBytes() const { return drawPalette.size() * sizeof(glm::vec4); }
+    // GPU time of the draw with the Bot's packed or loaded vertices, 0 until measured
+    float drawMs(bool packedVertices) const { return gpuDrawMs[packedVertices ? 1 : 0]; }
+
+private:
+    static const int QUERY_FRAMES = 3;
+
+    Bot *bot = nullptr;
+    int botCount = 0;
+    int maxBots = 0; // 0 without a GL context
+    int jointCount = 0;
+    int channelCount = 0;
+    float lastAnimationMs = 0.0f;
+    float currentTime = 0.0f;
+    bool baked = false;
+    bool lod = true;
+    bool meshLod = true;
+
+    // View for the LOD, projected size is radius * screenScale / distance
+    bool hasView = false;
+    glm::vec3 viewPosition = glm::vec3(0.0f);
+    float screenScale = 1.0f;
+    unsigned int frameIndex = 0;
+    int lodCounts[LOD_LEVEL_COUNT] = {0, 0, 0, 0};
+
+    AnimationBatch batch;
+    std::vector<glm::mat4> modelMatrices;
+    std::vector<float> timeOffsets, timeScales;
+    std::vector<float> clipTimes;          // Clip time of every bot this frame
+    std::vector<int> keyCursors;           // channelCount entries per bot
+    std::vector<uint8_t> lodLevels;        // Level of every bot in the last frame
+    std::vector<uint8_t> freshFlags;       // Evaluated this frame without a valid previous palette
+    std::vector<uint8_t> meshLevels;       // Mesh LOD level of every bot in the last frame
+    std::vector<glm::vec4> palette;        // Last evaluation, jointCount * 3 rows per bot
+    std::vector<glm::vec4> previousPalette; // The evaluation before it
+    std::vector<float> drawBlends;         // Blend of every bot drawn with a palette this frame
+    // Per frame lists: bots to evaluate, bots drawn with a palette, baked bots.
+    // The draw lists are grouped by mesh LOD, each level starting at its entry of the firsts.
+    std::vector<int> evaluateList;
+    std::vector<int> drawList, drawListScratch;
+    std::vector<uint32_t> bakedList, bakedListScratch;
+    std::vector<int> drawLevelFirsts, bakedLevelFirsts;
+    std::vector<int> meshLevelCounts;
+    int lastMeshLodChanges = 0;
+    long long drawnTriangles = 0, fullTriangles = 0;
+    std::vector<glm::vec4> drawPalette;    // Palettes of drawList in order, what is streamed
+    // Model matrix rows and (time offset, time scale) per bot, for baked playback
+    std::vector<glm::vec4> instanceData;
+    bool instancesDirty = false;
+
+    StreamBuffer paletteStream;
+    GLuint paletteTextureID = 0;
+    GLuint shaderProgramID = 0;
+
+    AnimationBake bake;
+    GLuint bakeTextureID = 0;
+    GLuint instanceBufferID = 0, instanceTextureID = 0;
+    StreamBuffer bakedListStream;
+    GLuint bakedListTextureID = 0;
+    GLuint bakedShaderProgramID = 0;
+
+    // Begin and end timestamps of the draw, and the vertex format it used
+    GLuint timerQueryIDs[QUERY_FRAMES][2] = {};
+    bool timerPending[QUERY_FRAMES] = {};
+    bool timerPacked[QUERY_FRAMES] = {};
+    int currentTimer = 0;
+    float gpuDrawMs[2] = {0.0f, 0.0f}; // Loaded, packed
+
+    // Radius on screen as a fraction of half its height, needs a view
+    float projectedSize(int index) const;
+    AnimationLod chooseLod(float size) const;
+    int chooseMeshLod(int current, float size) const;
+    // Reads the oldest timer once the GPU has finished it
+    void readTimer();
+};
+
+#endif // BOTCROWD_H
@@ -0,0 +1,55 @@
+#version 330 core
+
+// Input, same attributes as bot.vert
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 1) in vec3 vertexNormal;
+layout(location = 2) in vec2 vertexUV;
+
+layout(location = 3) in uvec4 jointIndices;
+layout(location = 4) in vec4 jointWeights;
+
+// Output data, to be interpolated for each fragment
+out vec3 worldPosition;
+out vec3 worldNormal;
+out vec3 fragPosition;
+out vec3 fragNormal;
+
+uniform mat4 vpMatrix;
+// Maps UNORM16 positions back to model space, identity for float positions
+uniform mat4 positionDequantize;
+uniform int jointCount;
+// Three rows of model * joint matrix per joint, jointCount joints per instance
+uniform samplerBuffer jointPalette;
+// Palette of the first instance of this draw
+uniform int instanceBase;
+
+invariant gl_Position;
+
+void main() {
+    int paletteBase = (instanceBase + gl_InstanceID) * jointCount;
+    vec4 position = positionDequantize * vec4(vertexPosition, 1.0);
+    vec3 skinnedPosition = vec3(0.0);
+    vec3 skinnedNormal = vec3(0.0);
+
+    for (int i = 0; i < 4; i++) {
+        float weight = jointWeights[i];
+        if (weight > 0.0) {
+            int row = (paletteBase + int(jointIndices[i])) * 3;
+            vec4 row0 = texelFetch(jointPalette, row);
+            vec4 row1 = texelFetch(jointPalette, row + 1);
+            vec4 row2 = texelFetch(jointPalette, row + 2);
+
+            skinnedPosition += weight * vec3(dot(row0, position), dot(row1, position), dot(row2, position));
+            skinnedNormal += weight * vec3(dot(row0.xyz, vertexNormal), dot(row1.xyz, vertexNormal),
+                                           dot(row2.xyz, vertexNormal));
+        }
+    }
+
+    // The palette already holds the model matrix, so everything here is in world space
+    worldPosition = skinnedPosition;
+    worldNormal = normalize(skinnedNormal);
+    fragPosition = skinnedPosition;
+    fragNormal = worldNormal;
+
+    gl_Position = vpMatrix * vec4(skinnedPosition, 1.0);
+}
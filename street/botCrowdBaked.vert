@@ -0,0 +1,75 @@
+#version 330 core
+
+// Input, same attributes as bot.vert
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 1) in vec3 vertexNormal;
+layout(location = 2) in vec2 vertexUV;
+
+layout(location = 3) in uvec4 jointIndices;
+layout(location = 4) in vec4 jointWeights;
+
+// Output data, to be interpolated for each fragment
+out vec3 worldPosition;
+out vec3 worldNormal;
+out vec3 fragPosition;
+out vec3 fragNormal;
+
+uniform mat4 vpMatrix;
+// Maps UNORM16 positions back to model space, identity for float positions
+uniform mat4 positionDequantize;
+uniform int jointCount;
+uniform float time;
+// Baked clip: three rows of every joint matrix along x, one frame per row
+uniform sampler2D animationFrames;
+uniform float frameRate;
+uniform int frameCount;
+// Three rows of the model matrix and (time offset, time scale) per bot
+uniform samplerBuffer instanceData;
+// Bot of every instance, the draw covers its range from instanceBase on
+uniform usamplerBuffer bakedInstances;
+uniform int instanceBase;
+
+invariant gl_Position;
+
+void main() {
+    int instance = int(texelFetch(bakedInstances, instanceBase + gl_InstanceID).r) * 4;
+    vec4 model0 = texelFetch(instanceData, instance);
+    vec4 model1 = texelFetch(instanceData, instance + 1);
+    vec4 model2 = texelFetch(instanceData, instance + 2);
+    vec4 timing = texelFetch(instanceData, instance + 3);
+
+    // Blend the two baked frames around this bot's clip time, the texture holds frameCount + 1 rows
+    float frame = mod((time * timing.y + timing.x) * frameRate, float(frameCount));
+    int frame0 = min(int(frame), frameCount - 1);
+    int frame1 = frame0 + 1;
+    float blend = frame - float(frame0);
+
+    vec4 position = positionDequantize * vec4(vertexPosition, 1.0);
+    vec3 skinnedPosition = vec3(0.0);
+    vec3 skinnedNormal = vec3(0.0);
+    for (int i = 0; i < 4; i++) {
+        float weight = jointWeights[i];
+        if (weight > 0.0) {
+            int column = int(jointIndices[i]) * 3;
+            vec4 row0 = mix(texelFetch(animationFrames, ivec2(column, frame0), 0),
+                            texelFetch(animationFrames, ivec2(column, frame1), 0), blend);
+            vec4 row1 = mix(texelFetch(animationFrames, ivec2(column + 1, frame0), 0),
+                            texelFetch(animationFrames, ivec2(column + 1, frame1), 0), blend);
+            vec4 row2 = mix(texelFetch(animationFrames, ivec2(column + 2, frame0), 0),
+                            texelFetch(animationFrames, ivec2(column + 2, frame1), 0), blend);
+
+            skinnedPosition += weight * vec3(dot(row0, position), dot(row1, position), dot(row2, position));
+            skinnedNormal += weight * vec3(dot(row0.xyz, vertexNormal), dot(row1.xyz, vertexNormal),
+                                           dot(row2.xyz, vertexNormal));
+        }
+    }
+
+    vec4 local = vec4(skinnedPosition, 1.0);
+    worldPosition = vec3(dot(model0, local), dot(model1, local), dot(model2, local));
+    worldNormal = normalize(vec3(dot(model0.xyz, skinnedNormal), dot(model1.xyz, skinnedNormal),
+                                 dot(model2.xyz, skinnedNormal)));
+    fragPosition = worldPosition;
+    fragNormal = worldNormal;
+
+    gl_Position = vpMatrix * vec4(worldPosition, 1.0);
+}
@@ -0,0 +1,34 @@
+#version 330 core
+// Linear blend skinning of one vertex per point, the outputs are captured with
+// transform feedback and drawn by every pass that needs the bot this frame
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 1) in vec3 vertexNormal;
+
+layout(location = 3) in uvec4 jointIndices;
+layout(location = 4) in vec4 jointWeights;
+
+out vec3 skinnedPosition;
+out vec3 skinnedNormal;
+
+uniform mat4 jointMatrices[25];
+// Maps UNORM16 positions back to model space, identity for float positions
+uniform mat4 positionDequantize;
+
+void main() {
+    vec4 source = positionDequantize * vec4(vertexPosition, 1.0);
+    vec4 position = vec4(0.0);
+    vec3 normal = vec3(0.0);
+
+    // Need to loop over the four possible influences on the joints
+    for (int i = 0; i < 4; i++) {
+        float weight = jointWeights[i];
+        if (weight > 0.0) {
+            mat4 jointMatrix = jointMatrices[jointIndices[i]];
+            position += weight * (jointMatrix * source);
+            normal += weight * (mat3(jointMatrix) * vertexNormal);
+        }
+    }
+
+    skinnedPosition = vec3(position);
+    skinnedNormal = normalize(normal);
+}
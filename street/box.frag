@@ -4,11 +4,13 @@ in vec3 fragNormal;
 in vec3 fragPosition;
 in vec2 fragUV;
 in vec4 fragPosLightSpace;
+in vec2 fragAOUV;
 
 out vec4 FragColor;
 
 uniform sampler2D textureSampler;
 uniform sampler2D shadowMap;
+uniform sampler2D aoMap;
 uniform vec3 lightDirection;
 uniform vec3 lightColor;
 uniform vec3 lightPosition;
@@ -60,11 +62,12 @@ void main() {
     float shininess = 60.0f;
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
 
-    vec3 ambient = 0.3 * lightColor;
+    vec3 ambient = 0.3 * lightColor * texture(aoMap, fragAOUV).r;
     vec3 diffuse = diff * lightColor;
     vec3 specular = spec * lightColor;
 
     vec3 finalColor = ambient + (1.0 - shadow) * (diffuse * lightIntensity + specular * lightIntensity);
+    finalColor += clusteredLighting(fragPosition, normal, viewDir, shininess);
 
     vec4 textureColor = texture(textureSampler, fragUV);
     FragColor = vec4(finalColor * textureColor.rgb, textureColor.a);
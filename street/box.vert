@@ -4,18 +4,23 @@ layout(location = 0) in vec3 vertexPosition;
 layout(location = 1) in vec3 vertexColor;
 layout(location = 2) in vec2 vertexUV;
 layout(location = 3) in vec3 vertexNormal;
+layout(location = 4) in vec2 vertexAOUV;
 
 out vec3 fragColor;
 out vec2 fragUV;
 out vec3 fragPosition;
 out vec3 fragNormal;
 out vec4 fragPosLightSpace;
+out vec2 fragAOUV;
 
 uniform mat4 MVP;
 uniform mat4 modelMatrix;
 uniform mat3 normalMatrix;
 uniform mat4 lightSpaceMatrix;
 
+// Same expression as depth.vert, the depth pre-pass must match to the bit
+invariant gl_Position;
+
 void main() {
     vec4 worldPosition = modelMatrix * vec4(vertexPosition, 1.0);
     gl_Position = MVP * vec4(vertexPosition, 1.0);
@@ -24,4 +29,5 @@ void main() {
     fragPosition = vec3(worldPosition);
     fragNormal = normalize(normalMatrix * vertexNormal);
     fragPosLightSpace = lightSpaceMatrix * worldPosition;
+    fragAOUV = vertexAOUV;
 }
\ No newline at end of file
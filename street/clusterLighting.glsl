@@ -0,0 +1,51 @@
+// Clustered local lights, inserted after the #version line of the fragment
+// shaders that light with them (see LoadShadersFromFile)
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+uniform uvec3 clusterDims;
+uniform vec2 clusterScreenSize;
+uniform vec2 clusterDepthRange; // Camera near and far planes
+uniform vec2 clusterSliceParams; // Depth of the first slice, log slice scale
+
+vec3 clusteredLighting(vec3 position, vec3 normal, vec3 viewDir, float shininess) {
+    // Find the cluster of this fragment from its window position and view depth
+    float ndcDepth = gl_FragCoord.z * 2.0 - 1.0;
+    float zNear = clusterDepthRange.x;
+    float zFar = clusterDepthRange.y;
+    float viewDepth = 2.0 * zNear * zFar / (zFar + zNear - ndcDepth * (zFar - zNear));
+    uint slice = 0u;
+    if (viewDepth >= clusterSliceParams.x) {
+        slice = min(clusterDims.z - 1u, 1u + uint(log(viewDepth / clusterSliceParams.x) * clusterSliceParams.y));
+    }
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / clusterScreenSize * vec2(clusterDims.xy)), clusterDims.xy - 1u);
+    int cluster = int((slice * clusterDims.y + tile.y) * clusterDims.x + tile.x);
+    uvec2 range = texelFetch(clusterGrid, cluster).rg;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; ++i) {
+        int light = int(texelFetch(clusterIndices, int(range.x + i)).r) * 3;
+        vec4 positionRadius = texelFetch(clusterLights, light);
+        vec4 colorOuterCos = texelFetch(clusterLights, light + 1);
+        vec4 directionInnerCos = texelFetch(clusterLights, light + 2);
+
+        vec3 toLight = positionRadius.xyz - position;
+        float dist = length(toLight);
+        if (dist >= positionRadius.w) {
+            continue;
+        }
+        vec3 lightDir = toLight / dist;
+        float falloff = 1.0 - dist / positionRadius.w;
+        float attenuation = falloff * falloff;
+        if (colorOuterCos.w > -1.0) {
+            float cosAngle = dot(-lightDir, directionInnerCos.xyz);
+            attenuation *= smoothstep(colorOuterCos.w, directionInnerCos.w, cosAngle);
+        }
+
+        float diff = max(dot(normal, lightDir), 0.0);
+        vec3 halfDir = normalize(lightDir + viewDir);
+        float spec = pow(max(dot(normal, halfDir), 0.0), shininess);
+        result += attenuation * colorOuterCos.rgb * (diff + spec);
+    }
+    return result;
+}
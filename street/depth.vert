@@ -1,9 +1,12 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 lightSpaceMatrix;
-uniform mat4 modelMatrix;
+// Light or camera matrix times model matrix, multiplied on the CPU exactly as
+// the main passes build their MVP, so the depth pre-pass matches them bit for bit
+uniform mat4 MVP;
+
+invariant gl_Position;
 
 void main() {
-    gl_Position = lightSpaceMatrix * modelMatrix * vec4(aPos, 1.0);
+    gl_Position = MVP * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include "dynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <render/shader.h>
+
+void DynamicResolution::initialize(int width, int height, float targetFrameMs) {
+    this->width = width;
+    this->height = height;
+    targetMs = targetFrameMs;
+    currentWidth = width;
+    currentHeight = height;
+
+    // Offscreen target at full window size, lower scales use a sub-rectangle
+    glGenTextures(1, &colorTextureID);
+    glBindTexture(GL_TEXTURE_2D, colorTextureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenRenderbuffers(1, &depthRenderbufferID);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbufferID);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+    glGenFramebuffers(1, &framebufferID);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTextureID, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderbufferID);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Dynamic resolution framebuffer is incomplete." << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // Fullscreen triangle generated from gl_VertexID
+    glGenVertexArrays(1, &vertexArrayID);
+    programID = LoadShadersFromFile("../street/upscale.vert", "../street/upscale.frag");
+    if (programID == 0) {
+        std::cerr << "Failed to load upscale shaders." << std::endl;
+    }
+    sourceSizeID = glGetUniformLocation(programID, "sourceSize");
+    uvScaleID = glGetUniformLocation(programID, "uvScale");
+    textureSamplerID = glGetUniformLocation(programID, "textureSampler");
+
+    glGenQueries(QUERY_FRAMES, queryIDs);
+    for (int i = 0; i < QUERY_FRAMES; ++i) {
+        queryPending[i] = false;
+    }
+}
+
+void DynamicResolution::beginFrame() {
+    glBeginQuery(GL_TIME_ELAPSED, queryIDs[currentQuery]);
+}
+
+void DynamicResolution::bindSceneTarget() {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+    glViewport(0, 0, currentWidth, currentHeight);
+}
+
+void DynamicResolution::present() {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(programID);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, colorTextureID);
+    glUniform1i(textureSamplerID, 0);
+    glUniform2f(sourceSizeID, static_cast<float>(width), static_cast<float>(height));
+    glUniform2f(uvScaleID, static_cast<float>(currentWidth) / width, static_cast<float>(currentHeight) / height);
+
+    glBindVertexArray(vertexArrayID);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+
+    glEnable(GL_DEPTH_TEST);
+
+    glEndQuery(GL_TIME_ELAPSED);
+    queryPending[currentQuery] = true;
+    currentQuery = (currentQuery + 1) % QUERY_FRAMES;
+
+    updateScale();
+}
+
+void DynamicResolution::updateScale() {
+    // Read the oldest query only once the GPU has finished it
+    int oldest = currentQuery;
+    if (!queryPending[oldest]) {
+        return;
+    }
+    GLint available = 0;
+    glGetQueryObjectiv(queryIDs[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return;
+    }
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(queryIDs[oldest], GL_QUERY_RESULT, &elapsed);
+    queryPending[oldest] = false;
+    gpuTimeMs = gpuTimeMs * 0.8f + elapsed / 1.0e6f * 0.2f;
+
+    if (!enabled) {
+        return;
+    }
+
+    // Shading cost grows with the pixel count, i.e. with scale squared. Only
+    // react outside a dead band and limit the step so the image does not pump.
+    if (gpuTimeMs > targetMs || gpuTimeMs < targetMs * 0.85f) {
+        float desired = resolutionScale * std::sqrt(targetMs * 0.92f / std::max(gpuTimeMs, 0.1f));
+        float step = std::min(0.02f, std::max(-0.05f, desired - resolutionScale));
+        resolutionScale = std::min(maxScale, std::max(minScale, resolutionScale + step));
+    }
+    if (resolutionScale >= maxScale) {
+        currentWidth = width;
+        currentHeight = height;
+    } else {
+        currentWidth = std::max(2, static_cast<int>(width * resolutionScale) & ~1);
+        currentHeight = std::max(2, static_cast<int>(height * resolutionScale) & ~1);
+    }
+}
+
+void DynamicResolution::setEnabled(bool enabled) {
+    this->enabled = enabled;
+    if (!enabled) {
+        resolutionScale = maxScale;
+        currentWidth = width;
+        currentHeight = height;
+    }
+}
+
+void DynamicResolution::cleanup() {
+    glDeleteQueries(QUERY_FRAMES, queryIDs);
+    glDeleteFramebuffers(1, &framebufferID);
+    glDeleteTextures(1, &colorTextureID);
+    glDeleteRenderbuffers(1, &depthRenderbufferID);
+    glDeleteVertexArrays(1, &vertexArrayID);
+    glDeleteProgram(programID);
+}
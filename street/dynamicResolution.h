@@ -0,0 +1,51 @@
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+
+#include <glad/gl.h>
+
+// Renders the 3D passes into an offscreen target whose resolution follows a
+// frame time governor, then upscales the result to the window with a
+// Catmull-Rom filter. The GPU time of each frame is measured with
+// GL_TIME_ELAPSED queries that are read back a few frames late.
+class DynamicResolution {
+public:
+    void initialize(int width, int height, float targetFrameMs);
+    void beginFrame();
+    // Binds the offscreen target and sets the viewport to the current render size
+    void bindSceneTarget();
+    // Upscales the scene into the default framebuffer and updates the scale for the next frame
+    void present();
+    void cleanup();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return enabled; }
+    int renderWidth() const { return currentWidth; }
+    int renderHeight() const { return currentHeight; }
+    float scale() const { return resolutionScale; }
+    float gpuFrameMs() const { return gpuTimeMs; }
+
+private:
+    static const int QUERY_FRAMES = 3;
+
+    int width = 0, height = 0; // Window size, also the size of the target
+    int currentWidth = 0, currentHeight = 0;
+    bool enabled = true;
+
+    float targetMs = 16.6f;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+    float resolutionScale = 1.0f;
+    float gpuTimeMs = 0.0f;
+
+    GLuint framebufferID, colorTextureID, depthRenderbufferID;
+    GLuint vertexArrayID, programID;
+    GLuint sourceSizeID, uvScaleID, textureSamplerID;
+
+    GLuint queryIDs[QUERY_FRAMES];
+    bool queryPending[QUERY_FRAMES];
+    int currentQuery = 0;
+
+    void updateScale();
+};
+
+#endif // DYNAMICRESOLUTION_H
@@ -0,0 +1,321 @@
+#include "flock.h"
+#include "jobSystem.h"
+
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FLOCK_SSE 1
+#endif
+
+// Items per job for the per-bird passes
+static const int BIRDS_PER_JOB = 2048;
+// Table entries per block of the parallel prefix sum
+static const int PREFIX_BLOCK = 16384;
+
+static float randomFloat() {
+    return static_cast<float>(rand()) / RAND_MAX;
+}
+
+void Flock::reserve(int count, const FlockSettings &settings) {
+    this->settings = settings;
+    birdCount = count;
+    for (std::vector<float> *field: {&positionX, &positionY, &positionZ, &velocityX, &velocityY, &velocityZ,
+                                     &sortedPositionX, &sortedPositionY, &sortedPositionZ,
+                                     &sortedVelocityX, &sortedVelocityY, &sortedVelocityZ}) {
+        field->resize(count);
+    }
+    cellKeys.resize(count);
+    vertices.resize(count);
+
+    uint32_t tableSize = 1;
+    while (tableSize < static_cast<uint32_t>(count)) {
+        tableSize <<= 1;
+    }
+    tableMask = tableSize - 1;
+    cellStart.resize(tableSize + 1);
+    cellCursor.reset(new std::atomic<uint32_t>[tableSize]);
+
+    glm::vec3 extent = settings.boundsMax - settings.boundsMin;
+    for (int i = 0; i < count; ++i) {
+        positionX[i] = settings.boundsMin.x + randomFloat() * extent.x;
+        positionY[i] = settings.boundsMin.y + randomFloat() * extent.y;
+        positionZ[i] = settings.boundsMin.z + randomFloat() * extent.z;
+        glm::vec3 velocity = glm::vec3(randomFloat(), randomFloat() * 0.2f, randomFloat()) * 2.0f - 1.0f;
+        velocity = glm::normalize(velocity) * settings.minSpeed;
+        velocityX[i] = velocity.x;
+        velocityY[i] = velocity.y;
+        velocityZ[i] = velocity.z;
+    }
+}
+
+void Flock::initialize(int count, const FlockSettings &settings, GLuint shaderProgramID) {
+    this->shaderProgramID = shaderProgramID;
+    reserve(count, settings);
+
+    vertexStream.initialize(sizeof(BirdVertex) * count);
+    glGenVertexArrays(1, &birdVAO);
+    glBindVertexArray(birdVAO);
+    glEnableVertexAttribArray(0); // Position
+    glEnableVertexAttribArray(1); // Color
+    glEnableVertexAttribArray(2); // Size
+    glBindVertexArray(0);
+}
+
+// y and z are hashed, x is added on top so neighbouring cells along x land in neighbouring buckets
+uint32_t Flock::cellKey(int x, int y, int z) const {
+    return ((static_cast<uint32_t>(y) * 19349663u ^ static_cast<uint32_t>(z) * 83492791u) +
+            static_cast<uint32_t>(x)) & tableMask;
+}
+
+void Flock::sortIntoCells() {
+    int tableSize = static_cast<int>(tableMask) + 1;
+    float inverseCell = 1.0f / settings.neighbourRadius;
+
+    // Count the birds of every cell
+    parallelFor(tableSize, PREFIX_BLOCK, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            cellCursor[i].store(0, std::memory_order_relaxed);
+        }
+    });
+    parallelFor(birdCount, BIRDS_PER_JOB, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            uint32_t key = cellKey(static_cast<int>(std::floor(positionX[i] * inverseCell)),
+                                   static_cast<int>(std::floor(positionY[i] * inverseCell)),
+                                   static_cast<int>(std::floor(positionZ[i] * inverseCell)));
+            cellKeys[i] = key;
+            cellCursor[key].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    // Exclusive prefix sum in blocks: block totals, their offsets, then every block on its own
+    int blockCount = (tableSize + PREFIX_BLOCK - 1) / PREFIX_BLOCK;
+    std::vector<uint32_t> blockOffsets(blockCount + 1, 0);
+    parallelFor(blockCount, 1, [&](int begin, int end) {
+        for (int b = begin; b < end; ++b) {
+            uint32_t total = 0;
+            int last = std::min(tableSize, (b + 1) * PREFIX_BLOCK);
+            for (int i = b * PREFIX_BLOCK; i < last; ++i) {
+                total += cellCursor[i].load(std::memory_order_relaxed);
+            }
+            blockOffsets[b + 1] = total;
+        }
+    });
+    for (int b = 0; b < blockCount; ++b) {
+        blockOffsets[b + 1] += blockOffsets[b];
+    }
+    parallelFor(blockCount, 1, [&](int begin, int end) {
+        for (int b = begin; b < end; ++b) {
+            uint32_t offset = blockOffsets[b];
+            int last = std::min(tableSize, (b + 1) * PREFIX_BLOCK);
+            for (int i = b * PREFIX_BLOCK; i < last; ++i) {
+                uint32_t cellCount = cellCursor[i].load(std::memory_order_relaxed);
+                cellStart[i] = offset;
+                cellCursor[i].store(offset, std::memory_order_relaxed);
+                offset += cellCount;
+            }
+        }
+    });
+    cellStart[tableSize] = static_cast<uint32_t>(birdCount);
+
+    // Scatter into cell order, the order inside a cell does not matter
+    parallelFor(birdCount, BIRDS_PER_JOB, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            uint32_t slot = cellCursor[cellKeys[i]].fetch_add(1, std::memory_order_relaxed);
+            sortedPositionX[slot] = positionX[i];
+            sortedPositionY[slot] = positionY[i];
+            sortedPositionZ[slot] = positionZ[i];
+            sortedVelocityX[slot] = velocityX[i];
+            sortedVelocityY[slot] = velocityY[i];
+            sortedVelocityZ[slot] = velocityZ[i];
+        }
+    });
+}
+
+// Steers the bird at sorted index i and writes its new state to index i of the current arrays
+int Flock::steer(int i, float deltaTime) {
+    glm::vec3 position(sortedPositionX[i], sortedPositionY[i], sortedPositionZ[i]);
+    glm::vec3 velocity(sortedVelocityX[i], sortedVelocityY[i], sortedVelocityZ[i]);
+    float radius = settings.neighbourRadius;
+    float radiusSquared = radius * radius;
+    glm::ivec3 cell = glm::ivec3(glm::floor(position / radius));
+
+    // Sums over the neighbours of relative position, velocity and position / distance^2
+    glm::vec3 offsetSum(0.0f), velocitySum(0.0f), separationSum(0.0f);
+    float neighbours = 0.0f;
+
+#ifdef FLOCK_SSE
+    __m128 selfX = _mm_set1_ps(position.x), selfY = _mm_set1_ps(position.y), selfZ = _mm_set1_ps(position.z);
+    __m128 radius4 = _mm_set1_ps(radiusSquared), zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    __m128 offsetX4 = zero, offsetY4 = zero, offsetZ4 = zero;
+    __m128 velocityX4 = zero, velocityY4 = zero, velocityZ4 = zero;
+    __m128 separationX4 = zero, separationY4 = zero, separationZ4 = zero, count4 = zero;
+#endif
+
+    // Accumulates every bird of the contiguous sorted range [j, end)
+    auto visit = [&](int j, int end) {
+#ifdef FLOCK_SSE
+        for (; simd && j + 4 <= end; j += 4) {
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(&sortedPositionX[j]), selfX);
+            __m128 dy = _mm_sub_ps(_mm_loadu_ps(&sortedPositionY[j]), selfY);
+            __m128 dz = _mm_sub_ps(_mm_loadu_ps(&sortedPositionZ[j]), selfZ);
+            __m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            // In range and not the bird itself
+            __m128 mask = _mm_and_ps(_mm_cmplt_ps(distanceSquared, radius4), _mm_cmpgt_ps(distanceSquared, zero));
+            __m128 inverse = _mm_and_ps(mask, _mm_div_ps(one, _mm_max_ps(distanceSquared, one)));
+            dx = _mm_and_ps(mask, dx);
+            dy = _mm_and_ps(mask, dy);
+            dz = _mm_and_ps(mask, dz);
+            offsetX4 = _mm_add_ps(offsetX4, dx);
+            offsetY4 = _mm_add_ps(offsetY4, dy);
+            offsetZ4 = _mm_add_ps(offsetZ4, dz);
+            velocityX4 = _mm_add_ps(velocityX4, _mm_and_ps(mask, _mm_loadu_ps(&sortedVelocityX[j])));
+            velocityY4 = _mm_add_ps(velocityY4, _mm_and_ps(mask, _mm_loadu_ps(&sortedVelocityY[j])));
+            velocityZ4 = _mm_add_ps(velocityZ4, _mm_and_ps(mask, _mm_loadu_ps(&sortedVelocityZ[j])));
+            separationX4 = _mm_add_ps(separationX4, _mm_mul_ps(dx, inverse));
+            separationY4 = _mm_add_ps(separationY4, _mm_mul_ps(dy, inverse));
+            separationZ4 = _mm_add_ps(separationZ4, _mm_mul_ps(dz, inverse));
+            count4 = _mm_add_ps(count4, _mm_and_ps(mask, one));
+        }
+#endif
+        for (; j < end; ++j) {
+            glm::vec3 offset = glm::vec3(sortedPositionX[j], sortedPositionY[j], sortedPositionZ[j]) - position;
+            float distanceSquared = glm::dot(offset, offset);
+            if (distanceSquared >= radiusSquared || distanceSquared <= 0.0f) {
+                continue;
+            }
+            offsetSum += offset;
+            velocitySum += glm::vec3(sortedVelocityX[j], sortedVelocityY[j], sortedVelocityZ[j]);
+            separationSum += offset / std::max(distanceSquared, 1.0f);
+            neighbours += 1.0f;
+        }
+    };
+
+    // The three cells of a row along x are consecutive buckets, so their birds are one
+    // run of memory. Buckets already covered by an earlier row are skipped, so a hash
+    // collision between rows never counts a bird twice.
+    uint32_t rowStart[9];
+    int rowCount = 0;
+    for (int z = -1; z <= 1; ++z) {
+        for (int y = -1; y <= 1; ++y) {
+            uint32_t first = cellKey(cell.x - 1, cell.y + y, cell.z + z);
+            int runBegin = static_cast<int>(cellStart[first]), runEnd = runBegin;
+            for (uint32_t k = 0; k < 3; ++k) {
+                uint32_t key = (first + k) & tableMask;
+                bool seen = false;
+                for (int r = 0; r < rowCount; ++r) {
+                    seen = seen || ((key - rowStart[r]) & tableMask) < 3;
+                }
+                if (seen) {
+                    visit(runBegin, runEnd);
+                    runBegin = runEnd = static_cast<int>(cellStart[key + 1]);
+                    continue;
+                }
+                if (key == 0 && k > 0) {
+                    // Wrapped around the table, bucket 0 does not follow the last one in memory
+                    visit(runBegin, runEnd);
+                    runBegin = 0;
+                }
+                runEnd = static_cast<int>(cellStart[key + 1]);
+            }
+            visit(runBegin, runEnd);
+            rowStart[rowCount++] = first;
+        }
+    }
+
+#ifdef FLOCK_SSE
+    float lanes[4];
+    auto sum = [&lanes](__m128 value) {
+        _mm_storeu_ps(lanes, value);
+        return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    };
+    offsetSum += glm::vec3(sum(offsetX4), sum(offsetY4), sum(offsetZ4));
+    velocitySum += glm::vec3(sum(velocityX4), sum(velocityY4), sum(velocityZ4));
+    separationSum += glm::vec3(sum(separationX4), sum(separationY4), sum(separationZ4));
+    neighbours += sum(count4);
+#endif
+
+    // Desired velocity from the three rules, each term about one max speed at full strength
+    glm::vec3 desired = velocity;
+    if (neighbours > 0.0f) {
+        glm::vec3 towardsCenter = offsetSum / neighbours / radius;
+        glm::vec3 matchVelocity = (velocitySum / neighbours - velocity) / settings.maxSpeed;
+        glm::vec3 awayFromOthers = -separationSum * radius;
+        desired += (settings.cohesion * towardsCenter + settings.alignment * matchVelocity +
+                    settings.separation * awayFromOthers) * settings.maxSpeed;
+    }
+    // Turn back once outside the bounds, harder the further out
+    glm::vec3 outside = glm::max(settings.boundsMin - position, glm::vec3(0.0f)) -
+                        glm::max(position - settings.boundsMax, glm::vec3(0.0f));
+    desired += outside / radius * settings.maxSpeed;
+
+    velocity += (desired - velocity) * std::min(1.0f, settings.turnRate * deltaTime);
+    float speed = glm::length(velocity);
+    if (speed > 0.0f) {
+        velocity *= glm::clamp(speed, settings.minSpeed, settings.maxSpeed) / speed;
+    }
+    position += velocity * deltaTime;
+
+    positionX[i] = position.x;
+    positionY[i] = position.y;
+    positionZ[i] = position.z;
+    velocityX[i] = velocity.x;
+    velocityY[i] = velocity.y;
+    velocityZ[i] = velocity.z;
+    return static_cast<int>(neighbours);
+}
+
+void Flock::simulate(float deltaTime) {
+    auto startTime = std::chrono::high_resolution_clock::now();
+    sortIntoCells();
+
+    GLuint packedColor = glm::packUnorm4x8(settings.color);
+    GLushort packedSize = glm::packHalf1x16(settings.size);
+    std::atomic<long long> neighbourTotal{0};
+    parallelFor(birdCount, BIRDS_PER_JOB, [&](int begin, int end) {
+        long long found = 0;
+        for (int i = begin; i < end; ++i) {
+            found += steer(i, deltaTime);
+            vertices[i] = {glm::vec3(positionX[i], positionY[i], positionZ[i]), packedColor, packedSize, 0};
+        }
+        neighbourTotal += found;
+    });
+
+    lastAverageNeighbours = birdCount > 0 ? static_cast<float>(neighbourTotal) / birdCount : 0.0f;
+    lastStepMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+}
+
+void Flock::upload() {
+    vertexStream.write(vertices.data(), sizeof(BirdVertex) * vertices.size());
+
+    glBindVertexArray(birdVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexStream.buffer());
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(BirdVertex), (void*)offsetof(BirdVertex, position));
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(BirdVertex), (void*)offsetof(BirdVertex, color));
+    glVertexAttribPointer(2, 1, GL_HALF_FLOAT, GL_FALSE, sizeof(BirdVertex), (void*)offsetof(BirdVertex, size));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Flock::render(glm::mat4 vpMatrix) {
+    if (birdCount == 0) {
+        return;
+    }
+    glUseProgram(shaderProgramID);
+    glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "vpMatrix"), 1, GL_FALSE, &vpMatrix[0][0]);
+
+    glBindVertexArray(birdVAO);
+    glDrawArrays(GL_POINTS, 0, birdCount);
+    glBindVertexArray(0);
+}
+
+void Flock::cleanup() {
+    vertexStream.cleanup();
+    glDeleteVertexArrays(1, &birdVAO);
+    birdVAO = 0;
+}
@@ -0,0 +1,87 @@
+#ifndef FLOCK_H
+#define FLOCK_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "streamBuffer.h"
+
+struct FlockSettings {
+    glm::vec3 boundsMin = glm::vec3(-800.0f, 200.0f, -800.0f);
+    glm::vec3 boundsMax = glm::vec3(800.0f, 500.0f, 800.0f);
+    float neighbourRadius = 20.0f; // Also the cell size of the grid
+    float separation = 1.5f;
+    float alignment = 1.0f;
+    float cohesion = 0.6f;
+    float minSpeed = 20.0f;
+    float maxSpeed = 60.0f;
+    float turnRate = 4.0f; // How fast velocity follows the steering, per second
+    glm::vec4 color = glm::vec4(1.0f, 0.9f, 0.6f, 1.0f);
+    float size = 6.0f;
+};
+
+// Boids flocking: every bird steers by separation, alignment and cohesion with the
+// others within neighbourRadius. Each step counting-sorts the birds by a hashed
+// grid cell of neighbourRadius, so a neighbour query only visits the 27 cells
+// around a bird and the whole step stays O(n). The birds are stored in cell order,
+// which keeps every query a few contiguous runs of memory. Sorting and steering
+// run on the job system, the neighbour loop uses SSE for four birds at a time.
+class Flock {
+public:
+    // Creates the birds at random positions inside the bounds, no GL calls
+    void reserve(int count, const FlockSettings &settings);
+    void initialize(int count, const FlockSettings &settings, GLuint shaderProgramID);
+    // Sorts and steers every bird, no GL calls
+    void simulate(float deltaTime);
+    void upload();
+    void render(glm::mat4 vpMatrix);
+    void cleanup();
+
+    // Scalar neighbour loop instead of SSE, for benchmarks
+    void setSimd(bool enabled) { simd = enabled; }
+    int count() const { return birdCount; }
+    float stepMs() const { return lastStepMs; }
+    // Average neighbours found per bird in the last step
+    float averageNeighbours() const { return lastAverageNeighbours; }
+
+private:
+    // Matches the attributes of particle.vert
+    struct BirdVertex {
+        glm::vec3 position;
+        GLuint color;   // RGBA8
+        GLushort size;  // Half float
+        GLushort padding;
+    };
+
+    FlockSettings settings;
+    int birdCount = 0;
+    bool simd = true;
+    float lastStepMs = 0.0f;
+    float lastAverageNeighbours = 0.0f;
+
+    // Current state and the cell sorted copy the neighbour queries read from
+    std::vector<float> positionX, positionY, positionZ, velocityX, velocityY, velocityZ;
+    std::vector<float> sortedPositionX, sortedPositionY, sortedPositionZ;
+    std::vector<float> sortedVelocityX, sortedVelocityY, sortedVelocityZ;
+    std::vector<uint32_t> cellKeys;
+
+    // Spatial hash, a power of two at least as large as the bird count
+    uint32_t tableMask = 0;
+    std::vector<uint32_t> cellStart; // Table size + 1 entries, birds of cell c are [cellStart[c], cellStart[c + 1])
+    std::unique_ptr<std::atomic<uint32_t>[]> cellCursor;
+
+    std::vector<BirdVertex> vertices;
+    GLuint birdVAO = 0;
+    StreamBuffer vertexStream;
+    GLuint shaderProgramID = 0;
+
+    uint32_t cellKey(int x, int y, int z) const;
+    void sortIntoCells();
+    int steer(int bird, float deltaTime);
+};
+
+#endif // FLOCK_H
@@ -9,6 +9,8 @@ out vec4 finalColor;
 
 uniform sampler2D textureSampler;
 uniform sampler2D shadowMap;
+uniform sampler2D aoMap;
+uniform vec4 aoTile; // Offset and size of this quad in the ambient occlusion atlas
 uniform vec3 lightDirection;
 uniform vec3 lightColor;
 uniform vec3 lightPosition;
@@ -62,11 +64,12 @@ void main() {
     float shininess = 12.0f;
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess) * 0.4;
 
-    vec3 ambient = 0.1 * lightColor;
+    vec3 ambient = 0.1 * lightColor * texture(aoMap, aoTile.xy + UV * aoTile.zw).r;
     vec3 diffuse = diff * lightColor * lightIntensity;
     vec3 specular = spec * lightColor * lightIntensity;
 
     vec3 finalLighting = ambient + (1.0 - shadow) * (diffuse + specular);
+    finalLighting += clusteredLighting(fragPosition, normal, viewDir, shininess);
 
     vec3 materialColor = texture(textureSampler, UV).rgb;
     finalColor = vec4(finalLighting * materialColor, 1.0);
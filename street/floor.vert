@@ -13,6 +13,9 @@ uniform mat4 modelMatrix;
 uniform mat3 normalMatrix;
 uniform mat4 lightSpaceMatrix;
 
+// Same expression as depth.vert, the depth pre-pass must match to the bit
+invariant gl_Position;
+
 void main() {
 
     vec4 worldPosition = modelMatrix * vec4(vertexPosition_modelspace, 1.0);
@@ -0,0 +1,166 @@
+#include "jobSystem.h"
+
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <thread>
+
+struct JobSystem::Queue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+};
+
+std::vector<JobSystem::Queue *> JobSystem::queues;
+
+// Queue of the current thread, the main thread and unknown threads use queue 0
+static thread_local int threadIndex = 0;
+
+static std::vector<std::thread> workers;
+static std::atomic<int> queuedJobs{0};
+static std::atomic<bool> quitting{false};
+static std::mutex sleepMutex;
+static std::condition_variable wakeCondition;
+
+void JobSystem::initialize(int workerCount) {
+    if (workerCount < 0) {
+        workerCount = std::max(0, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    }
+    quitting = false;
+    for (int i = 0; i <= workerCount; ++i) {
+        queues.push_back(new Queue());
+    }
+    for (int i = 1; i <= workerCount; ++i) {
+        workers.emplace_back(workerLoop, i);
+    }
+    std::cout << "Job system: " << workerCount << " worker threads" << std::endl;
+}
+
+void JobSystem::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        quitting = true;
+    }
+    wakeCondition.notify_all();
+    for (std::thread &worker: workers) {
+        worker.join();
+    }
+    workers.clear();
+    for (Queue *queue: queues) {
+        delete queue;
+    }
+    queues.clear();
+}
+
+void JobSystem::push(Job job) {
+    if (queues.empty()) {
+        // Not initialized, run right away
+        execute(job);
+        return;
+    }
+    Queue *queue = queues[threadIndex < static_cast<int>(queues.size()) ? threadIndex : 0];
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->jobs.push_back(std::move(job));
+    }
+    queuedJobs++;
+    {
+        // Pairs with the predicate check of sleeping workers so no wake-up is lost
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wakeCondition.notify_one();
+}
+
+bool JobSystem::popOrSteal(Job &job) {
+    int count = static_cast<int>(queues.size());
+    if (count == 0) {
+        return false;
+    }
+
+    // Newest job of our own queue first, it is the most likely to be in cache
+    Queue *own = queues[threadIndex < count ? threadIndex : 0];
+    {
+        std::lock_guard<std::mutex> lock(own->mutex);
+        if (!own->jobs.empty()) {
+            job = std::move(own->jobs.back());
+            own->jobs.pop_back();
+            queuedJobs--;
+            return true;
+        }
+    }
+
+    // Then the oldest job of another thread
+    for (int i = 1; i < count; ++i) {
+        Queue *victim = queues[(threadIndex + i) % count];
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if (!victim->jobs.empty()) {
+            job = std::move(victim->jobs.front());
+            victim->jobs.pop_front();
+            queuedJobs--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobSystem::execute(Job &job) {
+    job.function();
+
+    // The decrement happens under the lock so wait() can tell when nobody touches the counter anymore
+    JobCounter *counter = job.counter;
+    std::vector<std::pair<JobCounter *, std::function<void()>>> ready;
+    {
+        std::lock_guard<std::mutex> lock(counter->continuationMutex);
+        if (--counter->pending == 0) {
+            ready.swap(counter->continuations);
+        }
+    }
+
+    // Last job of the group, release everything that waited on it
+    for (auto &continuation: ready) {
+        push({std::move(continuation.second), continuation.first});
+    }
+}
+
+void JobSystem::run(JobCounter &counter, std::function<void()> job) {
+    counter.pending++;
+    push({std::move(job), &counter});
+}
+
+void JobSystem::runAfter(JobCounter &dependency, JobCounter &counter, std::function<void()> job) {
+    counter.pending++;
+    {
+        std::lock_guard<std::mutex> lock(dependency.continuationMutex);
+        if (dependency.pending > 0) {
+            dependency.continuations.emplace_back(&counter, std::move(job));
+            return;
+        }
+    }
+    push({std::move(job), &counter});
+}
+
+void JobSystem::wait(JobCounter &counter) {
+    while (counter.pending > 0) {
+        Job job;
+        if (popOrSteal(job)) {
+            execute(job);
+        } else {
+            // The remaining jobs are running on other threads
+            std::this_thread::yield();
+        }
+    }
+    // Wait for the thread that finished the last job to let go of the counter
+    std::lock_guard<std::mutex> lock(counter.continuationMutex);
+}
+
+void JobSystem::workerLoop(int index) {
+    threadIndex = index;
+    while (!quitting) {
+        Job job;
+        if (popOrSteal(job)) {
+            execute(job);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeCondition.wait(lock, []() { return queuedJobs > 0 || quitting; });
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Counts the unfinished jobs of a group. Jobs queued with runAfter start once
+// the counter they depend on drops to zero.
+struct JobCounter {
+    std::atomic<int> pending{0};
+    std::mutex continuationMutex;
+    std::vector<std::pair<JobCounter *, std::function<void()>>> continuations;
+};
+
+// Small work-stealing job system. Every thread, the main thread included, owns a
+// deque: it pushes and pops at the back, idle threads steal from the front of the
+// others. wait() runs queued jobs instead of blocking, so nested parallelFor
+// calls inside jobs cannot deadlock. Without initialize, or with zero workers,
+// all jobs run on the thread that waits for them.
+class JobSystem {
+public:
+    // workerCount < 0 picks one worker per hardware thread besides the main thread
+    static void initialize(int workerCount = -1);
+    static void shutdown();
+    static int threadCount() { return static_cast<int>(queues.size()); }
+
+    static void run(JobCounter &counter, std::function<void()> job);
+    // Queues the job once dependency has no pending jobs left
+    static void runAfter(JobCounter &dependency, JobCounter &counter, std::function<void()> job);
+    // Helps with queued jobs until the counter reaches zero
+    static void wait(JobCounter &counter);
+
+private:
+    struct Job {
+        std::function<void()> function;
+        JobCounter *counter;
+    };
+    struct Queue;
+
+    static std::vector<Queue *> queues;
+
+    static void push(Job job);
+    static bool popOrSteal(Job &job);
+    static void execute(Job &job);
+    static void workerLoop(int index);
+};
+
+// Splits [0, count) into chunks of at least minPerJob items, calls
+// function(begin, end) for each of them on the job system and waits for all.
+template <typename Function>
+void parallelFor(int count, int minPerJob, Function function) {
+    int jobCount = std::min(JobSystem::threadCount() * 4, (count + minPerJob - 1) / minPerJob);
+    if (jobCount <= 1) {
+        function(0, count);
+        return;
+    }
+
+    JobCounter counter;
+    int chunk = (count + jobCount - 1) / jobCount;
+    for (int begin = chunk; begin < count; begin += chunk) {
+        int end = std::min(count, begin + chunk);
+        JobSystem::run(counter, [&function, begin, end]() { function(begin, end); });
+    }
+    function(0, std::min(count, chunk));
+    JobSystem::wait(counter);
+}
+
+#endif // JOBSYSTEM_H
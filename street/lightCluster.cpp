@@ -0,0 +1,185 @@
+#include "lightCluster.h"
+#include "jobSystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+void LightClusters::initialize(int maxLights, float zNear, float zFar) {
+    this->maxLights = maxLights;
+    this->zNear = zNear;
+    this->zFar = zFar;
+    sliceNear = std::max(zNear, 5.0f);
+    sliceScale = (CLUSTER_Z - 1) / std::log(zFar / sliceNear);
+
+    clusterGrid.resize(CLUSTER_COUNT * 2, 0);
+    lightData.reserve(maxLights * 3);
+    ranges.reserve(maxLights);
+
+    // Light parameters (3 RGBA32F texels per light), offset and count into the
+    // index list for every cluster, and the light indices of all clusters packed
+    // back to back. The textures are pointed at the region written each frame.
+    lightStream.initialize(sizeof(glm::vec4) * 3 * maxLights);
+    gridStream.initialize(sizeof(GLuint) * clusterGrid.size());
+    indexStream.initialize(sizeof(GLushort) * std::max(1, maxLights * 8));
+    glGenTextures(1, &lightTextureID);
+    glGenTextures(1, &gridTextureID);
+    glGenTextures(1, &indexTextureID);
+}
+
+int LightClusters::depthSlice(float viewDepth) const {
+    // Must match the slice computation in the fragment shaders
+    if (viewDepth < sliceNear) {
+        return 0;
+    }
+    int slice = 1 + static_cast<int>(std::log(viewDepth / sliceNear) * sliceScale);
+    return std::min(slice, CLUSTER_Z - 1);
+}
+
+LightClusters::ClusterRange LightClusters::computeRange(const PointLight &light, glm::mat4 viewMatrix,
+                                                        glm::mat4 projectionMatrix) const {
+    ClusterRange range = {1, 0, 1, 0, 1, 0};
+
+    glm::vec3 center = glm::vec3(viewMatrix * glm::vec4(light.position, 1.0f));
+    float depth = -center.z;
+    float radius = light.radius;
+    if (depth - radius > zFar || depth + radius < zNear) {
+        return range;
+    }
+
+    glm::vec2 ndcMin(-1.0f), ndcMax(1.0f);
+    if (depth - radius > zNear) {
+        // Project the corners of the light's view-space bounding box, which
+        // conservatively bounds the projected sphere
+        ndcMin = glm::vec2(1e9f);
+        ndcMax = glm::vec2(-1e9f);
+        for (int i = 0; i < 8; ++i) {
+            glm::vec3 corner = center + glm::vec3((i & 1) ? radius : -radius,
+                                                  (i & 2) ? radius : -radius,
+                                                  (i & 4) ? radius : -radius);
+            glm::vec4 clip = projectionMatrix * glm::vec4(corner, 1.0f);
+            glm::vec2 ndc = glm::vec2(clip) / clip.w;
+            ndcMin = glm::min(ndcMin, ndc);
+            ndcMax = glm::max(ndcMax, ndc);
+        }
+        if (ndcMax.x < -1.0f || ndcMax.y < -1.0f || ndcMin.x > 1.0f || ndcMin.y > 1.0f) {
+            return range;
+        }
+    }
+
+    range.minX = glm::clamp(static_cast<int>(std::floor((ndcMin.x * 0.5f + 0.5f) * CLUSTER_X)), 0, CLUSTER_X - 1);
+    range.maxX = glm::clamp(static_cast<int>(std::floor((ndcMax.x * 0.5f + 0.5f) * CLUSTER_X)), 0, CLUSTER_X - 1);
+    range.minY = glm::clamp(static_cast<int>(std::floor((ndcMin.y * 0.5f + 0.5f) * CLUSTER_Y)), 0, CLUSTER_Y - 1);
+    range.maxY = glm::clamp(static_cast<int>(std::floor((ndcMax.y * 0.5f + 0.5f) * CLUSTER_Y)), 0, CLUSTER_Y - 1);
+    range.minZ = depthSlice(std::max(depth - radius, zNear));
+    range.maxZ = depthSlice(std::min(depth + radius, zFar));
+    return range;
+}
+
+void LightClusters::update(const std::vector<PointLight> &lights, glm::mat4 viewMatrix, glm::mat4 projectionMatrix,
+                           int screenWidth, int screenHeight) {
+    screenSize = glm::vec2(screenWidth, screenHeight);
+    int lightCount = std::min(static_cast<int>(lights.size()), maxLights);
+
+    // Pass 1: cluster range of every light
+    ranges.resize(lightCount);
+    parallelFor(lightCount, 64, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            ranges[i] = computeRange(lights[i], viewMatrix, projectionMatrix);
+        }
+    });
+
+    // Pass 2: count lights per cluster, each thread owns a set of depth slices
+    parallelFor(CLUSTER_Z, 4, [&](int sliceBegin, int sliceEnd) {
+        std::fill(clusterGrid.begin() + sliceBegin * CLUSTER_X * CLUSTER_Y * 2,
+                  clusterGrid.begin() + sliceEnd * CLUSTER_X * CLUSTER_Y * 2, 0);
+        for (int i = 0; i < lightCount; ++i) {
+            const ClusterRange &r = ranges[i];
+            int zBegin = std::max(r.minZ, sliceBegin);
+            int zEnd = std::min(r.maxZ, sliceEnd - 1);
+            for (int z = zBegin; z <= zEnd; ++z)
+                for (int y = r.minY; y <= r.maxY; ++y)
+                    for (int x = r.minX; x <= r.maxX; ++x)
+                        clusterGrid[((z * CLUSTER_Y + y) * CLUSTER_X + x) * 2 + 1]++;
+        }
+    });
+
+    // Prefix sum of the counts gives every cluster its offset in the index list
+    GLuint total = 0;
+    for (int c = 0; c < CLUSTER_COUNT; ++c) {
+        clusterGrid[c * 2] = total;
+        total += clusterGrid[c * 2 + 1];
+    }
+    lightIndices.resize(total);
+
+    // Pass 3: write the light indices, again split by depth slice
+    parallelFor(CLUSTER_Z, 4, [&](int sliceBegin, int sliceEnd) {
+        for (int c = sliceBegin * CLUSTER_X * CLUSTER_Y; c < sliceEnd * CLUSTER_X * CLUSTER_Y; ++c) {
+            clusterGrid[c * 2 + 1] = 0;
+        }
+        for (int i = 0; i < lightCount; ++i) {
+            const ClusterRange &r = ranges[i];
+            int zBegin = std::max(r.minZ, sliceBegin);
+            int zEnd = std::min(r.maxZ, sliceEnd - 1);
+            for (int z = zBegin; z <= zEnd; ++z)
+                for (int y = r.minY; y <= r.maxY; ++y)
+                    for (int x = r.minX; x <= r.maxX; ++x) {
+                        GLuint *cell = &clusterGrid[((z * CLUSTER_Y + y) * CLUSTER_X + x) * 2];
+                        lightIndices[cell[0] + cell[1]++] = static_cast<GLushort>(i);
+                    }
+        }
+    });
+
+    // Pack light parameters
+    lightData.resize(lightCount * 3);
+    visibleLights = 0;
+    for (int i = 0; i < lightCount; ++i) {
+        const PointLight &light = lights[i];
+        lightData[i * 3] = glm::vec4(light.position, light.radius);
+        lightData[i * 3 + 1] = glm::vec4(light.color * light.intensity, light.spotOuterCos);
+        lightData[i * 3 + 2] = glm::vec4(glm::normalize(light.direction), light.spotInnerCos);
+        if (ranges[i].minX <= ranges[i].maxX) {
+            visibleLights++;
+        }
+    }
+
+    // Upload
+    lightStream.write(lightData.data(), sizeof(glm::vec4) * lightData.size());
+    gridStream.write(clusterGrid.data(), sizeof(GLuint) * clusterGrid.size());
+    indexStream.write(lightIndices.data(), sizeof(GLushort) * lightIndices.size());
+
+    glBindTexture(GL_TEXTURE_BUFFER, lightTextureID);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightStream.buffer());
+    glBindTexture(GL_TEXTURE_BUFFER, gridTextureID);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, gridStream.buffer());
+    glBindTexture(GL_TEXTURE_BUFFER, indexTextureID);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, indexStream.buffer());
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::applyUniforms(GLuint programID) const {
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_BUFFER, lightTextureID);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_BUFFER, gridTextureID);
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_BUFFER, indexTextureID);
+    glActiveTexture(GL_TEXTURE0);
+
+    glUniform1i(glGetUniformLocation(programID, "clusterLights"), 4);
+    glUniform1i(glGetUniformLocation(programID, "clusterGrid"), 5);
+    glUniform1i(glGetUniformLocation(programID, "clusterIndices"), 6);
+    glUniform3ui(glGetUniformLocation(programID, "clusterDims"), CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+    glUniform2f(glGetUniformLocation(programID, "clusterScreenSize"), screenSize.x, screenSize.y);
+    glUniform2f(glGetUniformLocation(programID, "clusterDepthRange"), zNear, zFar);
+    glUniform2f(glGetUniformLocation(programID, "clusterSliceParams"), sliceNear, sliceScale);
+}
+
+void LightClusters::cleanup() {
+    glDeleteTextures(1, &lightTextureID);
+    glDeleteTextures(1, &gridTextureID);
+    glDeleteTextures(1, &indexTextureID);
+    lightStream.cleanup();
+    gridStream.cleanup();
+    indexStream.cleanup();
+}
@@ -0,0 +1,61 @@
+#ifndef LIGHTCLUSTER_H
+#define LIGHTCLUSTER_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "lightInfo.h"
+#include "streamBuffer.h"
+
+// Clustered forward lighting. The view frustum is split into a
+// CLUSTER_X * CLUSTER_Y screen tiles times CLUSTER_Z exponential depth slices.
+// Every frame the lights are assigned to the clusters they touch on the CPU and
+// the result is uploaded into three texture buffers, so a fragment shader only
+// loops over the lights of its own cluster.
+class LightClusters {
+public:
+    static const int CLUSTER_X = 16;
+    static const int CLUSTER_Y = 9;
+    static const int CLUSTER_Z = 24;
+    static const int CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+
+    void initialize(int maxLights, float zNear, float zFar);
+    void update(const std::vector<PointLight> &lights, glm::mat4 viewMatrix, glm::mat4 projectionMatrix,
+                int screenWidth, int screenHeight);
+    // Binds the cluster buffers and sets the cluster uniforms on the program currently in use
+    void applyUniforms(GLuint programID) const;
+    void cleanup();
+
+    int lightCount() const { return visibleLights; }
+    int indexCount() const { return static_cast<int>(lightIndices.size()); }
+
+private:
+    // Inclusive cluster index range touched by a light, empty when minX > maxX
+    struct ClusterRange {
+        int minX, maxX;
+        int minY, maxY;
+        int minZ, maxZ;
+    };
+
+    int maxLights = 0;
+    int visibleLights = 0;
+    float zNear = 0.1f;
+    float zFar = 1000.0f;
+    float sliceNear = 5.0f; // Depth covered by the first slice
+    float sliceScale = 1.0f;
+    glm::vec2 screenSize;
+
+    std::vector<ClusterRange> ranges;
+    std::vector<GLuint> clusterGrid; // offset, count per cluster
+    std::vector<GLushort> lightIndices;
+    std::vector<glm::vec4> lightData; // 3 texels per light
+
+    StreamBuffer lightStream, gridStream, indexStream;
+    GLuint lightTextureID = 0, gridTextureID = 0, indexTextureID = 0;
+
+    int depthSlice(float viewDepth) const;
+    ClusterRange computeRange(const PointLight &light, glm::mat4 viewMatrix, glm::mat4 projectionMatrix) const;
+};
+
+#endif // LIGHTCLUSTER_H
@@ -13,4 +13,19 @@ struct Light {
     Light(glm::vec3 dir, glm::vec3 pos, glm::vec3 col, glm::vec3 lookat, float inten) : direction(dir), position(pos), color(col), intensity(inten), look_at(lookat){}
 };
 
-#endif // LIGHTINFO_H
\ No newline at end of file
+// Local light used by the clustered lighting pass. A spot light has
+// spotOuterCos > -1, a point light leaves both cone cosines at -1.
+struct PointLight {
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+    float intensity;
+    glm::vec3 direction;
+    float spotInnerCos;
+    float spotOuterCos;
+
+    PointLight(glm::vec3 pos, float rad, glm::vec3 col, float inten) : position(pos), radius(rad), color(col), intensity(inten),
+        direction(0.0f, -1.0f, 0.0f), spotInnerCos(-1.0f), spotOuterCos(-1.0f) {}
+};
+
+#endif // LIGHTINFO_H
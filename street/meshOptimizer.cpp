@@ -0,0 +1,252 @@
+#include "meshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Forsyth's scoring, tuned for an LRU cache a little larger than the hardware FIFO
+static const int FORSYTH_CACHE_SIZE = 32;
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float LAST_TRIANGLE_SCORE = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+// Cache size of the run detection in optimizeOverdraw
+static const int OVERDRAW_CACHE_SIZE = 16;
+
+static float vertexScore(int cachePosition, unsigned int remainingTriangles) {
+    if (remainingTriangles == 0) {
+        return -1.0f;
+    }
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        // The three vertices of the last triangle score the same, so no direction is preferred
+        if (cachePosition < 3) {
+            score = LAST_TRIANGLE_SCORE;
+        } else {
+            float scale = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+            score = std::pow(1.0f - (cachePosition - 3) * scale, CACHE_DECAY_POWER);
+        }
+    }
+    // Vertices with few triangles left are finished first, so they leave the cache for good
+    score += VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remainingTriangles), -VALENCE_BOOST_POWER);
+    return score;
+}
+
+VertexCacheStats analyzeVertexCache(const std::vector<uint32_t> &indices, size_t vertexCount, int cacheSize) {
+    VertexCacheStats stats;
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return stats;
+    }
+
+    // A vertex is cached while fewer than cacheSize misses came after its own
+    std::vector<unsigned int> insertedAt(vertexCount, 0);
+    unsigned int misses = 0;
+    size_t uniqueVertices = 0;
+    for (uint32_t index: indices) {
+        if (insertedAt[index] == 0) {
+            uniqueVertices++;
+        }
+        if (insertedAt[index] == 0 || misses - insertedAt[index] >= static_cast<unsigned int>(cacheSize)) {
+            misses++;
+            insertedAt[index] = misses;
+        }
+    }
+    stats.acmr = static_cast<float>(misses) / triangleCount;
+    stats.atvr = static_cast<float>(misses) / uniqueVertices;
+    return stats;
+}
+
+void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount) {
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // Triangles of every vertex, the first remainingTriangles of each list are not emitted yet
+    std::vector<unsigned int> remainingTriangles(vertexCount, 0);
+    for (uint32_t index: indices) {
+        remainingTriangles[index]++;
+    }
+    std::vector<size_t> firstTriangle(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        firstTriangle[v + 1] = firstTriangle[v] + remainingTriangles[v];
+    }
+    std::vector<uint32_t> vertexTriangles(indices.size());
+    std::vector<size_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        vertexTriangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> score(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        score[v] = vertexScore(-1, remainingTriangles[v]);
+    }
+
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    std::vector<uint32_t> cache, nextCache;
+    cache.reserve(FORSYTH_CACHE_SIZE + 3);
+    nextCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+    size_t scanCursor = 0;
+    long long best = 0;
+    while (output.size() < indices.size()) {
+        if (best < 0) {
+            // Nothing in the cache has triangles left, continue with the next one in input order
+            while (emitted[scanCursor]) {
+                scanCursor++;
+            }
+            best = static_cast<long long>(scanCursor);
+        }
+
+        emitted[best] = true;
+        const uint32_t *triangle = &indices[best * 3];
+        nextCache.clear();
+        for (int k = 0; k < 3; ++k) {
+            uint32_t v = triangle[k];
+            output.push_back(v);
+            nextCache.push_back(v);
+
+            // Move the triangle past the end of the vertex's remaining list
+            uint32_t *begin = &vertexTriangles[firstTriangle[v]];
+            uint32_t *end = begin + remainingTriangles[v];
+            std::iter_swap(std::find(begin, end, static_cast<uint32_t>(best)), end - 1);
+            remainingTriangles[v]--;
+        }
+        for (uint32_t v: cache) {
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+                nextCache.push_back(v);
+            }
+        }
+
+        for (size_t i = 0; i < nextCache.size(); ++i) {
+            uint32_t v = nextCache[i];
+            cachePosition[v] = i < static_cast<size_t>(FORSYTH_CACHE_SIZE) ? static_cast<int>(i) : -1;
+            score[v] = vertexScore(cachePosition[v], remainingTriangles[v]);
+        }
+        if (nextCache.size() > static_cast<size_t>(FORSYTH_CACHE_SIZE)) {
+            nextCache.resize(FORSYTH_CACHE_SIZE);
+        }
+        cache.swap(nextCache);
+
+        // The next triangle is the best one touching the cache
+        best = -1;
+        float bestScore = -1.0f;
+        for (uint32_t v: cache) {
+            const uint32_t *triangles = &vertexTriangles[firstTriangle[v]];
+            for (unsigned int t = 0; t < remainingTriangles[v]; ++t) {
+                const uint32_t *candidate = &indices[triangles[t] * 3];
+                float triangleScore = score[candidate[0]] + score[candidate[1]] + score[candidate[2]];
+                if (triangleScore > bestScore) {
+                    bestScore = triangleScore;
+                    best = triangles[t];
+                }
+            }
+        }
+    }
+    indices.swap(output);
+}
+
+bool optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<glm::vec3> &positions, float threshold) {
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return false;
+    }
+
+    // Runs start at triangles that miss the cache on every vertex, splitting there costs nothing
+    std::vector<size_t> runStarts;
+    std::vector<unsigned int> insertedAt(positions.size(), 0);
+    unsigned int misses = 0;
+    for (size_t t = 0; t < triangleCount; ++t) {
+        int triangleMisses = 0;
+        for (int k = 0; k < 3; ++k) {
+            uint32_t index = indices[t * 3 + k];
+            if (insertedAt[index] == 0 || misses - insertedAt[index] >= static_cast<unsigned int>(OVERDRAW_CACHE_SIZE)) {
+                misses++;
+                insertedAt[index] = misses;
+                triangleMisses++;
+            }
+        }
+        if (t == 0 || triangleMisses == 3) {
+            runStarts.push_back(t);
+        }
+    }
+    if (runStarts.size() < 2) {
+        return false;
+    }
+    runStarts.push_back(triangleCount);
+
+    // Area weighted center and normal of the mesh and of every run
+    struct Run {
+        size_t begin, end;
+        float key;
+    };
+    std::vector<Run> runs;
+    std::vector<glm::vec3> runCenters, runNormals;
+    glm::vec3 meshCenter(0.0f);
+    float meshArea = 0.0f;
+    for (size_t r = 0; r + 1 < runStarts.size(); ++r) {
+        glm::vec3 center(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = runStarts[r]; t < runStarts[r + 1]; ++t) {
+            glm::vec3 a = positions[indices[t * 3]], b = positions[indices[t * 3 + 1]], c = positions[indices[t * 3 + 2]];
+            glm::vec3 cross = glm::cross(b - a, c - a);
+            float triangleArea = glm::length(cross) * 0.5f;
+            center += (a + b + c) / 3.0f * triangleArea;
+            normal += cross;
+            area += triangleArea;
+        }
+        meshCenter += center;
+        meshArea += area;
+        runs.push_back({runStarts[r], runStarts[r + 1], 0.0f});
+        runCenters.push_back(area > 0.0f ? center / area : positions[indices[runStarts[r] * 3]]);
+        runNormals.push_back(normal);
+    }
+    if (meshArea <= 0.0f) {
+        return false;
+    }
+    meshCenter /= meshArea;
+    for (size_t r = 0; r < runs.size(); ++r) {
+        float length = glm::length(runNormals[r]);
+        runs[r].key = length > 0.0f ? glm::dot(runCenters[r] - meshCenter, runNormals[r] / length) : 0.0f;
+    }
+
+    // Outward facing runs first
+    std::stable_sort(runs.begin(), runs.end(), [](const Run &a, const Run &b) { return a.key > b.key; });
+    std::vector<uint32_t> sorted;
+    sorted.reserve(indices.size());
+    for (const Run &run: runs) {
+        sorted.insert(sorted.end(), indices.begin() + run.begin * 3, indices.begin() + run.end * 3);
+    }
+
+    float before = analyzeVertexCache(indices, positions.size()).acmr;
+    float after = analyzeVertexCache(sorted, positions.size()).acmr;
+    if (after > before * threshold) {
+        return false;
+    }
+    indices.swap(sorted);
+    return true;
+}
+
+std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t> &indices, size_t vertexCount) {
+    const uint32_t unused = ~0u;
+    std::vector<uint32_t> newIndex(vertexCount, unused);
+    std::vector<uint32_t> order;
+    order.reserve(vertexCount);
+    for (uint32_t &index: indices) {
+        if (newIndex[index] == unused) {
+            newIndex[index] = static_cast<uint32_t>(order.size());
+            order.push_back(index);
+        }
+        index = newIndex[index];
+    }
+    for (size_t v = 0; v < vertexCount; ++v) {
+        if (newIndex[v] == unused) {
+            order.push_back(static_cast<uint32_t>(v));
+        }
+    }
+    return order;
+}
@@ -0,0 +1,39 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Load-time reordering of indexed triangle lists, no GL calls. Triangles are
+// put in post-transform vertex cache order with Forsyth's algorithm, then
+// optionally sorted in clusters so that outward facing parts draw first, and
+// vertices are renumbered in first use order for fetch locality.
+
+// Post-transform cache behaviour of an index list under a FIFO cache.
+// ACMR is transformed vertices per triangle (0.5 is ideal for large grids,
+// 3 is no reuse), ATVR is transformed vertices per unique vertex (1 is ideal).
+struct VertexCacheStats {
+    float acmr = 0.0f;
+    float atvr = 0.0f;
+};
+
+VertexCacheStats analyzeVertexCache(const std::vector<uint32_t> &indices, size_t vertexCount, int cacheSize = 16);
+
+// Reorders the triangles of indices for the vertex cache
+void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount);
+
+// Sorts runs of cache-ordered triangles so clusters facing away from the mesh
+// center draw first and hide what is behind them. A run ends where a triangle
+// misses the cache on all three vertices, so the cache order inside runs is
+// kept; the sort is dropped if ACMR would grow by more than threshold.
+// Returns whether the order changed.
+bool optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<glm::vec3> &positions,
+                      float threshold = 1.05f);
+
+// Renumbers vertices in order of first use, unused vertices go last. Returns
+// the old vertex index of every new one and rewrites indices to match.
+std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t> &indices, size_t vertexCount);
+
+#endif // MESHOPTIMIZER_H
@@ -0,0 +1,411 @@
+#include "meshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+
+// Open edges also keep a plane through them, upright on their triangle, weighted
+// this much against the area weighted triangle planes so borders and seams hold their shape
+static const float BOUNDARY_WEIGHT = 10.0f;
+// Every pass collapses a set of edges with no vertex in common, this bounds how many run
+static const int MAX_PASSES = 100;
+// Largest turn of a triangle normal in one collapse, as a cosine
+static const float FLIP_COSINE = 0.25f;
+// Marks a vertex without an open edge, a vertex with several marks itself
+static const uint32_t NO_EDGE = ~0u;
+
+enum VertexKind : uint8_t { KIND_MANIFOLD, KIND_BORDER, KIND_SEAM, KIND_LOCKED };
+
+// Sum of weighted squared distances to planes, p'Ap + 2b'p + c with A symmetric
+struct Quadric {
+    float a00 = 0.0f, a11 = 0.0f, a22 = 0.0f, a10 = 0.0f, a20 = 0.0f, a21 = 0.0f;
+    float b0 = 0.0f, b1 = 0.0f, b2 = 0.0f, c = 0.0f;
+    float weight = 0.0f;
+
+    void addPlane(glm::vec3 normal, float distance, float planeWeight) {
+        a00 += planeWeight * normal.x * normal.x;
+        a11 += planeWeight * normal.y * normal.y;
+        a22 += planeWeight * normal.z * normal.z;
+        a10 += planeWeight * normal.y * normal.x;
+        a20 += planeWeight * normal.z * normal.x;
+        a21 += planeWeight * normal.z * normal.y;
+        b0 += planeWeight * normal.x * distance;
+        b1 += planeWeight * normal.y * distance;
+        b2 += planeWeight * normal.z * distance;
+        c += planeWeight * distance * distance;
+        weight += planeWeight;
+    }
+
+    void add(const Quadric &other) {
+        a00 += other.a00;
+        a11 += other.a11;
+        a22 += other.a22;
+        a10 += other.a10;
+        a20 += other.a20;
+        a21 += other.a21;
+        b0 += other.b0;
+        b1 += other.b1;
+        b2 += other.b2;
+        c += other.c;
+        weight += other.weight;
+    }
+
+    // Mean squared distance of p to the planes
+    float error(glm::vec3 p) const {
+        float rx = a00 * p.x + a10 * p.y + a20 * p.z;
+        float ry = a10 * p.x + a11 * p.y + a21 * p.z;
+        float rz = a20 * p.x + a21 * p.y + a22 * p.z;
+        float sum = rx * p.x + ry * p.y + rz * p.z + 2.0f * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+        return weight > 0.0f ? std::abs(sum) / weight : 0.0f;
+    }
+};
+
+struct PositionHash {
+    size_t operator()(const glm::vec3 &p) const {
+        // Adding zero turns -0 into +0, which compares equal
+        float components[3] = {p.x + 0.0f, p.y + 0.0f, p.z + 0.0f};
+        uint32_t bits[3];
+        std::memcpy(bits, components, sizeof(bits));
+        return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+    }
+};
+
+// Open edges and kind of every vertex in use, rebuilt before each pass
+struct Topology {
+    std::unordered_set<uint64_t> edges;
+    std::vector<uint8_t> used;
+    std::vector<uint8_t> kinds;
+    std::vector<uint32_t> openIncoming, openOutgoing;
+    std::vector<uint32_t> twins; // The vertex across the seam, for seam vertices
+};
+
+static uint64_t edgeKey(uint32_t from, uint32_t to) {
+    return (static_cast<uint64_t>(from) << 32) | to;
+}
+
+// An edge is open when no triangle uses it the other way round with the same
+// two vertices, at a border or where UVs split at a seam
+static void classifyVertices(const std::vector<uint32_t> &indices, const std::vector<uint32_t> &positionIds,
+                             const std::vector<uint32_t> &wedgeNext, Topology &topology) {
+    size_t vertexCount = positionIds.size();
+    topology.edges.clear();
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        for (int k = 0; k < 3; ++k) {
+            topology.edges.insert(edgeKey(indices[t + k], indices[t + (k + 1) % 3]));
+        }
+    }
+
+    topology.used.assign(vertexCount, 0);
+    topology.openIncoming.assign(vertexCount, NO_EDGE);
+    topology.openOutgoing.assign(vertexCount, NO_EDGE);
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        for (int k = 0; k < 3; ++k) {
+            uint32_t a = indices[t + k], b = indices[t + (k + 1) % 3];
+            topology.used[a] = 1;
+            if (topology.edges.count(edgeKey(b, a)) == 0) {
+                topology.openOutgoing[a] = topology.openOutgoing[a] == NO_EDGE ? b : a;
+                topology.openIncoming[b] = topology.openIncoming[b] == NO_EDGE ? a : b;
+            }
+        }
+    }
+
+    topology.kinds.assign(vertexCount, KIND_LOCKED);
+    topology.twins.assign(vertexCount, NO_EDGE);
+    auto singleEdge = [](uint32_t vertex, uint32_t edge) { return edge != NO_EDGE && edge != vertex; };
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+        if (!topology.used[v]) {
+            continue;
+        }
+        uint32_t twin = NO_EDGE;
+        int shared = 1;
+        for (uint32_t w = wedgeNext[v]; w != v; w = wedgeNext[w]) {
+            if (topology.used[w]) {
+                twin = w;
+                shared++;
+            }
+        }
+
+        uint32_t incoming = topology.openIncoming[v], outgoing = topology.openOutgoing[v];
+        if (shared == 1) {
+            if (incoming == NO_EDGE && outgoing == NO_EDGE) {
+                topology.kinds[v] = KIND_MANIFOLD;
+            } else if (singleEdge(v, incoming) && singleEdge(v, outgoing)) {
+                topology.kinds[v] = KIND_BORDER;
+            }
+        } else if (shared == 2) {
+            // A seam: both vertices have one open edge each way, mirroring the other's
+            uint32_t twinIncoming = topology.openIncoming[twin], twinOutgoing = topology.openOutgoing[twin];
+            if (singleEdge(v, incoming) && singleEdge(v, outgoing) && singleEdge(twin, twinIncoming) &&
+                singleEdge(twin, twinOutgoing) && positionIds[incoming] == positionIds[twinOutgoing] &&
+                positionIds[outgoing] == positionIds[twinIncoming]) {
+                topology.kinds[v] = KIND_SEAM;
+                topology.twins[v] = twin;
+            }
+        }
+    }
+}
+
+// Manifold vertices collapse onto any neighbour. Border and seam vertices only
+// along their open edges onto their own kind or a locked vertex, and the twin of
+// a seam vertex onto the vertex at the far end of the mirrored edge, in twinTo.
+static bool canCollapse(const Topology &topology, const std::vector<uint32_t> &positionIds, uint32_t from,
+                        uint32_t to, uint32_t &twinTo) {
+    twinTo = NO_EDGE;
+    uint8_t kind = topology.kinds[from];
+    if (kind == KIND_LOCKED || positionIds[from] == positionIds[to]) {
+        return false;
+    }
+    if (kind == KIND_MANIFOLD) {
+        return true;
+    }
+    bool alongOpenEdge = topology.openOutgoing[from] == to || topology.openIncoming[from] == to;
+    uint8_t toKind = topology.kinds[to];
+    if (!alongOpenEdge || (toKind != kind && toKind != KIND_LOCKED)) {
+        return false;
+    }
+    if (kind == KIND_BORDER) {
+        return true;
+    }
+    uint32_t twin = topology.twins[from];
+    twinTo = topology.openOutgoing[from] == to ? topology.openIncoming[twin] : topology.openOutgoing[twin];
+    return positionIds[twinTo] == positionIds[to];
+}
+
+std::vector<uint32_t> simplifyMesh(const std::vector<uint32_t> &indices, const std::vector<glm::vec3> &positions,
+                                   const std::vector<float> &attributes, int attributeCount,
+                                   size_t targetIndexCount, float targetError, float *resultError) {
+    std::vector<uint32_t> result(indices);
+    if (resultError) {
+        *resultError = 0.0f;
+    }
+    size_t vertexCount = positions.size();
+    if (result.size() <= targetIndexCount || vertexCount == 0) {
+        return result;
+    }
+
+    // Positions relative to the largest extent, so errors do not depend on the model units
+    glm::vec3 minimum = positions[0], maximum = positions[0];
+    for (const glm::vec3 &p: positions) {
+        minimum = glm::min(minimum, p);
+        maximum = glm::max(maximum, p);
+    }
+    glm::vec3 extent = maximum - minimum;
+    float largestExtent = std::max(extent.x, std::max(extent.y, extent.z));
+    float scale = largestExtent > 0.0f ? 1.0f / largestExtent : 1.0f;
+    std::vector<glm::vec3> points(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        points[v] = (positions[v] - minimum) * scale;
+    }
+
+    // First vertex at every position, and a cycle through the vertices sharing it
+    std::vector<uint32_t> positionIds(vertexCount), wedgeNext(vertexCount);
+    {
+        std::unordered_map<glm::vec3, uint32_t, PositionHash> firstAt;
+        firstAt.reserve(vertexCount);
+        for (uint32_t v = 0; v < vertexCount; ++v) {
+            uint32_t first = firstAt.emplace(positions[v], v).first->second;
+            positionIds[v] = first;
+            if (first == v) {
+                wedgeNext[v] = v;
+            } else {
+                wedgeNext[v] = wedgeNext[first];
+                wedgeNext[first] = v;
+            }
+        }
+    }
+
+    // Quadrics live with the position, so both sides of a seam share theirs
+    Topology topology;
+    classifyVertices(result, positionIds, wedgeNext, topology);
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t t = 0; t + 2 < result.size(); t += 3) {
+        const uint32_t *triangle = &result[t];
+        glm::vec3 p0 = points[triangle[0]], p1 = points[triangle[1]], p2 = points[triangle[2]];
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(normal);
+        if (length == 0.0f) {
+            continue;
+        }
+        normal /= length;
+        for (int k = 0; k < 3; ++k) {
+            quadrics[positionIds[triangle[k]]].addPlane(normal, -glm::dot(normal, p0), length * 0.5f);
+        }
+        for (int k = 0; k < 3; ++k) {
+            uint32_t a = triangle[k], b = triangle[(k + 1) % 3];
+            if (topology.edges.count(edgeKey(b, a)) != 0) {
+                continue;
+            }
+            glm::vec3 edge = points[b] - points[a];
+            float edgeLength = glm::length(edge);
+            if (edgeLength == 0.0f) {
+                continue;
+            }
+            glm::vec3 side = glm::normalize(glm::cross(edge, normal));
+            float planeWeight = edgeLength * edgeLength * BOUNDARY_WEIGHT;
+            quadrics[positionIds[a]].addPlane(side, -glm::dot(side, points[a]), planeWeight);
+            quadrics[positionIds[b]].addPlane(side, -glm::dot(side, points[a]), planeWeight);
+        }
+    }
+
+    auto attributeDistance = [&](uint32_t a, uint32_t b) {
+        float distance = 0.0f;
+        const float *first = &attributes[static_cast<size_t>(a) * attributeCount];
+        const float *second = &attributes[static_cast<size_t>(b) * attributeCount];
+        for (int i = 0; i < attributeCount; ++i) {
+            distance += (first[i] - second[i]) * (first[i] - second[i]);
+        }
+        return distance;
+    };
+
+    struct Collapse {
+        uint32_t from, to, twinTo;
+        float error;
+    };
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> collapseRemap(vertexCount);
+    std::vector<uint8_t> locked(vertexCount);
+    std::vector<uint32_t> firstTriangle(vertexCount + 1), vertexTriangles;
+    float targetErrorSquared = targetError * targetError;
+    float largestError = 0.0f;
+
+    for (int pass = 0; pass < MAX_PASSES && result.size() > targetIndexCount; ++pass) {
+        if (pass > 0) {
+            classifyVertices(result, positionIds, wedgeNext, topology);
+        }
+
+        // Both ways along every edge, interior edges once
+        collapses.clear();
+        for (size_t t = 0; t + 2 < result.size(); t += 3) {
+            for (int k = 0; k < 3; ++k) {
+                uint32_t a = result[t + k], b = result[t + (k + 1) % 3];
+                if (b < a && topology.edges.count(edgeKey(b, a)) != 0) {
+                    continue;
+                }
+                for (int direction = 0; direction < 2; ++direction) {
+                    uint32_t from = direction == 0 ? a : b, to = direction == 0 ? b : a;
+                    Collapse collapse = {from, to, NO_EDGE, 0.0f};
+                    if (!canCollapse(topology, positionIds, from, to, collapse.twinTo)) {
+                        continue;
+                    }
+                    Quadric quadric = quadrics[positionIds[from]];
+                    quadric.add(quadrics[positionIds[to]]);
+                    collapse.error = quadric.error(points[to]);
+                    if (attributeCount > 0) {
+                        float distance = attributeDistance(from, to);
+                        if (collapse.twinTo != NO_EDGE) {
+                            distance = std::max(distance, attributeDistance(topology.twins[from], collapse.twinTo));
+                        }
+                        collapse.error += distance;
+                    }
+                    collapses.push_back(collapse);
+                }
+            }
+        }
+        if (collapses.empty()) {
+            break;
+        }
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse &a, const Collapse &b) { return a.error < b.error; });
+
+        // Triangles around every vertex
+        std::fill(firstTriangle.begin(), firstTriangle.end(), 0);
+        for (uint32_t index: result) {
+            firstTriangle[index + 1]++;
+        }
+        std::partial_sum(firstTriangle.begin(), firstTriangle.end(), firstTriangle.begin());
+        vertexTriangles.resize(result.size());
+        {
+            std::vector<uint32_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+            for (size_t i = 0; i < result.size(); ++i) {
+                vertexTriangles[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+
+        // Triangles around from that stay must keep facing the same way once it
+        // moves onto to, the ones that lose an edge are counted in removed
+        auto keepsOrientation = [&](uint32_t from, uint32_t to, size_t &removed) {
+            size_t lost = 0;
+            for (uint32_t i = firstTriangle[from]; i < firstTriangle[from + 1]; ++i) {
+                const uint32_t *triangle = &result[vertexTriangles[i] * 3];
+                glm::vec3 before[3], after[3];
+                bool degenerate = false;
+                for (int k = 0; k < 3; ++k) {
+                    uint32_t corner = collapseRemap[triangle[k]];
+                    degenerate = degenerate || positionIds[corner] == positionIds[to];
+                    before[k] = points[corner];
+                    after[k] = corner == from ? points[to] : before[k];
+                }
+                if (degenerate) {
+                    lost++;
+                    continue;
+                }
+                glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+                // Small turns add up over the passes, so anything past about 75 degrees counts as a flip
+                float lengths = glm::length(normalBefore) * glm::length(normalAfter);
+                if (glm::dot(normalBefore, normalAfter) <= FLIP_COSINE * lengths && glm::dot(normalBefore, normalBefore) > 0.0f) {
+                    return false;
+                }
+            }
+            removed += lost;
+            return true;
+        };
+
+        // Cheapest first, every collapse locks both positions until the next pass
+        std::iota(collapseRemap.begin(), collapseRemap.end(), 0u);
+        std::fill(locked.begin(), locked.end(), 0);
+        size_t triangleCount = result.size() / 3;
+        size_t targetTriangleCount = targetIndexCount / 3;
+        bool collapsed = false;
+        for (const Collapse &collapse: collapses) {
+            if (collapse.error > targetErrorSquared || triangleCount <= targetTriangleCount) {
+                break;
+            }
+            uint32_t from = collapse.from, to = collapse.to;
+            if (locked[positionIds[from]] || locked[positionIds[to]]) {
+                continue;
+            }
+            uint32_t twin = topology.twins[from];
+            size_t removed = 0;
+            if (!keepsOrientation(from, to, removed) ||
+                (collapse.twinTo != NO_EDGE && !keepsOrientation(twin, collapse.twinTo, removed))) {
+                continue;
+            }
+
+            collapseRemap[from] = to;
+            if (collapse.twinTo != NO_EDGE) {
+                collapseRemap[twin] = collapse.twinTo;
+            }
+            quadrics[positionIds[to]].add(quadrics[positionIds[from]]);
+            locked[positionIds[from]] = locked[positionIds[to]] = 1;
+            triangleCount -= std::min(removed, triangleCount);
+            largestError = std::max(largestError, collapse.error);
+            collapsed = true;
+        }
+        if (!collapsed) {
+            break;
+        }
+
+        // Apply the pass, dropping the triangles that lost an edge
+        size_t written = 0;
+        for (size_t t = 0; t + 2 < result.size(); t += 3) {
+            uint32_t a = collapseRemap[result[t]], b = collapseRemap[result[t + 1]], c = collapseRemap[result[t + 2]];
+            if (positionIds[a] == positionIds[b] || positionIds[b] == positionIds[c] ||
+                positionIds[c] == positionIds[a]) {
+                continue;
+            }
+            result[written++] = a;
+            result[written++] = b;
+            result[written++] = c;
+        }
+        result.resize(written);
+    }
+
+    if (resultError) {
+        *resultError = std::sqrt(largestError);
+    }
+    return result;
+}
@@ -0,0 +1,29 @@
+#ifndef MESHSIMPLIFIER_H
+#define MESHSIMPLIFIER_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Load-time level of detail for indexed triangle lists, no GL calls. Edges are
+// collapsed in order of quadric error (Garland and Heckbert), always onto one
+// of their two vertices, so the simplified list indexes the original vertex
+// buffer and every vertex keeps its own UV, normal and skin weights.
+//
+// Vertices that share a position but nothing else, as on both sides of a UV
+// seam, only collapse along the seam and together with their twin, so seams
+// never open. Borders only collapse along themselves, and anything more
+// tangled than a seam is locked.
+
+// Returns a simplified copy of indices with at most targetIndexCount indices,
+// or more where reaching that would take a collapse above targetError.
+// Errors are distances relative to the largest extent of the mesh.
+// attributes holds attributeCount floats per vertex, already scaled by how
+// much they matter; their squared distance is added to the error of a
+// collapse. resultError, when given, receives the largest error taken.
+std::vector<uint32_t> simplifyMesh(const std::vector<uint32_t> &indices, const std::vector<glm::vec3> &positions,
+                                   const std::vector<float> &attributes, int attributeCount,
+                                   size_t targetIndexCount, float targetError, float *resultError = nullptr);
+
+#endif // MESHSIMPLIFIER_H
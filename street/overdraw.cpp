@@ -0,0 +1,46 @@
+#include "overdraw.h"
+
+void OverdrawMonitor::initialize() {
+    glGenQueries(QUERY_FRAMES, queryIDs);
+    for (int i = 0; i < QUERY_FRAMES; ++i) {
+        queryPixels[i] = 0;
+        queryPending[i] = false;
+    }
+}
+
+void OverdrawMonitor::beginCount() {
+    glBeginQuery(GL_SAMPLES_PASSED, queryIDs[currentQuery]);
+}
+
+void OverdrawMonitor::endCount(int pixelCount) {
+    glEndQuery(GL_SAMPLES_PASSED);
+    queryPixels[currentQuery] = pixelCount;
+    queryPending[currentQuery] = true;
+    currentQuery = (currentQuery + 1) % QUERY_FRAMES;
+
+    // The query issued QUERY_FRAMES - 1 frames ago is normally finished by now
+    int oldest = currentQuery;
+    if (!queryPending[oldest]) {
+        return;
+    }
+    GLint available = 0;
+    glGetQueryObjectiv(queryIDs[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return;
+    }
+    GLuint samples = 0;
+    glGetQueryObjectuiv(queryIDs[oldest], GL_QUERY_RESULT, &samples);
+    queryPending[oldest] = false;
+
+    float frameRatio = static_cast<float>(samples) / static_cast<float>(queryPixels[oldest]);
+    overdrawRatio = overdrawRatio * 0.9f + frameRatio * 0.1f;
+    if (!prepassRecommended && overdrawRatio > enableRatio) {
+        prepassRecommended = true;
+    } else if (prepassRecommended && overdrawRatio < disableRatio) {
+        prepassRecommended = false;
+    }
+}
+
+void OverdrawMonitor::cleanup() {
+    glDeleteQueries(QUERY_FRAMES, queryIDs);
+}
@@ -0,0 +1,8 @@
+#version 330 core
+
+out vec4 FragColor;
+
+// Every fragment adds one step, so brightness shows how often a pixel was shaded
+void main() {
+    FragColor = vec4(0.25, 0.08, 0.02, 1.0);
+}
@@ -0,0 +1,36 @@
+#ifndef OVERDRAW_H
+#define OVERDRAW_H
+
+#include <glad/gl.h>
+
+// Measures how many fragments the opaque geometry produces per screen pixel
+// with GL_SAMPLES_PASSED queries and decides whether the depth pre-pass pays
+// off. Results are read a few frames late so the queries never stall.
+class OverdrawMonitor {
+public:
+    void initialize();
+    // Wrap the draws whose passing fragments would all be shaded without a pre-pass
+    void beginCount();
+    void endCount(int pixelCount);
+    void cleanup();
+
+    float ratio() const { return overdrawRatio; }
+    bool prepassWanted() const { return prepassRecommended; }
+
+private:
+    static const int QUERY_FRAMES = 3;
+
+    GLuint queryIDs[QUERY_FRAMES];
+    int queryPixels[QUERY_FRAMES];
+    bool queryPending[QUERY_FRAMES];
+    int currentQuery = 0;
+
+    float overdrawRatio = 1.0f;
+    bool prepassRecommended = false;
+
+    // Hysteresis so the mode does not flicker around a single threshold
+    float enableRatio = 1.6f;
+    float disableRatio = 1.25f;
+};
+
+#endif // OVERDRAW_H
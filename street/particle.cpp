@@ -1,29 +1,127 @@
 #include "particle.h"
+#include "jobSystem.h"
+#include <glm/gtc/packing.hpp>
 #include <cstdlib>
 #include <iostream>
 
-ParticleSystem::ParticleSystem(int particleMax, GLuint shaderProgramID) : shaderProgramID(shaderProgramID) {
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PARTICLE_SSE 1
+#endif
+
+void ParticleArrays::resize(int count) {
+    lifeTime.resize(count);
+    offsetX.resize(count);
+    offsetY.resize(count);
+    offsetZ.resize(count);
+    positions.resize(count * 3);
+    colors.resize(count);
+    sizes.resize(count);
+}
+
+void updateParticlesScalar(ParticleArrays &particles, int begin, float deltaTime, glm::vec3 start, glm::vec3 end) {
+    glm::vec3 direction = end - start;
+    for (int i = begin; i < particles.count(); ++i) {
+        float life = particles.lifeTime[i] + deltaTime * 0.1f;
+        if (life >= 1.0f) {
+            life -= 1.0f;
+        }
+        particles.lifeTime[i] = life;
+
+        particles.positions[i * 3] = start.x + life * direction.x + particles.offsetX[i];
+        particles.positions[i * 3 + 1] = start.y + life * direction.y + particles.offsetY[i];
+        particles.positions[i * 3 + 2] = start.z + life * direction.z + particles.offsetZ[i];
+    }
+}
+
+void updateParticles(ParticleArrays &particles, float deltaTime, glm::vec3 start, glm::vec3 end) {
+    int i = 0;
+#ifdef PARTICLE_SSE
+    glm::vec3 direction = end - start;
+    const __m128 step = _mm_set1_ps(deltaTime * 0.1f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 startX = _mm_set1_ps(start.x), startY = _mm_set1_ps(start.y), startZ = _mm_set1_ps(start.z);
+    const __m128 dirX = _mm_set1_ps(direction.x), dirY = _mm_set1_ps(direction.y), dirZ = _mm_set1_ps(direction.z);
+
+    float *lifeTime = particles.lifeTime.data();
+    float *positions = particles.positions.data();
+    int vectorEnd = particles.count() & ~3;
+    for (; i < vectorEnd; i += 4) {
+        __m128 life = _mm_add_ps(_mm_loadu_ps(lifeTime + i), step);
+        life = _mm_sub_ps(life, _mm_and_ps(_mm_cmpge_ps(life, one), one));
+        _mm_storeu_ps(lifeTime + i, life);
+
+        __m128 x = _mm_add_ps(_mm_add_ps(startX, _mm_mul_ps(life, dirX)), _mm_loadu_ps(&particles.offsetX[i]));
+        __m128 y = _mm_add_ps(_mm_add_ps(startY, _mm_mul_ps(life, dirY)), _mm_loadu_ps(&particles.offsetY[i]));
+        __m128 z = _mm_add_ps(_mm_add_ps(startZ, _mm_mul_ps(life, dirZ)), _mm_loadu_ps(&particles.offsetZ[i]));
+
+        // Transpose x0..x3, y0..y3, z0..z3 into x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+        __m128 xy01 = _mm_unpacklo_ps(x, y);
+        __m128 xy23 = _mm_unpackhi_ps(x, y);
+        __m128 z0x1 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0));
+        __m128 y1z1 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1));
+        __m128 z2x3 = _mm_shuffle_ps(z, xy23, _MM_SHUFFLE(2, 2, 2, 2));
+        __m128 x3z3 = _mm_shuffle_ps(xy23, z, _MM_SHUFFLE(3, 3, 3, 2));
+        _mm_storeu_ps(positions + i * 3, _mm_shuffle_ps(xy01, z0x1, _MM_SHUFFLE(2, 0, 1, 0)));
+        _mm_storeu_ps(positions + i * 3 + 4, _mm_shuffle_ps(y1z1, xy23, _MM_SHUFFLE(1, 0, 2, 0)));
+        _mm_storeu_ps(positions + i * 3 + 8, _mm_shuffle_ps(z2x3, x3z3, _MM_SHUFFLE(2, 1, 2, 0)));
+    }
+#endif
+    updateParticlesScalar(particles, i, deltaTime, start, end);
+}
+
+ParticleSystem::ParticleSystem(int particleMax, GLuint shaderProgramID, GLuint simulationProgramID)
+        : particleCount(particleMax), shaderProgramID(shaderProgramID), simulationProgramID(simulationProgramID) {
     particles.resize(particleMax);
 
-    // Generate VAO and VBO
-    glGenVertexArrays(1, &particleVAO);
-    glGenBuffers(1, &particleVBO);
-    glBindVertexArray(particleVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Particle) * particles.size(), nullptr, GL_DYNAMIC_DRAW);
+    // Color and size are written once on initialize, followed by the offsets in GPU mode
+    size_t colorBytes = sizeof(GLuint) * particleCount;
+    size_t sizeBytes = (sizeof(GLushort) * particleCount + 3) & ~size_t(3); // Keeps the offsets 4 byte aligned
+    size_t offsetBytes = simulationProgramID ? sizeof(glm::vec3) * particleCount : 0;
+    glGenBuffers(1, &attributeVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, attributeVBO);
+    glBufferData(GL_ARRAY_BUFFER, colorBytes + sizeBytes + offsetBytes, nullptr, GL_STATIC_DRAW);
 
-    // Enable vertex attributes
-    glEnableVertexAttribArray(0); // Position
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, position));
+    if (!simulationProgramID) {
+        // Positions are simulated on the CPU and streamed every frame
+        positionStream.initialize(sizeof(float) * 3 * particleCount);
+    } else {
+        // Position and lifeTime per particle, read from one buffer and written to the other
+        glGenBuffers(2, stateVBO);
+        glGenVertexArrays(2, simulationVAO);
+        for (int i = 0; i < 2; ++i) {
+            glBindBuffer(GL_ARRAY_BUFFER, stateVBO[i]);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * particleCount, nullptr, GL_DYNAMIC_COPY);
 
-    glEnableVertexAttribArray(1); // Color
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, color));
+            glBindVertexArray(simulationVAO[i]);
+            glEnableVertexAttribArray(0); // State
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
+            glBindBuffer(GL_ARRAY_BUFFER, attributeVBO);
+            glEnableVertexAttribArray(1); // Offset
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(colorBytes + sizeBytes));
+        }
+    }
 
-    glEnableVertexAttribArray(2); // Size
-    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, size));
+    // One render VAO per state buffer, the CPU path only uses the first
+    int vaoCount = simulationProgramID ? 2 : 1;
+    glGenVertexArrays(vaoCount, particleVAO);
+    for (int i = 0; i < vaoCount; ++i) {
+        glBindVertexArray(particleVAO[i]);
+        glEnableVertexAttribArray(0); // Position, the CPU path points it at the stream after each upload
+        if (simulationProgramID) {
+            glBindBuffer(GL_ARRAY_BUFFER, stateVBO[i]);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+        }
 
-    glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, attributeVBO);
+        glEnableVertexAttribArray(1); // Color
+        glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, (void*)0);
+        glEnableVertexAttribArray(2); // Size
+        glVertexAttribPointer(2, 1, GL_HALF_FLOAT, GL_FALSE, 0, (void*)colorBytes);
+    }
 
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 // Destructor
@@ -32,37 +130,134 @@ ParticleSystem::~ParticleSystem() {
 }
 
 // Initialize particles
-void ParticleSystem::initialize(glm::vec3 start, glm::vec3 end) {
-    for (size_t i = 0; i < particles.size(); ++i) {
-        float t = static_cast<float>(i) / particles.size();
-        particles[i].position = glm::mix(start, end, t);
-        particles[i].velocity = glm::normalize(end - start) * 10.0f;
-        particles[i].color = glm::vec4(0.2f, 1.0f, 0.2f, 1.0f);
-        particles[i].size = 10.0f + static_cast<float>(rand()) / RAND_MAX * 10.0f;
-        particles[i].lifeTime = t;
+void ParticleSystem::initialize(glm::vec3 start, glm::vec3 end, glm::vec3 spread, glm::vec4 color, float minSize,
+                                float maxSize) {
+    GLuint packedColor = glm::packUnorm4x8(color);
+    for (int i = 0; i < particleCount; ++i) {
+        float t = static_cast<float>(i) / particleCount;
+        particles.colors[i] = packedColor;
+        particles.sizes[i] = glm::packHalf1x16(minSize + static_cast<float>(rand()) / RAND_MAX * (maxSize - minSize));
+        particles.lifeTime[i] = t;
 
         // Assign random offset
-        particles[i].randomOffset = glm::vec3((static_cast<float>(rand()) / RAND_MAX - 0.5f) * 200.0f, (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 50.0f, (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 200.0f );
+        particles.offsetX[i] = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * spread.x;
+        particles.offsetY[i] = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * spread.y;
+        particles.offsetZ[i] = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * spread.z;
+
+        glm::vec3 position = glm::mix(start, end, t) +
+                             glm::vec3(particles.offsetX[i], particles.offsetY[i], particles.offsetZ[i]);
+        particles.positions[i * 3] = position.x;
+        particles.positions[i * 3 + 1] = position.y;
+        particles.positions[i * 3 + 2] = position.z;
     }
+
+    size_t colorBytes = sizeof(GLuint) * particleCount;
+    size_t sizeBytes = (sizeof(GLushort) * particleCount + 3) & ~size_t(3);
+    glBindBuffer(GL_ARRAY_BUFFER, attributeVBO);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, colorBytes, particles.colors.data());
+    glBufferSubData(GL_ARRAY_BUFFER, colorBytes, sizeof(GLushort) * particleCount, particles.sizes.data());
+
+    if (!simulationProgramID) {
+        uploadPositions();
+        return;
+    }
+
+    // Hand the state over to the GPU and drop the CPU copy
+    std::vector<glm::vec3> offsets(particleCount);
+    std::vector<glm::vec4> state(particleCount);
+    for (int i = 0; i < particleCount; ++i) {
+        offsets[i] = glm::vec3(particles.offsetX[i], particles.offsetY[i], particles.offsetZ[i]);
+        state[i] = glm::vec4(particles.positions[i * 3], particles.positions[i * 3 + 1], particles.positions[i * 3 + 2],
+                             particles.lifeTime[i]);
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, colorBytes + sizeBytes, sizeof(glm::vec3) * particleCount, offsets.data());
+    glBindBuffer(GL_ARRAY_BUFFER, stateVBO[currentState]);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec4) * particleCount, state.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    particles = ParticleArrays();
 }
 
 
+void ParticleSystem::setCollision(const SignedDistanceGrid *grid, GLuint textureID, float radius) {
+    collisionGrid = grid;
+    collisionTextureID = textureID;
+    collisionRadius = radius;
+    if (!grid) {
+        collisionPush.clear();
+    } else if (!simulationProgramID && static_cast<int>(collisionPush.size()) != particleCount) {
+        collisionPush.assign(particleCount, glm::vec3(0.0f));
+    }
+}
+
 void ParticleSystem::update(float deltaTime, glm::vec3 start, glm::vec3 end) {
-    for (auto &particle : particles) {
-        particle.lifeTime += deltaTime * 0.1f;
-        if (particle.lifeTime >= 1.0f) {
-            particle.lifeTime -= 1.0f;
+    if (simulationProgramID) {
+        glUseProgram(simulationProgramID);
+        glUniform1f(glGetUniformLocation(simulationProgramID, "deltaTime"), deltaTime);
+        glUniform3fv(glGetUniformLocation(simulationProgramID, "start"), 1, &start[0]);
+        glUniform3fv(glGetUniformLocation(simulationProgramID, "end"), 1, &end[0]);
+        glUniform1i(glGetUniformLocation(simulationProgramID, "collide"), collisionGrid ? 1 : 0);
+        if (collisionGrid) {
+            glm::vec3 origin = collisionGrid->origin(), extent = collisionGrid->extent();
+            glUniform3fv(glGetUniformLocation(simulationProgramID, "sdfOrigin"), 1, &origin[0]);
+            glUniform3fv(glGetUniformLocation(simulationProgramID, "sdfExtent"), 1, &extent[0]);
+            glUniform1f(glGetUniformLocation(simulationProgramID, "collisionRadius"), collisionRadius);
+            glUniform1i(glGetUniformLocation(simulationProgramID, "sdfTexture"), 3);
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_3D, collisionTextureID);
+            glActiveTexture(GL_TEXTURE0);
         }
 
-        glm::vec3 basePosition = glm::mix(start, end, particle.lifeTime);
+        // One point per particle, nothing is rasterized
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBindVertexArray(simulationVAO[currentState]);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, stateVBO[1 - currentState]);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, particleCount);
+        glEndTransformFeedback();
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glBindVertexArray(0);
+        glDisable(GL_RASTERIZER_DISCARD);
 
-        glm::vec3 offset = particle.randomOffset;
-        particle.position = basePosition + offset;
+        currentState = 1 - currentState;
+        return;
     }
 
-    // Update particle buffer
-    glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(Particle) * particles.size(), particles.data());
+    updateParticles(particles, deltaTime, start, end);
+    if (collisionGrid) {
+        collide(deltaTime);
+    }
+    uploadPositions();
+}
+
+// One grid sample per particle on top of the kinematic position, the push carries
+// over to the next frame so particles rest on roofs instead of sinking back in
+void ParticleSystem::collide(float deltaTime) {
+    float wrapped = deltaTime * 0.1f; // lifeTime below one step means the particle just restarted
+    parallelFor(particleCount, 4096, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            if (particles.lifeTime[i] < wrapped) {
+                collisionPush[i] = glm::vec3(0.0f);
+            }
+            float *p = &particles.positions[i * 3];
+            glm::vec3 kinematic(p[0], p[1], p[2]);
+            glm::vec3 position = kinematic + collisionPush[i];
+            collisionGrid->collide(position, collisionRadius);
+            collisionPush[i] = position - kinematic;
+            p[0] = position.x;
+            p[1] = position.y;
+            p[2] = position.z;
+        }
+    });
+}
+
+// Only the positions are streamed, 12 bytes per particle
+void ParticleSystem::uploadPositions() {
+    positionStream.write(particles.positions.data(), sizeof(float) * particles.positions.size());
+    glBindVertexArray(particleVAO[0]);
+    glBindBuffer(GL_ARRAY_BUFFER, positionStream.buffer());
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 
@@ -72,14 +267,21 @@ void ParticleSystem::render(glm::mat4 vpMatrix) {
     glUseProgram(shaderProgramID);
     glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "vpMatrix"), 1, GL_FALSE, &vpMatrix[0][0]);
 
-    glBindVertexArray(particleVAO);
-    glDrawArrays(GL_POINTS, 0, particles.size());
+    glBindVertexArray(particleVAO[currentState]);
+    glDrawArrays(GL_POINTS, 0, particleCount);
     glBindVertexArray(0);
 }
 
 
 // Cleanup resources
 void ParticleSystem::cleanup() {
-    glDeleteBuffers(1, &particleVBO);
-    glDeleteVertexArrays(1, &particleVAO);
+    positionStream.cleanup();
+    glDeleteBuffers(1, &attributeVBO);
+    glDeleteBuffers(2, stateVBO);
+    glDeleteVertexArrays(2, particleVAO);
+    glDeleteVertexArrays(2, simulationVAO);
+    attributeVBO = 0;
+    stateVBO[0] = stateVBO[1] = 0;
+    particleVAO[0] = particleVAO[1] = 0;
+    simulationVAO[0] = simulationVAO[1] = 0;
 }
@@ -6,26 +6,63 @@
 #include <glm/glm.hpp>
 #include <vector>
 
-struct Particle {
-    glm::vec3 position;
-    glm::vec4 color;
-    glm::vec3 velocity;
-    float size;
-    float lifeTime;
-    glm::vec3 randomOffset;
+#include "sdfGrid.h"
+#include "streamBuffer.h"
 
+// Particle state in structure-of-arrays layout, so the update kernel can load
+// four particles of one field with a single SSE instruction.
+struct ParticleArrays {
+    std::vector<float> lifeTime;
+    std::vector<float> offsetX, offsetY, offsetZ;
+    std::vector<float> positions; // Interleaved xyz, the per-frame GPU stream
+    std::vector<GLuint> colors;   // RGBA8
+    std::vector<GLushort> sizes;  // Half floats
+
+    int count() const { return static_cast<int>(lifeTime.size()); }
+    void resize(int count);
 };
 
+// Advances every particle along start -> end and writes the interleaved positions.
+// Uses SSE for four particles per step when available, scalar code for the rest.
+void updateParticles(ParticleArrays &particles, float deltaTime, glm::vec3 start, glm::vec3 end);
+void updateParticlesScalar(ParticleArrays &particles, int begin, float deltaTime, glm::vec3 start, glm::vec3 end);
+
+// Particles move from start to end over their lifetime, spread around that line by
+// a fixed random offset. With a simulation program the state stays on the GPU in two
+// buffers that are advanced in turn with transform feedback, so nothing is uploaded
+// after initialize.
 class ParticleSystem {
 private:
-    std::vector<Particle> particles;
-    GLuint particleVAO, particleVBO;
+    ParticleArrays particles;
+    int particleCount;
+    GLuint particleVAO[2] = {0, 0};
+    GLuint attributeVBO = 0;
+    StreamBuffer positionStream; // CPU simulation only
     GLuint shaderProgramID;
 
+    // GPU simulation
+    GLuint simulationProgramID;
+    GLuint simulationVAO[2] = {0, 0};
+    GLuint stateVBO[2] = {0, 0};
+    int currentState = 0;
+
+    // Collision with the baked city, the push of each particle is kept until it wraps
+    const SignedDistanceGrid *collisionGrid = nullptr;
+    GLuint collisionTextureID = 0;
+    float collisionRadius = 0.0f;
+    std::vector<glm::vec3> collisionPush; // CPU simulation only
+
+    void uploadPositions();
+    void collide(float deltaTime);
+
 public:
-    ParticleSystem(int particleMax, GLuint shaderProgramID);
+    ParticleSystem(int particleMax, GLuint shaderProgramID, GLuint simulationProgramID = 0);
     ~ParticleSystem();
-    void initialize(glm::vec3 start, glm::vec3 end);
+    void initialize(glm::vec3 start, glm::vec3 end, glm::vec3 spread = glm::vec3(200.0f, 50.0f, 200.0f),
+                    glm::vec4 color = glm::vec4(0.2f, 1.0f, 0.2f, 1.0f), float minSize = 10.0f, float maxSize = 20.0f);
+    // The CPU path samples the grid, the GPU path the 3D texture made from it.
+    // A null grid turns collision off.
+    void setCollision(const SignedDistanceGrid *grid, GLuint textureID, float radius);
     void update(float deltaTime, glm::vec3 start, glm::vec3 end);
     void render(glm::mat4 vpMatrix);
     void cleanup();
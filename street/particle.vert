@@ -6,9 +6,10 @@ layout (location = 2) in float aSize;
 out vec4 particleColor;
 
 uniform mat4 vpMatrix;
+uniform float pointSizeScale = 1.0;
 
 void main() {
     particleColor = aColor;
     gl_Position = vpMatrix * vec4(aPos, 1.0);
-    gl_PointSize = aSize;
+    gl_PointSize = aSize * pointSizeScale;
 }
\ No newline at end of file
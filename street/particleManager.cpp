@@ -0,0 +1,309 @@
+#include "particleManager.h"
+#include "radixSort.h"
+
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+// Emitters further away than lodDistance * 2^(MAX_LOD_LEVEL - 1) stay at the lowest rate
+static const int MAX_LOD_LEVEL = 3;
+
+static float randomFloat() {
+    return static_cast<float>(rand()) / RAND_MAX;
+}
+
+void ParticleManager::reserve(int capacity) {
+    this->capacity = capacity;
+    age.assign(capacity, 0.0f);
+    lifeTime.assign(capacity, 0.0f);
+    offsetX.resize(capacity);
+    offsetY.resize(capacity);
+    offsetZ.resize(capacity);
+    emitterIndex.resize(capacity);
+    size.resize(capacity);
+    lastPosition.resize(capacity);
+    freeSlots.reserve(capacity);
+    vertices.reserve(capacity);
+    viewDepths.reserve(capacity);
+    depthKeys.reserve(capacity);
+    keyScratch.reserve(capacity);
+    drawOrder.reserve(capacity);
+    orderScratch.reserve(capacity);
+}
+
+void ParticleManager::initialize(int capacity, GLuint shaderProgramID) {
+    this->shaderProgramID = shaderProgramID;
+    reserve(capacity);
+
+    vertexStream.initialize(sizeof(ParticleVertex) * capacity);
+    indexStream.initialize(sizeof(GLuint) * capacity);
+    glGenVertexArrays(1, &particleVAO);
+    glBindVertexArray(particleVAO);
+    glEnableVertexAttribArray(0); // Position
+    glEnableVertexAttribArray(1); // Color
+    glEnableVertexAttribArray(2); // Size
+    glBindVertexArray(0);
+}
+
+int ParticleManager::addEmitter(const ParticleEmitter &emitter) {
+    int index = static_cast<int>(emitters.size());
+    emitters.push_back(emitter);
+    EmitterState state;
+    state.packedColor = glm::packUnorm4x8(emitter.color);
+    emitterStates.push_back(state);
+    visibleEmitters++;
+
+    int steadyCount = static_cast<int>(emitter.spawnRate * emitter.lifeTime);
+    for (int i = 0; i < steadyCount; ++i) {
+        spawn(index, emitter.lifeTime * i / steadyCount);
+    }
+    return index;
+}
+
+bool ParticleManager::spawn(int emitter, float initialAge) {
+    int slot;
+    if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    } else if (highWater < capacity) {
+        slot = highWater++;
+    } else {
+        droppedSpawns++;
+        return false;
+    }
+
+    const ParticleEmitter &e = emitters[emitter];
+    glm::vec3 offset(0.0f);
+    if (e.shape == EMITTER_BOX) {
+        offset = glm::vec3(randomFloat(), randomFloat(), randomFloat()) * 2.0f - 1.0f;
+    } else if (e.shape == EMITTER_SPHERE) {
+        do {
+            offset = glm::vec3(randomFloat(), randomFloat(), randomFloat()) * 2.0f - 1.0f;
+        } while (glm::dot(offset, offset) > 1.0f);
+    }
+    offset *= e.shapeExtent;
+
+    age[slot] = initialAge;
+    lifeTime[slot] = e.lifeTime;
+    offsetX[slot] = offset.x;
+    offsetY[slot] = offset.y;
+    offsetZ[slot] = offset.z;
+    emitterIndex[slot] = emitter;
+    size[slot] = glm::packHalf1x16(e.minSize + randomFloat() * (e.maxSize - e.minSize));
+    return true;
+}
+
+void ParticleManager::emitterBounds(int emitterIndex, glm::vec3 &boundsMin, glm::vec3 &boundsMax) const {
+    const ParticleEmitter &e = emitters[emitterIndex];
+    // Sizes are in pixels, the margin only has to cover the collision push
+    glm::vec3 margin = e.shapeExtent + collisionRadius;
+    boundsMin = glm::min(e.start, e.end) - margin;
+    boundsMax = glm::max(e.start, e.end) + margin;
+}
+
+void ParticleManager::setView(glm::mat4 vpMatrix, glm::vec3 cameraPosition) {
+    // Frustum planes straight from the rows of the view projection matrix
+    glm::mat4 m = glm::transpose(vpMatrix);
+    glm::vec4 planes[6] = {m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[3] + m[2], m[3] - m[2]};
+
+    visibleEmitters = 0;
+    for (size_t e = 0; e < emitters.size(); ++e) {
+        glm::vec3 boundsMin, boundsMax;
+        emitterBounds(static_cast<int>(e), boundsMin, boundsMax);
+
+        // The box is outside when its corner furthest along a plane normal is behind that plane
+        bool visible = true;
+        for (const glm::vec4 &plane: planes) {
+            glm::vec3 corner(plane.x >= 0.0f ? boundsMax.x : boundsMin.x, plane.y >= 0.0f ? boundsMax.y : boundsMin.y,
+                             plane.z >= 0.0f ? boundsMax.z : boundsMin.z);
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+                visible = false;
+                break;
+            }
+        }
+
+        EmitterState &state = emitterStates[e];
+        if (visible && !state.visible) {
+            // The positions kept from before the cull are stale, step on the first visible frame
+            state.framesSkipped = (1 << MAX_LOD_LEVEL) - 1;
+        }
+        state.visible = visible;
+        visibleEmitters += visible ? 1 : 0;
+
+        float distance = glm::length(glm::clamp(cameraPosition, boundsMin, boundsMax) - cameraPosition);
+        float lodDistance = emitters[e].lodDistance;
+        state.lodLevel = 0;
+        while (distance > lodDistance && state.lodLevel < MAX_LOD_LEVEL) {
+            state.lodLevel++;
+            lodDistance *= 2.0f;
+        }
+    }
+}
+
+void ParticleManager::simulate(float deltaTime) {
+    // Decide how far every emitter advances this frame. Culled emitters only collect the
+    // time, distant ones advance every few frames by everything collected since.
+    for (size_t e = 0; e < emitters.size(); ++e) {
+        EmitterState &state = emitterStates[e];
+        state.packedColor = glm::packUnorm4x8(emitters[e].color);
+        state.pendingTime += deltaTime;
+        state.stepTime = 0.0f;
+        if (!state.visible) {
+            continue;
+        }
+        if (state.framesSkipped + 1 < (1 << state.lodLevel) && state.pendingTime < emitters[e].lifeTime) {
+            state.framesSkipped++;
+            continue;
+        }
+        state.stepTime = state.pendingTime;
+        state.pendingTime = 0.0f;
+        state.framesSkipped = 0;
+        if (!emitters[e].active) {
+            continue;
+        }
+
+        // Spawns are spread over the step at the times the rate puts them. Particles that
+        // would already have died are never created, so a long step costs no more than a short one.
+        float rate = emitters[e].spawnRate / (1 << state.lodLevel);
+        float previous = state.spawnAccumulator;
+        state.spawnAccumulator += rate * state.stepTime;
+        int spawnCount = static_cast<int>(state.spawnAccumulator);
+        state.spawnAccumulator -= spawnCount;
+        int firstAlive = std::max(1, spawnCount - static_cast<int>(rate * emitters[e].lifeTime));
+        for (int j = firstAlive; j <= spawnCount; ++j) {
+            float spawnTime = (j - previous) / rate;
+            float ageAtEnd = std::max(0.0f, state.stepTime - spawnTime);
+            if (ageAtEnd < emitters[e].lifeTime) {
+                // Aged by stepTime below like every other particle
+                spawn(static_cast<int>(e), ageAtEnd - state.stepTime);
+            }
+        }
+    }
+
+    // Age every used slot, free the ones that expire and pack the living ones
+    vertices.clear();
+    sorted = false;
+    collisions = 0;
+    simulatedParticles = 0;
+    for (int i = 0; i < highWater; ++i) {
+        if (lifeTime[i] == 0.0f) {
+            continue;
+        }
+        const EmitterState &state = emitterStates[emitterIndex[i]];
+        if (!state.visible) {
+            continue;
+        }
+
+        ParticleVertex vertex;
+        vertex.color = state.packedColor;
+        vertex.size = size[i];
+        vertex.padding = 0;
+        if (state.stepTime == 0.0f) {
+            vertex.position = lastPosition[i];
+            vertices.push_back(vertex);
+            continue;
+        }
+
+        age[i] += state.stepTime;
+        if (age[i] >= lifeTime[i]) {
+            lifeTime[i] = 0.0f;
+            age[i] = 0.0f;
+            freeSlots.push_back(i);
+            continue;
+        }
+
+        const ParticleEmitter &e = emitters[emitterIndex[i]];
+        float t = std::max(0.0f, age[i]) / lifeTime[i];
+        vertex.position = e.start + t * (e.end - e.start) + glm::vec3(offsetX[i], offsetY[i], offsetZ[i]);
+        if (collisionGrid) {
+            glm::vec3 before = vertex.position;
+            if (collisionGrid->collide(vertex.position, collisionRadius)) {
+                offsetX[i] += vertex.position.x - before.x;
+                offsetY[i] += vertex.position.y - before.y;
+                offsetZ[i] += vertex.position.z - before.z;
+                collisions++;
+            }
+        }
+        lastPosition[i] = vertex.position;
+        vertices.push_back(vertex);
+        simulatedParticles++;
+    }
+}
+
+void ParticleManager::setCollision(const SignedDistanceGrid *grid, float radius) {
+    collisionGrid = grid;
+    collisionRadius = radius;
+}
+
+void ParticleManager::sortByDepth(glm::vec3 cameraPosition, glm::vec3 viewDirection) {
+    auto startTime = std::chrono::high_resolution_clock::now();
+    int count = static_cast<int>(vertices.size());
+
+    // View depth of every particle, quantized to 16 bits over this frame's range.
+    // The farthest particle gets key 0, so ascending keys draw back to front.
+    float nearest = 1e30f, farthest = -1e30f;
+    viewDepths.resize(count);
+    for (int i = 0; i < count; ++i) {
+        viewDepths[i] = glm::dot(vertices[i].position - cameraPosition, viewDirection);
+        nearest = std::min(nearest, viewDepths[i]);
+        farthest = std::max(farthest, viewDepths[i]);
+    }
+    float keyScale = farthest > nearest ? 65535.0f / (farthest - nearest) : 0.0f;
+    depthKeys.resize(count);
+    for (int i = 0; i < count; ++i) {
+        depthKeys[i] = static_cast<uint16_t>((farthest - viewDepths[i]) * keyScale);
+    }
+
+    radixSort16(depthKeys, drawOrder, keyScratch, orderScratch);
+    sorted = true;
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    lastSortMs = std::chrono::duration<float, std::milli>(endTime - startTime).count();
+}
+
+void ParticleManager::update(float deltaTime) {
+    simulate(deltaTime);
+    upload();
+}
+
+void ParticleManager::upload() {
+    vertexStream.write(vertices.data(), sizeof(ParticleVertex) * vertices.size());
+
+    // Every frame lands in a different buffer of the ring
+    glBindVertexArray(particleVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexStream.buffer());
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(ParticleVertex), (void*)offsetof(ParticleVertex, position));
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ParticleVertex), (void*)offsetof(ParticleVertex, color));
+    glVertexAttribPointer(2, 1, GL_HALF_FLOAT, GL_FALSE, sizeof(ParticleVertex), (void*)offsetof(ParticleVertex, size));
+    if (sorted) {
+        indexStream.write(drawOrder.data(), sizeof(GLuint) * drawOrder.size());
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexStream.buffer());
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ParticleManager::render(glm::mat4 vpMatrix) {
+    if (vertices.empty()) {
+        return;
+    }
+    glUseProgram(shaderProgramID);
+    glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "vpMatrix"), 1, GL_FALSE, &vpMatrix[0][0]);
+
+    glBindVertexArray(particleVAO);
+    if (sorted) {
+        glDrawElements(GL_POINTS, static_cast<GLsizei>(drawOrder.size()), GL_UNSIGNED_INT, (void*)0);
+    } else {
+        glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(vertices.size()));
+    }
+    glBindVertexArray(0);
+}
+
+void ParticleManager::cleanup() {
+    vertexStream.cleanup();
+    indexStream.cleanup();
+    glDeleteVertexArrays(1, &particleVAO);
+    particleVAO = 0;
+}
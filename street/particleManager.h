@@ -0,0 +1,128 @@
+#ifndef PARTICLEMANAGER_H
+#define PARTICLEMANAGER_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+#include "sdfGrid.h"
+#include "streamBuffer.h"
+
+enum EmitterShape { EMITTER_POINT, EMITTER_BOX, EMITTER_SPHERE };
+
+// Describes where particles spawn and how they move. A particle travels from
+// start to end over its lifetime, displaced by a fixed offset picked inside the
+// emitter shape when it spawns.
+struct ParticleEmitter {
+    glm::vec3 start = glm::vec3(0.0f);
+    glm::vec3 end = glm::vec3(0.0f, 50.0f, 0.0f);
+    EmitterShape shape = EMITTER_BOX;
+    glm::vec3 shapeExtent = glm::vec3(100.0f, 25.0f, 100.0f); // Half extent of the box or sphere
+    float spawnRate = 20.0f; // Particles per second
+    float lifeTime = 10.0f;  // Seconds
+    glm::vec4 color = glm::vec4(0.2f, 1.0f, 0.2f, 1.0f);
+    float minSize = 10.0f;
+    float maxSize = 20.0f;
+    bool active = true;
+    // Past this camera distance spawn and update rates halve, and halve again at every doubling
+    float lodDistance = 800.0f;
+};
+
+// One particle pool shared by every emitter. Dead particles go on a free list and
+// their slots are reused by the next spawn, so the pool never reallocates. The
+// living particles of all emitters are packed into one vertex stream and drawn
+// with a single glDrawArrays. Emitters outside the view only advance their clock and
+// are fast-forwarded in closed form once they are seen again, and distant ones
+// spawn and update less often.
+class ParticleManager {
+public:
+    void initialize(int capacity, GLuint shaderProgramID);
+    // Allocates the pool without creating any GL objects, initialize calls it
+    void reserve(int capacity);
+    // New emitters start in their steady state, with particles of every age
+    int addEmitter(const ParticleEmitter &emitter);
+    ParticleEmitter &emitter(int emitterIndex) { return emitters[emitterIndex]; }
+    // Box around every position the emitter's particles can reach
+    void emitterBounds(int emitterIndex, glm::vec3 &boundsMin, glm::vec3 &boundsMax) const;
+    // Culls emitters against the frustum and picks their level of detail for the next simulate
+    void setView(glm::mat4 vpMatrix, glm::vec3 cameraPosition);
+    // Spawns, ages and moves the particles and fills the vertex stream, no GL calls
+    void simulate(float deltaTime);
+    // Orders the vertices of the last simulate back to front along the view direction
+    void sortByDepth(glm::vec3 cameraPosition, glm::vec3 viewDirection);
+    // Keeps particles at least radius away from the baked geometry, nullptr turns it off.
+    // The push is added to the particle offset, so it keeps resting on what it hit.
+    void setCollision(const SignedDistanceGrid *grid, float radius);
+    // Streams the vertices and the draw order of the last simulate to the GPU
+    void upload();
+    void update(float deltaTime);
+    void render(glm::mat4 vpMatrix);
+    void cleanup();
+
+    int aliveCount() const { return static_cast<int>(vertices.size()); }
+    int droppedCount() const { return droppedSpawns; }
+    float sortMs() const { return lastSortMs; }
+    int collisionCount() const { return collisions; }
+    int visibleEmitterCount() const { return visibleEmitters; }
+    int emitterCount() const { return static_cast<int>(emitters.size()); }
+    // Particles whose position was recomputed by the last simulate
+    int simulatedCount() const { return simulatedParticles; }
+
+private:
+    // Matches the attributes of particle.vert
+    struct ParticleVertex {
+        glm::vec3 position;
+        GLuint color;   // RGBA8
+        GLushort size;  // Half float
+        GLushort padding;
+    };
+
+    struct EmitterState {
+        float spawnAccumulator = 0.0f;
+        GLuint packedColor = 0;
+        bool visible = true;
+        int lodLevel = 0;      // Updates every 2^lodLevel frames at 1/2^lodLevel of the spawn rate
+        int framesSkipped = 0;
+        float pendingTime = 0.0f; // Time not simulated yet, while culled or between LOD updates
+        float stepTime = 0.0f;    // Time advanced by the current simulate, 0 reuses the last positions
+    };
+
+    int capacity = 0;
+    int highWater = 0; // Slots at and above this index have never been used
+    int droppedSpawns = 0;
+    int visibleEmitters = 0;
+    int simulatedParticles = 0;
+    std::vector<ParticleEmitter> emitters;
+    std::vector<EmitterState> emitterStates;
+
+    // Pool in structure-of-arrays layout, a slot is alive while age < lifeTime
+    std::vector<float> age, lifeTime;
+    std::vector<float> offsetX, offsetY, offsetZ;
+    std::vector<int> emitterIndex;
+    std::vector<GLushort> size;
+    std::vector<glm::vec3> lastPosition; // Drawn again on frames an emitter skips
+    std::vector<int> freeSlots;
+
+    std::vector<ParticleVertex> vertices;
+
+    const SignedDistanceGrid *collisionGrid = nullptr;
+    float collisionRadius = 0.0f;
+    int collisions = 0; // Particles pushed out during the last simulate
+
+    // Depth sort, rebuilt every frame
+    bool sorted = false;
+    float lastSortMs = 0.0f;
+    std::vector<float> viewDepths;
+    std::vector<uint16_t> depthKeys, keyScratch;
+    std::vector<uint32_t> drawOrder, orderScratch;
+
+    GLuint particleVAO = 0;
+    StreamBuffer vertexStream;
+    StreamBuffer indexStream;
+    GLuint shaderProgramID = 0;
+
+    bool spawn(int emitterIndex, float initialAge);
+};
+
+#endif // PARTICLEMANAGER_H
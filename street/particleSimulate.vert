@@ -0,0 +1,42 @@
+#version 330 core
+// Advances one particle per vertex, the output is captured with transform feedback
+layout (location = 0) in vec4 aState; // Position, lifeTime
+layout (location = 1) in vec3 aOffset;
+
+out vec4 outState;
+
+uniform float deltaTime;
+uniform vec3 start;
+uniform vec3 end;
+
+// Signed distance grid of the city, gradient in rgb and distance in a
+uniform bool collide;
+uniform sampler3D sdfTexture;
+uniform vec3 sdfOrigin;
+uniform vec3 sdfExtent;
+uniform float collisionRadius;
+
+void main() {
+    float lifeTime = aState.w + deltaTime * 0.1;
+    vec3 push = vec3(0.0);
+    if (lifeTime >= 1.0) {
+        lifeTime -= 1.0;
+    } else {
+        // Whatever the last collision added on top of the path, kept until the particle wraps
+        push = aState.xyz - (mix(start, end, aState.w) + aOffset);
+    }
+    vec3 position = mix(start, end, lifeTime) + aOffset + push;
+
+    if (collide) {
+        vec3 grid = (position - sdfOrigin) / sdfExtent;
+        if (all(greaterThanEqual(grid, vec3(0.0))) && all(lessThan(grid, vec3(1.0)))) {
+            // Grid points sit on texel centers
+            vec3 size = vec3(textureSize(sdfTexture, 0));
+            vec4 field = texture(sdfTexture, (grid * (size - 1.0) + 0.5) / size);
+            if (field.a < collisionRadius && dot(field.rgb, field.rgb) > 1e-6) {
+                position += normalize(field.rgb) * (collisionRadius - field.a);
+            }
+        }
+    }
+    outState = vec4(position, lifeTime);
+}
@@ -0,0 +1,65 @@
+#include "radixSort.h"
+#include "jobSystem.h"
+
+#include <algorithm>
+
+// Below this count one thread is faster than splitting the work
+static const int PARALLEL_THRESHOLD = 65536;
+
+void radixSort16(std::vector<uint16_t> &keys, std::vector<uint32_t> &order, std::vector<uint16_t> &keyScratch,
+                 std::vector<uint32_t> &orderScratch) {
+    int count = static_cast<int>(keys.size());
+    order.resize(count);
+    keyScratch.resize(count);
+    orderScratch.resize(count);
+    for (int i = 0; i < count; ++i) {
+        order[i] = static_cast<uint32_t>(i);
+    }
+
+    int chunkCount = count < PARALLEL_THRESHOLD ? 1 : std::max(1, std::min(JobSystem::threadCount(), 16));
+    int chunkSize = (count + chunkCount - 1) / std::max(1, chunkCount);
+    std::vector<uint32_t> histograms(chunkCount * 256);
+
+    uint16_t *sourceKeys = keys.data(), *targetKeys = keyScratch.data();
+    uint32_t *sourceOrder = order.data(), *targetOrder = orderScratch.data();
+    for (int shift = 0; shift < 16; shift += 8) {
+        // Histogram of every chunk
+        std::fill(histograms.begin(), histograms.end(), 0);
+        parallelFor(chunkCount, 1, [&](int chunkBegin, int chunkEnd) {
+            for (int c = chunkBegin; c < chunkEnd; ++c) {
+                uint32_t *histogram = &histograms[c * 256];
+                int end = std::min(count, (c + 1) * chunkSize);
+                for (int i = c * chunkSize; i < end; ++i) {
+                    histogram[(sourceKeys[i] >> shift) & 0xFF]++;
+                }
+            }
+        });
+
+        // Exclusive prefix sum, bucket major so equal keys keep the chunk order
+        uint32_t offset = 0;
+        for (int bucket = 0; bucket < 256; ++bucket) {
+            for (int c = 0; c < chunkCount; ++c) {
+                uint32_t bucketCount = histograms[c * 256 + bucket];
+                histograms[c * 256 + bucket] = offset;
+                offset += bucketCount;
+            }
+        }
+
+        // Scatter keys and positions together
+        parallelFor(chunkCount, 1, [&](int chunkBegin, int chunkEnd) {
+            for (int c = chunkBegin; c < chunkEnd; ++c) {
+                uint32_t *offsets = &histograms[c * 256];
+                int end = std::min(count, (c + 1) * chunkSize);
+                for (int i = c * chunkSize; i < end; ++i) {
+                    uint32_t target = offsets[(sourceKeys[i] >> shift) & 0xFF]++;
+                    targetKeys[target] = sourceKeys[i];
+                    targetOrder[target] = sourceOrder[i];
+                }
+            }
+        });
+
+        std::swap(sourceKeys, targetKeys);
+        std::swap(sourceOrder, targetOrder);
+    }
+    // Two passes leave the result back in keys and order
+}
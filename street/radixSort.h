@@ -0,0 +1,14 @@
+#ifndef RADIXSORT_H
+#define RADIXSORT_H
+
+#include <cstdint>
+#include <vector>
+
+// Stable LSD radix sort of 16 bit keys in two 8 bit passes. On return order holds
+// the input positions sorted by ascending key. The cost is linear in the count;
+// large inputs split the histogram and scatter passes across the job system.
+// keys is reordered alongside, scratch buffers are reused between calls.
+void radixSort16(std::vector<uint16_t> &keys, std::vector<uint32_t> &order, std::vector<uint16_t> &keyScratch,
+                 std::vector<uint32_t> &orderScratch);
+
+#endif // RADIXSORT_H
@@ -3,101 +3,98 @@
 #include <string>
 #include <iostream>
 #include <fstream>
-#include <sstream> 
+#include <sstream>
 #include <vector>
 #include <stb/stb_image.h>
 
-GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path)
+// Reads a whole shader source file, kind names it in the error message
+static bool readShaderFile(const char *file_path, const char *kind, std::string &code)
 {
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+	std::ifstream ShaderStream(file_path, std::ios::in);
+	if (!ShaderStream.is_open())
+	{
+		printf("%s not found %s.\n", kind, file_path);
+		return false;
+	}
+	std::stringstream sstr;
+	sstr << ShaderStream.rdbuf();
+	code = sstr.str();
+	return true;
+}
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if (VertexShaderStream.is_open())
+// Inserts the shared code of include_path after the #version line of code
+static bool insertInclude(std::string &code, const char *include_path)
+{
+	std::string IncludeCode;
+	if (!readShaderFile(include_path, "Shader include", IncludeCode))
 	{
-		std::stringstream sstr;
-		sstr << VertexShaderStream.rdbuf();
-		VertexShaderCode = sstr.str();
-		VertexShaderStream.close();
+		return false;
 	}
-	else
+	size_t Version = code.find("#version");
+	size_t LineEnd = Version == std::string::npos ? std::string::npos : code.find('\n', Version);
+	if (LineEnd == std::string::npos)
 	{
-		printf("Vertex shader not found %s.\n", vertex_file_path);
-		return 0;
+		printf("No #version line to insert %s after.\n", include_path);
+		return false;
 	}
+	code.insert(LineEnd + 1, IncludeCode + "\n");
+	return true;
+}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if (FragmentShaderStream.is_open())
+// Compiles one shader stage and prints its info log on failure. name, when
+// given, is the file it came from. Returns 0 on failure.
+static GLuint compileShader(GLenum type, const std::string &source, const char *name)
+{
+	const char *Stage = type == GL_VERTEX_SHADER ? "vertex" : "fragment";
+	if (name)
 	{
-		std::stringstream sstr;
-		sstr << FragmentShaderStream.rdbuf();
-		FragmentShaderCode = sstr.str();
-		FragmentShaderStream.close();
+		printf("Compiling %s shader : %s\n", Stage, name);
 	}
 	else
 	{
-		printf("Fragment shader not found %s.\n", fragment_file_path);
-		return 0;
+		printf("Compiling %s shader\n", Stage);
 	}
 
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
-
-	// Compile Vertex Shader
-	printf("Compiling vertex shader : %s\n", vertex_file_path);
-	char const *VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer, NULL);
-	glCompileShader(VertexShaderID);
+	GLuint ShaderID = glCreateShader(type);
+	char const *SourcePointer = source.c_str();
+	glShaderSource(ShaderID, 1, &SourcePointer, NULL);
+	glCompileShader(ShaderID);
 
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
+	GLint Result = GL_FALSE;
+	glGetShaderiv(ShaderID, GL_COMPILE_STATUS, &Result);
 	if (!Result) {
-		printf("Error compiling vertex shader : %s\n", vertex_file_path);
-		glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-		if (InfoLogLength > 0) {
-			std::vector<char> VertexShaderErrorMessage(InfoLogLength + 1);
-			glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-			printf("%s\n", &VertexShaderErrorMessage[0]);
+		if (name)
+		{
+			printf("Error compiling %s shader : %s\n", Stage, name);
 		}
-		return 0;
-	}
-
-	// Compile Fragment Shader
-	printf("Compiling fragment shader : %s\n", fragment_file_path);
-	char const *FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer, NULL);
-	glCompileShader(FragmentShaderID);
-
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	if (!Result) {
-		printf("Error compiling fragment shader : %s\n", fragment_file_path);
-		glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-		if (InfoLogLength > 0)
+		else
 		{
-			std::vector<char> FragmentShaderErrorMessage(InfoLogLength + 1);
-			glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-			printf("%s\n", &FragmentShaderErrorMessage[0]);
+			printf("Error compiling %s shader\n", Stage);
 		}
+		int InfoLogLength;
+		glGetShaderiv(ShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+		if (InfoLogLength > 0) {
+			std::vector<char> ShaderErrorMessage(InfoLogLength + 1);
+			glGetShaderInfoLog(ShaderID, InfoLogLength, NULL, &ShaderErrorMessage[0]);
+			printf("%s\n", &ShaderErrorMessage[0]);
+		}
+		glDeleteShader(ShaderID);
 		return 0;
 	}
+	return ShaderID;
+}
 
-	// Link the program
-	printf("Linking program\n");
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
+// Links a program with its shaders attached and prints the info log on
+// failure. The program is deleted if it does not link. Returns 0 on failure.
+static GLuint linkProgram(GLuint ProgramID)
+{
 	glLinkProgram(ProgramID);
 
-	// Check the program
+	GLint Result = GL_FALSE;
 	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
 	if (!Result) {
 		printf("Error linking program\n");
+		int InfoLogLength;
 		glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
 		if (InfoLogLength > 0)
 		{
@@ -105,11 +102,39 @@ GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_fi
 			glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
 			printf("%s\n", &ProgramErrorMessage[0]);
 		}
+		glDeleteProgram(ProgramID);
 		return 0;
 	}
+	return ProgramID;
+}
+
+static GLuint loadShaders(const std::string &VertexShaderCode, const std::string &FragmentShaderCode,
+                          const char *vertex_name, const char *fragment_name)
+{
+	GLuint VertexShaderID = compileShader(GL_VERTEX_SHADER, VertexShaderCode, vertex_name);
+	if (VertexShaderID == 0)
+	{
+		return 0;
+	}
+	GLuint FragmentShaderID = compileShader(GL_FRAGMENT_SHADER, FragmentShaderCode, fragment_name);
+	if (FragmentShaderID == 0)
+	{
+		glDeleteShader(VertexShaderID);
+		return 0;
+	}
+
+	// Link the program
+	printf("Linking program\n");
+	GLuint ProgramID = glCreateProgram();
+	glAttachShader(ProgramID, VertexShaderID);
+	glAttachShader(ProgramID, FragmentShaderID);
+	ProgramID = linkProgram(ProgramID);
 
-	glDetachShader(ProgramID, VertexShaderID);
-	glDetachShader(ProgramID, FragmentShaderID);
+	if (ProgramID != 0)
+	{
+		glDetachShader(ProgramID, VertexShaderID);
+		glDetachShader(ProgramID, FragmentShaderID);
+	}
 
 	glDeleteShader(VertexShaderID);
 	glDeleteShader(FragmentShaderID);
@@ -117,80 +142,52 @@ GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_fi
 	return ProgramID;
 }
 
-GLuint LoadShadersFromString(std::string VertexShaderCode, std::string FragmentShaderCode)
+GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path,
+                           const char *fragment_include_path)
 {
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
-
-	// Compile Vertex Shader
-	printf("Compiling vertex shader\n");
-	char const *VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer, NULL);
-	glCompileShader(VertexShaderID);
-
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	if (!Result) {
-		printf("Error compiling vertex shader\n");
-		glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-		if (InfoLogLength > 0) {
-			std::vector<char> VertexShaderErrorMessage(InfoLogLength + 1);
-			glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-			printf("%s\n", &VertexShaderErrorMessage[0]);
-		}
+	std::string VertexShaderCode, FragmentShaderCode;
+	if (!readShaderFile(vertex_file_path, "Vertex shader", VertexShaderCode) ||
+	    !readShaderFile(fragment_file_path, "Fragment shader", FragmentShaderCode))
+	{
+		return 0;
+	}
+	if (fragment_include_path && !insertInclude(FragmentShaderCode, fragment_include_path))
+	{
 		return 0;
 	}
+	return loadShaders(VertexShaderCode, FragmentShaderCode, vertex_file_path, fragment_file_path);
+}
 
-	// Compile Fragment Shader
-	printf("Compiling fragment shader\n");
-	char const *FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer, NULL);
-	glCompileShader(FragmentShaderID);
+GLuint LoadShadersFromString(std::string VertexShaderCode, std::string FragmentShaderCode)
+{
+	return loadShaders(VertexShaderCode, FragmentShaderCode, nullptr, nullptr);
+}
 
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	if (!Result) {
-		printf("Error compiling fragment shader\n");
-		glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-		if (InfoLogLength > 0)
-		{
-			std::vector<char> FragmentShaderErrorMessage(InfoLogLength + 1);
-			glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-			printf("%s\n", &FragmentShaderErrorMessage[0]);
-		}
+GLuint LoadTransformFeedbackShaderFromFile(const char *vertex_file_path, const char *const *varyings, int varyingCount)
+{
+	std::string VertexShaderCode;
+	if (!readShaderFile(vertex_file_path, "Vertex shader", VertexShaderCode))
+	{
+		return 0;
+	}
+	GLuint VertexShaderID = compileShader(GL_VERTEX_SHADER, VertexShaderCode, vertex_file_path);
+	if (VertexShaderID == 0)
+	{
 		return 0;
 	}
 
-	// Link the program
-	printf("Linking program\n");
+	// The captured outputs have to be declared before linking
+	printf("Linking transform feedback program\n");
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
+	glTransformFeedbackVaryings(ProgramID, varyingCount, varyings, GL_INTERLEAVED_ATTRIBS);
+	ProgramID = linkProgram(ProgramID);
 
-	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	if (!Result) {
-		printf("Error linking program\n");
-		glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-		if (InfoLogLength > 0)
-		{
-			std::vector<char> ProgramErrorMessage(InfoLogLength + 1);
-			glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-			printf("%s\n", &ProgramErrorMessage[0]);
-		}
-		return 0;
+	if (ProgramID != 0)
+	{
+		glDetachShader(ProgramID, VertexShaderID);
 	}
-
-	glDetachShader(ProgramID, VertexShaderID);
-	glDetachShader(ProgramID, FragmentShaderID);
-
 	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
 
 	return ProgramID;
 }
@@ -4,10 +4,16 @@
 #include <glad/gl.h>
 #include <string>
 
-GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path);
+// fragment_include_path, when given, names a file of shared GLSL that is
+// inserted right after the #version line of the fragment shader
+GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path,
+                           const char *fragment_include_path = nullptr);
 
 GLuint LoadShadersFromString(std::string VertexShaderCode, std::string FragmentShaderCode);
 
+// Vertex-only program whose outputs are captured interleaved with transform feedback
+GLuint LoadTransformFeedbackShaderFromFile(const char *vertex_file_path, const char *const *varyings, int varyingCount);
+
 
 
 #endif
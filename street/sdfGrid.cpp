@@ -0,0 +1,130 @@
+#include "sdfGrid.h"
+#include "jobSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+void SignedDistanceGrid::addBox(glm::vec3 center, glm::vec3 halfExtent) {
+    boxes.push_back({center, halfExtent});
+}
+
+void SignedDistanceGrid::setGround(float height) {
+    hasGround = true;
+    groundHeight = height;
+}
+
+static float boxDistance(glm::vec3 p, glm::vec3 center, glm::vec3 halfExtent) {
+    glm::vec3 q = glm::abs(p - center) - halfExtent;
+    float outside = glm::length(glm::max(q, glm::vec3(0.0f)));
+    float inside = std::min(std::max(q.x, std::max(q.y, q.z)), 0.0f);
+    return outside + inside;
+}
+
+void SignedDistanceGrid::build(glm::vec3 boundsMin, glm::vec3 boundsMax, float cellSize, float bandWidth) {
+    auto startTime = std::chrono::high_resolution_clock::now();
+    this->boundsMin = boundsMin;
+    this->cellSize = cellSize;
+    band = bandWidth;
+    dims = glm::ivec3(glm::ceil((boundsMax - boundsMin) / cellSize)) + 1;
+    cells.assign(dims.x * dims.y * dims.z, glm::vec4(0.0f, 0.0f, 0.0f, band));
+
+    // Distances: every box only touches the grid points inside its bounds grown by the band.
+    // Work is split by z slices so no two threads write the same point.
+    parallelFor(dims.z, 4, [&](int zBegin, int zEnd) {
+        for (int z = zBegin; z < zEnd; ++z) {
+            for (const Box &box: boxes) {
+                glm::vec3 lo = (box.center - box.halfExtent - band - boundsMin) / cellSize;
+                glm::vec3 hi = (box.center + box.halfExtent + band - boundsMin) / cellSize;
+                if (z < static_cast<int>(std::floor(lo.z)) || z > static_cast<int>(std::ceil(hi.z))) {
+                    continue;
+                }
+                int x0 = std::max(0, static_cast<int>(std::floor(lo.x)));
+                int x1 = std::min(dims.x - 1, static_cast<int>(std::ceil(hi.x)));
+                int y0 = std::max(0, static_cast<int>(std::floor(lo.y)));
+                int y1 = std::min(dims.y - 1, static_cast<int>(std::ceil(hi.y)));
+                for (int y = y0; y <= y1; ++y) {
+                    for (int x = x0; x <= x1; ++x) {
+                        glm::vec3 p = boundsMin + glm::vec3(x, y, z) * cellSize;
+                        float &d = cell(x, y, z).w;
+                        d = std::min(d, boxDistance(p, box.center, box.halfExtent));
+                    }
+                }
+            }
+            if (hasGround) {
+                for (int y = 0; y < dims.y; ++y) {
+                    float d = boundsMin.y + y * cellSize - groundHeight;
+                    for (int x = 0; x < dims.x; ++x) {
+                        cell(x, y, z).w = std::min(cell(x, y, z).w, d);
+                    }
+                }
+            }
+        }
+    });
+
+    // Gradients by central differences, one sided at the border
+    parallelFor(dims.z, 4, [&](int zBegin, int zEnd) {
+        for (int z = zBegin; z < zEnd; ++z) {
+            for (int y = 0; y < dims.y; ++y) {
+                for (int x = 0; x < dims.x; ++x) {
+                    glm::vec3 gradient(
+                            cell(std::min(x + 1, dims.x - 1), y, z).w - cell(std::max(x - 1, 0), y, z).w,
+                            cell(x, std::min(y + 1, dims.y - 1), z).w - cell(x, std::max(y - 1, 0), z).w,
+                            cell(x, y, std::min(z + 1, dims.z - 1)).w - cell(x, y, std::max(z - 1, 0)).w);
+                    float length = glm::length(gradient);
+                    glm::vec4 &c = cell(x, y, z);
+                    c = glm::vec4(length > 1e-6f ? gradient / length : glm::vec3(0.0f), c.w);
+                }
+            }
+        }
+    });
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    std::cout << "Built signed distance grid: " << dims.x << "x" << dims.y << "x" << dims.z << " from "
+              << boxes.size() << " boxes, "
+              << std::chrono::duration<double, std::milli>(endTime - startTime).count() << " ms" << std::endl;
+}
+
+glm::vec4 SignedDistanceGrid::sample(glm::vec3 position) const {
+    glm::vec3 g = (position - boundsMin) / cellSize;
+    if (g.x < 0.0f || g.y < 0.0f || g.z < 0.0f ||
+        g.x >= dims.x - 1 || g.y >= dims.y - 1 || g.z >= dims.z - 1) {
+        return glm::vec4(0.0f, 0.0f, 0.0f, band);
+    }
+
+    // Trilinear interpolation of the eight surrounding grid points
+    glm::ivec3 i = glm::ivec3(g);
+    glm::vec3 f = g - glm::vec3(i);
+    glm::vec4 c00 = glm::mix(cell(i.x, i.y, i.z), cell(i.x + 1, i.y, i.z), f.x);
+    glm::vec4 c10 = glm::mix(cell(i.x, i.y + 1, i.z), cell(i.x + 1, i.y + 1, i.z), f.x);
+    glm::vec4 c01 = glm::mix(cell(i.x, i.y, i.z + 1), cell(i.x + 1, i.y, i.z + 1), f.x);
+    glm::vec4 c11 = glm::mix(cell(i.x, i.y + 1, i.z + 1), cell(i.x + 1, i.y + 1, i.z + 1), f.x);
+    return glm::mix(glm::mix(c00, c10, f.y), glm::mix(c01, c11, f.y), f.z);
+}
+
+bool SignedDistanceGrid::collide(glm::vec3 &position, float radius) const {
+    glm::vec4 s = sample(position);
+    if (s.w >= radius) {
+        return false;
+    }
+    float length = glm::length(glm::vec3(s));
+    if (length > 1e-6f) {
+        position += glm::vec3(s) / length * (radius - s.w);
+    }
+    return true;
+}
+
+GLuint SignedDistanceGrid::createTexture() const {
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_3D, textureID);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, dims.x, dims.y, dims.z, 0, GL_RGBA, GL_FLOAT, cells.data());
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    return textureID;
+}
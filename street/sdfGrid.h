@@ -0,0 +1,48 @@
+#ifndef SDFGRID_H
+#define SDFGRID_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Coarse signed distance field of the static city, baked at startup from the
+// building boxes and the ground plane. Every grid point stores the normalized
+// gradient next to the distance, so a particle needs one trilinear sample per
+// step however many buildings there are. Distances are exact inside a band
+// around the geometry and clamped to the band width further out.
+class SignedDistanceGrid {
+public:
+    // Boxes span center - halfExtent to center + halfExtent, like Building
+    void addBox(glm::vec3 center, glm::vec3 halfExtent);
+    void setGround(float height);
+    void build(glm::vec3 boundsMin, glm::vec3 boundsMax, float cellSize, float bandWidth);
+    // Gradient in xyz and distance in w, (0, 0, 0, bandWidth) outside the grid
+    glm::vec4 sample(glm::vec3 position) const;
+    // Pushes a sphere of the given radius out of the geometry, returns true on contact
+    bool collide(glm::vec3 &position, float radius) const;
+
+    // RGBA16F 3D texture with the same layout as the CPU grid
+    GLuint createTexture() const;
+    glm::vec3 origin() const { return boundsMin; }
+    glm::vec3 extent() const { return glm::vec3(dims - 1) * cellSize; }
+
+private:
+    struct Box {
+        glm::vec3 center, halfExtent;
+    };
+
+    std::vector<Box> boxes;
+    bool hasGround = false;
+    float groundHeight = 0.0f;
+
+    glm::vec3 boundsMin;
+    glm::ivec3 dims = glm::ivec3(0);
+    float cellSize = 1.0f;
+    float band = 0.0f;
+    std::vector<glm::vec4> cells;
+
+    glm::vec4 &cell(int x, int y, int z) { return cells[(z * dims.y + y) * dims.x + x]; }
+    const glm::vec4 &cell(int x, int y, int z) const { return cells[(z * dims.y + y) * dims.x + x]; }
+};
+
+#endif // SDFGRID_H
@@ -1,15 +1,14 @@
 #version 330 core
 
-// Input UV from the vertex shader
-in vec2 uv;
+// Input view direction from the vertex shader
+in vec3 direction;
 
-uniform sampler2D textureSampler;
+uniform samplerCube skyboxSampler;
 
 // Output final color
 out vec3 finalColor;
 
 void main()
 {
-    // Use only the texture color
-    finalColor = texture(textureSampler, uv).rgb;
-}
\ No newline at end of file
+    finalColor = texture(skyboxSampler, direction).rgb;
+}
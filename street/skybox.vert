@@ -1,24 +1,19 @@
 #version 330 core
 
-// Input
-layout(location = 0) in vec3 vertexPosition;
-layout(location = 1) in vec3 vertexColor;
-layout(location = 2) in vec2 vertexUV;
-
 // Output data, to be interpolated for each fragment
-out vec3 color;
-out vec2 uv;
+out vec3 direction;
 
-// Matrix for vertex transformation
-uniform mat4 MVP;
+// Inverse of projection * view without translation
+uniform mat4 inverseVP;
 
 void main() {
-    // Transform vertex
-    gl_Position =  MVP * vec4(vertexPosition, 1);
+    // Fullscreen triangle from the vertex ID: (-1,-1), (3,-1), (-1,3)
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
 
-    // Pass vertex color to the fragment shader
-    color = vertexColor;
+    // z = w puts the sky exactly on the far plane
+    gl_Position = vec4(position, 1.0, 1.0);
 
-    // TODO: Pass UV to the fragment shader
-    uv = vertexUV;
-}
\ No newline at end of file
+    // World space view direction through this vertex
+    vec4 farPoint = inverseVP * vec4(position, 1.0, 1.0);
+    direction = farPoint.xyz / farPoint.w;
+}
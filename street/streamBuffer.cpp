@@ -0,0 +1,135 @@
+#include "streamBuffer.h"
+
+#include <GLFW/glfw3.h>
+#include <cstring>
+#include <iostream>
+
+// ARB_buffer_storage is core in GL 4.4 and not part of the 3.3 loader
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+typedef void (GLAD_API_PTR *BufferStorageFunction)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+static BufferStorageFunction bufferStorage = nullptr;
+
+bool StreamBuffer::persistentMapping = false;
+int StreamBuffer::allStalls = 0;
+
+void StreamBuffer::loadExtensions() {
+    if (glfwExtensionSupported("GL_ARB_buffer_storage")) {
+        bufferStorage = reinterpret_cast<BufferStorageFunction>(glfwGetProcAddress("glBufferStorage"));
+    }
+    persistentMapping = bufferStorage != nullptr;
+    std::cout << "Stream buffers: " << (persistentMapping ? "persistent mapping" : "unsynchronized mapping")
+              << std::endl;
+}
+
+void StreamBuffer::initialize(size_t regionSize) {
+    glGenBuffers(REGION_COUNT, bufferIDs);
+    for (int i = 0; i < REGION_COUNT; ++i) {
+        allocateRegion(i, regionSize);
+    }
+    currentRegion = 0;
+    written = false;
+}
+
+void StreamBuffer::allocateRegion(int region, size_t size) {
+    size = size > 0 ? size : 16;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bufferIDs[region]);
+    if (persistentMapping) {
+        // Immutable storage can not be resized, growing needs a new buffer object
+        if (persistentPointers[region]) {
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glDeleteBuffers(1, &bufferIDs[region]);
+            glGenBuffers(1, &bufferIDs[region]);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, bufferIDs[region]);
+        }
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        bufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+        persistentPointers[region] = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+    } else {
+        glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    regionSizes[region] = size;
+}
+
+void *StreamBuffer::map(size_t size) {
+    // Everything that read the last region has been submitted by now
+    if (written) {
+        fences[currentRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        currentRegion = (currentRegion + 1) % REGION_COUNT;
+    }
+    written = true;
+    maps++;
+
+    GLsync &fence = fences[currentRegion];
+    if (fence) {
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            stalls++;
+            allStalls++;
+            while (status == GL_TIMEOUT_EXPIRED) {
+                status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            }
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    if (size > regionSizes[currentRegion]) {
+        allocateRegion(currentRegion, size + size / 2);
+    }
+    if (persistentMapping) {
+        return persistentPointers[currentRegion];
+    }
+    if (size == 0) {
+        return nullptr;
+    }
+
+    // The fence already guarantees the GPU is done with this region
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bufferIDs[currentRegion]);
+    void *pointer = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                                                                    GL_MAP_UNSYNCHRONIZED_BIT);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    mapped = pointer != nullptr;
+    return pointer;
+}
+
+void StreamBuffer::unmap() {
+    if (!mapped) {
+        return;
+    }
+    mapped = false;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bufferIDs[currentRegion]);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void StreamBuffer::write(const void *data, size_t size) {
+    void *pointer = map(size);
+    if (pointer && size > 0) {
+        memcpy(pointer, data, size);
+    }
+    unmap();
+}
+
+void StreamBuffer::cleanup() {
+    for (int i = 0; i < REGION_COUNT; ++i) {
+        if (fences[i]) {
+            glDeleteSync(fences[i]);
+            fences[i] = nullptr;
+        }
+        if (persistentPointers[i]) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, bufferIDs[i]);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            persistentPointers[i] = nullptr;
+        }
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(REGION_COUNT, bufferIDs);
+    for (int i = 0; i < REGION_COUNT; ++i) {
+        bufferIDs[i] = 0;
+    }
+}
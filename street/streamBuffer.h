@@ -0,0 +1,55 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <glad/gl.h>
+#include <cstddef>
+
+// Ring of buffer regions for data that is rewritten every frame. Mapping the
+// next region fences the one written before it, so the CPU only waits when the
+// GPU is still REGION_COUNT frames behind, and every wait is counted as a stall.
+// Uses persistently mapped ARB_buffer_storage buffers when the driver has them,
+// unsynchronized glMapBufferRange otherwise.
+//
+// Each region is its own buffer object: GL 3.3 has no glTexBufferRange, so a
+// texture buffer can only look at the start of a buffer.
+class StreamBuffer {
+public:
+    static const int REGION_COUNT = 3;
+
+    // Call once after the GL context exists, before the first initialize
+    static void loadExtensions();
+
+    void initialize(size_t regionSize);
+    // Waits for the next region and returns it for writing, grows it if size does not fit
+    void *map(size_t size);
+    void unmap();
+    // Convenience for map, memcpy, unmap
+    void write(const void *data, size_t size);
+    void cleanup();
+
+    // Buffer of the region written last, valid until the next map
+    GLuint buffer() const { return bufferIDs[currentRegion]; }
+    int stallCount() const { return stalls; }
+    int mapCount() const { return maps; }
+    static bool isPersistent() { return persistentMapping; }
+    // Stalls of every stream buffer since startup
+    static int totalStalls() { return allStalls; }
+
+private:
+    GLuint bufferIDs[REGION_COUNT] = {0, 0, 0};
+    GLsync fences[REGION_COUNT] = {nullptr, nullptr, nullptr};
+    size_t regionSizes[REGION_COUNT] = {0, 0, 0};
+    void *persistentPointers[REGION_COUNT] = {nullptr, nullptr, nullptr};
+    int currentRegion = 0;
+    bool written = false;
+    bool mapped = false;
+    int stalls = 0;
+    int maps = 0;
+
+    static bool persistentMapping;
+    static int allStalls;
+
+    void allocateRegion(int region, size_t size);
+};
+
+#endif // STREAMBUFFER_H
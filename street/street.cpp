@@ -16,11 +16,21 @@
 #include <math.h>
 
 #include "particle.h"
+#include "particleManager.h"
+#include "sdfGrid.h"
+#include "flock.h"
+#include "streamBuffer.h"
+#include "jobSystem.h"
 #include "sand.h"
 #include "bot.h"
+#include "botCrowd.h"
 #include "Floor.h"
 #include "lightInfo.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "lightCluster.h"
+#include "overdraw.h"
+#include "dynamicResolution.h"
+#include "aoBaker.h"
+#include "vertexQuantization.h"
 #include <stb/stb_image_write.h>
 
 static GLFWwindow *window;
@@ -59,6 +69,11 @@ static glm::vec3 lightLookAt(0.0f, 0.0f, 0.0f); // Where the light is pointing
 static glm::vec3 lightDirection; // Computed in each frame
 Light sunLightInfo(lightDirection, lightPosition, lightColor, lightLookAt, lightIntensity);
 
+// Street lamps and neon signs, shaded through the light clusters
+static std::vector<PointLight> pointLights;
+static LightClusters lightClusters;
+static const int MAX_POINT_LIGHTS = 1024;
+
 static float depthFoV = 90.0f;
 static float depthNear = 90.0f;
 static float depthFar = 1000.0f;
@@ -69,6 +84,46 @@ const unsigned int SHADOW_WIDTH = 4096, SHADOW_HEIGHT = 4096;
 GLuint depthMapFBO;
 GLuint depthMap;
 
+// Depth pre-pass control, cycled with P. Auto turns the pre-pass on when
+// the measured overdraw is high. O shows the overdraw of the opaque pass.
+enum DepthPrepassMode { PREPASS_AUTO, PREPASS_ON, PREPASS_OFF };
+static DepthPrepassMode depthPrepassMode = PREPASS_AUTO;
+static bool showOverdraw = false;
+
+// Dynamic resolution of the 3D passes, toggled with R
+static DynamicResolution dynamicResolution;
+static const float TARGET_FRAME_MS = 16.6f;
+
+// Baked ambient occlusion atlas shared by the buildings, the floor and the sand
+static GLuint aoTextureID = 0;
+static glm::vec4 sandAOTile(0.0f);
+
+// Shared pool of the CPU simulated particles
+static const int PARTICLE_POOL_SIZE = 4096;
+
+// Snow over the whole city, simulated on the GPU, toggled with N
+static bool showSnow = false;
+static const int SNOW_PARTICLES = 1000000;
+
+// Flock of birds over the rooftops, toggled with B
+static bool showFlock = false;
+static const int FLOCK_BIRDS = 20000;
+
+// Instanced crowd of bots, K cycles through the sizes, J switches every bot to baked playback
+// on the GPU, L toggles the animation LOD and M the mesh LOD
+static const int CROWD_SIZES[] = {0, 1000, 10000};
+static int crowdSizeIndex = 0;
+static bool crowdBaked = false;
+static bool crowdLod = true;
+static bool crowdMeshLod = true;
+// Bot and crowd vertices from the packed 24 byte format or as loaded, toggled with V
+// to compare the GPU frame time
+static bool packedBotVertices = true;
+
+// Particles collide with the buildings through a baked distance grid, toggled with C
+static bool particleCollision = true;
+static const float PARTICLE_RADIUS = 4.0f;
+
 static bool playAnimation = true;
 static float playbackSpeed = 2.0f;
 
@@ -122,270 +177,99 @@ static void saveDepthTexture(GLuint fbo, std::string filename) {
 bool saveDepthMap = false;
 
 
-struct Skybox {
-    glm::vec3 position; // Position of the box
-    glm::vec3 scale; // Size of the box in each axis
-
-    GLfloat vertex_buffer_data[72] = {
-        // Vertex definition for a canonical box
-        // Front face
-        -1.0f, -1.0f, 1.0f,
-        1.0f, -1.0f, 1.0f,
-        1.0f, 1.0f, 1.0f,
-        -1.0f, 1.0f, 1.0f,
-
-        // Back face
-        1.0f, -1.0f, -1.0f,
-        -1.0f, -1.0f, -1.0f,
-        -1.0f, 1.0f, -1.0f,
-        1.0f, 1.0f, -1.0f,
-
-        // Left face
-        -1.0f, -1.0f, -1.0f,
-        -1.0f, -1.0f, 1.0f,
-        -1.0f, 1.0f, 1.0f,
-        -1.0f, 1.0f, -1.0f,
-
-        // Right face
-        1.0f, -1.0f, 1.0f,
-        1.0f, -1.0f, -1.0f,
-        1.0f, 1.0f, -1.0f,
-        1.0f, 1.0f, 1.0f,
-
-        // Top face
-        -1.0f, 1.0f, 1.0f,
-        1.0f, 1.0f, 1.0f,
-        1.0f, 1.0f, -1.0f,
-        -1.0f, 1.0f, -1.0f,
-
-        // Bottom face
-        -1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f, 1.0f,
-        -1.0f, -1.0f, 1.0f,
-    };
-
-    GLfloat color_buffer_data[72] = {
-        // Front, red
-        1.0f, 0.0f, 0.0f,
-        1.0f, 0.0f, 0.0f,
-        1.0f, 0.0f, 0.0f,
-        1.0f, 0.0f, 0.0f,
-
-        // Back, yellow
-        1.0f, 1.0f, 0.0f,
-        1.0f, 1.0f, 0.0f,
-        1.0f, 1.0f, 0.0f,
-        1.0f, 1.0f, 0.0f,
-
-        // Left, green
-        0.0f, 1.0f, 0.0f,
-        0.0f, 1.0f, 0.0f,
-        0.0f, 1.0f, 0.0f,
-        0.0f, 1.0f, 0.0f,
-
-        // Right, cyan
-        0.0f, 1.0f, 1.0f,
-        0.0f, 1.0f, 1.0f,
-        0.0f, 1.0f, 1.0f,
-        0.0f, 1.0f, 1.0f,
-
-        // Top, blue
-        0.0f, 0.0f, 1.0f,
-        0.0f, 0.0f, 1.0f,
-        0.0f, 0.0f, 1.0f,
-        0.0f, 0.0f, 1.0f,
-
-        // Bottom, magenta
-        1.0f, 0.0f, 1.0f,
-        1.0f, 0.0f, 1.0f,
-        1.0f, 0.0f, 1.0f,
-        1.0f, 0.0f, 1.0f,
-    };
-
-    GLuint index_buffer_data[36] = {
-        // 12 triangle faces of a box
-        0, 3, 2,
-        0, 2, 1,
-
-        4, 7, 6,
-        4, 6, 5,
-
-        8, 11, 10,
-        8, 10, 9,
-
-        12, 15, 14,
-        12, 14, 13,
-
-        16, 19, 18,
-        16, 18, 17,
-
-        20, 23, 22,
-        20, 22, 21,
-    };
-
-    // TODO: Define UV buffer data
-    // ---------------------------
-    // ---------------------------
-
-    GLfloat uv_buffer_data[48] = {
-        // Front face (positive Z)
-        0.5f, 0.666f, // Top right
-        0.25f, 0.666f, // Top left
-        0.25f, 0.333f, // Bottom left
-        0.5f, 0.333f, // Bottom right
-
-        // Back face (negative Z)
-        1.0f, 0.666f, // Top right
-        0.75f, 0.666f, // Top left
-        0.75f, 0.333f, // Bottom left
-        1.0f, 0.333f, // Bottom right
-
-
-        0.75f, 0.666f, // Top left
-        0.5f, 0.666f, // Top right
-        0.5f, 0.333f, // Bottom right
-        0.75f, 0.333f, // Bottom left
-
-        // Left face (negative X) - Correct
-        0.25f, 0.666f, // Top right
-        0.0f, 0.666f, // Top left
-        0.0f, 0.333f, // Bottom left
-        0.25f, 0.333f, // Bottom right
-
-        // Right face (positive X) - Correct
-
-        0.5f, 0.333f,
-        0.25f, 0.333f, // Top left
-        // Top right
-        0.25f, 0.0f,
-        0.5f, 0.0f, // Bottom right
-        // Bottom left
-
-        // Bottom face (negative Y) - Now using the previous Top UV coordinates
-        0.5f, 1.0f,
-        0.25f, 1.0f, // Top left
-        // Top right
-        0.25f, 0.666f,
-        0.5f, 0.666f, // Bottom right
-        // Bottom left
-
-    };
+// Atlas UV of a point on the unit cube, matching the face layout of sky.png
+// (a 4x3 cross) as it was mapped onto the old 24 vertex sky box
+static glm::vec2 skyAtlasUV(glm::vec3 p) {
+    glm::vec3 a = glm::abs(p);
+    glm::vec3 t = (p + 1.0f) * 0.5f; // Face coordinates in [0, 1]
+    if (a.x >= a.y && a.x >= a.z) {
+        if (p.x > 0.0f) return glm::vec2(glm::mix(0.0f, 0.25f, t.z), glm::mix(0.666f, 0.333f, t.y));
+        return glm::vec2(glm::mix(0.75f, 0.5f, t.z), glm::mix(0.666f, 0.333f, t.y));
+    }
+    if (a.y >= a.z) {
+        if (p.y > 0.0f) return glm::vec2(glm::mix(0.5f, 0.25f, t.x), glm::mix(0.0f, 0.333f, t.z));
+        return glm::vec2(glm::mix(0.5f, 0.25f, t.x), glm::mix(1.0f, 0.666f, t.z));
+    }
+    if (p.z > 0.0f) return glm::vec2(glm::mix(0.5f, 0.25f, t.x), glm::mix(0.666f, 0.333f, t.y));
+    return glm::vec2(glm::mix(0.75f, 1.0f, t.x), glm::mix(0.666f, 0.333f, t.y));
+}
 
-    GLfloat normal_buffer_data[72] = {
-        // Front face
-        0.0f, 0.0f, 1.0f,
-        0.0f, 0.0f, 1.0f,
-        0.0f, 0.0f, 1.0f,
-        0.0f, 0.0f, 1.0f,
+// Loads the sky atlas and resamples it once into the six faces of a cube map
+static GLuint LoadCubemapFromAtlas(const char *texture_file_path) {
+    int w, h, channels;
+    stbi_set_flip_vertically_on_load(false);
+    uint8_t *img = stbi_load(texture_file_path, &w, &h, &channels, 3);
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
 
-        // Back face
-        0.0f, 0.0f, -1.0f,
-        0.0f, 0.0f, -1.0f,
-        0.0f, 0.0f, -1.0f,
-        0.0f, 0.0f, -1.0f,
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-        // Left face
-        -1.0f, 0.0f, 0.0f,
-        -1.0f, 0.0f, 0.0f,
-        -1.0f, 0.0f, 0.0f,
-        -1.0f, 0.0f, 0.0f,
+    if (!img) {
+        std::cout << "Failed to load texture " << texture_file_path << std::endl;
+        return texture;
+    }
 
-        // Right face
-        1.0f, 0.0f, 0.0f,
-        1.0f, 0.0f, 0.0f,
-        1.0f, 0.0f, 0.0f,
-        1.0f, 0.0f, 0.0f,
+    int faceSize = w / 4;
+    std::vector<uint8_t> face(faceSize * faceSize * 3);
+    for (int f = 0; f < 6; ++f) {
+        for (int j = 0; j < faceSize; ++j) {
+            for (int i = 0; i < faceSize; ++i) {
+                // Direction of this texel following the GL cube map face convention
+                float sc = 2.0f * (i + 0.5f) / faceSize - 1.0f;
+                float tc = 2.0f * (j + 0.5f) / faceSize - 1.0f;
+                glm::vec3 dir;
+                switch (GL_TEXTURE_CUBE_MAP_POSITIVE_X + f) {
+                    case GL_TEXTURE_CUBE_MAP_POSITIVE_X: dir = glm::vec3(1.0f, -tc, -sc); break;
+                    case GL_TEXTURE_CUBE_MAP_NEGATIVE_X: dir = glm::vec3(-1.0f, -tc, sc); break;
+                    case GL_TEXTURE_CUBE_MAP_POSITIVE_Y: dir = glm::vec3(sc, 1.0f, tc); break;
+                    case GL_TEXTURE_CUBE_MAP_NEGATIVE_Y: dir = glm::vec3(sc, -1.0f, -tc); break;
+                    case GL_TEXTURE_CUBE_MAP_POSITIVE_Z: dir = glm::vec3(sc, -tc, 1.0f); break;
+                    default: dir = glm::vec3(-sc, -tc, -1.0f); break;
+                }
 
-        // Top face
-        0.0f, 1.0f, 0.0f,
-        0.0f, 1.0f, 0.0f,
-        0.0f, 1.0f, 0.0f,
-        0.0f, 1.0f, 0.0f,
+                // Bilinear sample of the atlas
+                glm::vec2 uv = skyAtlasUV(dir);
+                float x = glm::clamp(uv.x * w - 0.5f, 0.0f, w - 1.0f);
+                float y = glm::clamp(uv.y * h - 0.5f, 0.0f, h - 1.0f);
+                int x0 = static_cast<int>(x), y0 = static_cast<int>(y);
+                int x1 = std::min(x0 + 1, w - 1), y1 = std::min(y0 + 1, h - 1);
+                float fx = x - x0, fy = y - y0;
+                for (int c = 0; c < 3; ++c) {
+                    float top = glm::mix(img[(y0 * w + x0) * 3 + c], img[(y0 * w + x1) * 3 + c], fx);
+                    float bottom = glm::mix(img[(y1 * w + x0) * 3 + c], img[(y1 * w + x1) * 3 + c], fx);
+                    face[(j * faceSize + i) * 3 + c] = static_cast<uint8_t>(glm::mix(top, bottom, fy) + 0.5f);
+                }
+            }
+        }
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, GL_RGB, faceSize, faceSize, 0, GL_RGB,
+                     GL_UNSIGNED_BYTE, face.data());
+    }
+    stbi_image_free(img);
 
-        // Bottom face
-        0.0f, -1.0f, 0.0f,
-        0.0f, -1.0f, 0.0f,
-        0.0f, -1.0f, 0.0f,
-        0.0f, -1.0f, 0.0f
-    };
+    return texture;
+}
 
 
+// Sky drawn last as a single fullscreen triangle on the far plane, so only
+// the pixels the city leaves uncovered are shaded
+struct Skybox {
     // OpenGL buffers
     GLuint vertexArrayID;
-    GLuint vertexBufferID;
-    GLuint indexBufferID;
-    GLuint colorBufferID;
-    GLuint uvBufferID;
     GLuint textureID;
 
-    //Ligthing
-    GLuint normalBufferID;
-    GLuint shadowFBO;
-    GLuint depthTexture;
-    GLuint lightSpaceMatrixID;
-    GLuint lightPositionID;
-    GLuint lightIntensityID;
-
     // Shader variable IDs
-    GLuint mvpMatrixID;
+    GLuint inverseVPMatrixID;
     GLuint textureSamplerID;
     GLuint programID;
 
-    void initialize(glm::vec3 position, glm::vec3 scale, const char *texturePath) {
-        // Define scale of the building geometry
-        this->position = position;
-        this->scale = scale;
-
-        // Create a vertex array object
+    void initialize(const char *texturePath) {
+        // The triangle is generated from gl_VertexID, the VAO is empty
         glGenVertexArrays(1, &vertexArrayID);
-        glBindVertexArray(vertexArrayID);
-
-
-        // Add shadow mapping setup
-        glGenFramebuffers(1, &shadowFBO);
-        glBindFramebuffer(GL_FRAMEBUFFER, shadowFBO);
-        glGenTextures(1, &depthTexture);
-        glBindTexture(GL_TEXTURE_2D, depthTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, 1024, 1024, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
-        glDrawBuffer(GL_NONE);
-        glReadBuffer(GL_NONE);
-
-
-        // Create a vertex buffer object to store the vertex data
-        glGenBuffers(1, &vertexBufferID);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
-
-
-        // Create normal buffer
-        glGenBuffers(1, &normalBufferID);
-        glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(normal_buffer_data), normal_buffer_data, GL_STATIC_DRAW);
-
-
-        // Create a vertex buffer object to store the color data
-        // TODO:
-        glGenBuffers(1, &colorBufferID);
-        glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(color_buffer_data), color_buffer_data, GL_STATIC_DRAW);
-
-        // TODO: Create a vertex buffer object to store the UV data
-        // --------------------------------------------------------
-        // --------------------------------------------------------
-        glGenBuffers(1, &uvBufferID);
-        glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(uv_buffer_data), uv_buffer_data, GL_STATIC_DRAW);
-
-        // Create an index buffer object to store the index data that defines triangle faces
-        glGenBuffers(1, &indexBufferID);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
 
         // Create and compile our GLSL program from the shaders
         programID = LoadShadersFromFile("../street/skybox.vert", "../street/skybox.frag");
@@ -393,83 +277,42 @@ struct Skybox {
             std::cerr << "Failed to load shaders." << std::endl;
         }
 
-        // Get a handle for our "MVP" uniform
-        mvpMatrixID = glGetUniformLocation(programID, "MVP");
-        lightPositionID = glGetUniformLocation(programID, "lightPosition");
-        lightIntensityID = glGetUniformLocation(programID, "lightIntensity");
-        lightSpaceMatrixID = glGetUniformLocation(programID, "lightSpaceMatrix");
+        inverseVPMatrixID = glGetUniformLocation(programID, "inverseVP");
+        textureSamplerID = glGetUniformLocation(programID, "skyboxSampler");
 
-        // TODO: Load a texture
-        textureID = LoadTextureTileBox(texturePath);
-
-
-        // TODO: Get a handle to texture sampler
-        textureSamplerID = glGetUniformLocation(programID, "textureSampler");
+        glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+        textureID = LoadCubemapFromAtlas(texturePath);
     }
 
+    // cameraMatrix is projection * view with the translation removed
     void render(glm::mat4 cameraMatrix) {
         glUseProgram(programID);
 
-        // Original texture
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
         glUniform1i(textureSamplerID, 0);
 
-        // Vertex attributes
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        glm::mat4 inverseVP = glm::inverse(cameraMatrix);
+        glUniformMatrix4fv(inverseVPMatrixID, 1, GL_FALSE, &inverseVP[0][0]);
 
-        glEnableVertexAttribArray(1);
-        glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        // Depth of the triangle is exactly 1.0, so it only passes where the
+        // cleared depth was never overwritten
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
 
-        glEnableVertexAttribArray(2);
-        glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glEnableVertexAttribArray(3);
-        glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-
-        // Model transform
-        glm::mat4 modelMatrix = glm::mat4();
-        modelMatrix = glm::scale(modelMatrix, scale);
-
-        // Set uniforms
-        glm::mat4 mvp = cameraMatrix * modelMatrix;
-        glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
-
-
-        // Draw
-        glDrawElements(
-            GL_TRIANGLES,
-            36,
-            GL_UNSIGNED_INT,
-            (void *) 0
-        );
+        glBindVertexArray(vertexArrayID);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
 
-        // Cleanup
-        glDisableVertexAttribArray(0);
-        glDisableVertexAttribArray(1);
-        glDisableVertexAttribArray(2);
-        glDisableVertexAttribArray(3);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
     }
 
 
     void cleanup() {
-        glDeleteBuffers(1, &vertexBufferID);
-        glDeleteBuffers(1, &colorBufferID);
-        glDeleteBuffers(1, &indexBufferID);
         glDeleteVertexArrays(1, &vertexArrayID);
-        glDeleteBuffers(1, &uvBufferID);
         glDeleteTextures(1, &textureID);
         glDeleteProgram(programID);
-        glDeleteBuffers(1, &normalBufferID);
-        glDeleteFramebuffers(1, &shadowFBO);
-        glDeleteTextures(1, &depthTexture);
     }
 };
 
@@ -663,6 +506,12 @@ struct Building {
     // Shader variable IDs for shadow mapping
     GLuint lightSpaceMatrixID;
     GLuint shadowMapID;
+    // Baked ambient occlusion
+    GLuint aoUVBufferID = 0;
+    GLuint aoTextureID = 0;
+    GLuint aoMapID;
+    // Positions are uploaded as UNORM16 in the box bounds, this maps them back
+    glm::mat4 positionDequantize = glm::mat4(1.0f);
 
     void initialize(glm::vec3 position, glm::vec3 scale, const char *textureFilePath) {
         // Define scale of the building geometry
@@ -673,32 +522,50 @@ struct Building {
         glGenVertexArrays(1, &vertexArrayID);
         glBindVertexArray(vertexArrayID);
 
+        // Packed vertices: UNORM16 positions, 2_10_10_10 normals and half float UVs
+        PositionQuantization quantization = PositionQuantization::fromBounds(glm::vec3(-1.0f), glm::vec3(1.0f));
+        positionDequantize = quantization.dequantize();
+        uint16_t packed_vertex_data[96];
+        GLuint packed_normal_data[24];
+        for (int i = 0; i < 24; ++i) {
+            quantization.encode(glm::make_vec3(&vertex_buffer_data[3 * i]), &packed_vertex_data[4 * i]);
+            glm::vec3 normal = glm::make_vec3(&normal_buffer_data[3 * i]);
+            packed_normal_data[i] = glm::packSnorm3x10_1x2(glm::vec4(normal, 0.0f));
+        }
+
         // Create a vertex buffer object to store the vertex data
         glGenBuffers(1, &vertexBufferID);
         glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(packed_vertex_data), packed_vertex_data, GL_STATIC_DRAW);
 
 
         glGenBuffers(1, &normalBufferID);
         glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(normal_buffer_data), normal_buffer_data, GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(packed_normal_data), packed_normal_data, GL_STATIC_DRAW);
 
 
         for (int i = 0; i < 24; ++i) uv_buffer_data[2 * i + 1] *= 5;
 
+        uint16_t packed_uv_data[48];
+        for (int i = 0; i < 48; ++i) {
+            packed_uv_data[i] = glm::packHalf1x16(uv_buffer_data[i]);
+        }
 
         glGenBuffers(1, &uvBufferID);
         glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(uv_buffer_data), uv_buffer_data,
+        glBufferData(GL_ARRAY_BUFFER, sizeof(packed_uv_data), packed_uv_data,
                      GL_STATIC_DRAW);
 
+        // Float position, normal, UV and AO UV against the packed 8 + 4 + 4 + 4 bytes
+        VertexFormatStats::add(24, 40, 20);
+
         // Create an index buffer object to store the index data that defines triangle faces
         glGenBuffers(1, &indexBufferID);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
 
         // Create and compile our GLSL program from the shaders
-        programID = LoadShadersFromFile("../street/box.vert", "../street/box.frag");
+        programID = LoadShadersFromFile("../street/box.vert", "../street/box.frag", "../street/clusterLighting.glsl");
         if (programID == 0) {
             std::cerr << "Failed to load shaders." << std::endl;
         }
@@ -717,14 +584,36 @@ struct Building {
         // After loading the shader program
         lightSpaceMatrixID = glGetUniformLocation(programID, "lightSpaceMatrix");
         shadowMapID = glGetUniformLocation(programID, "shadowMap");
+        aoMapID = glGetUniformLocation(programID, "aoMap");
+    }
+
+    // Maps every face of the box onto its tile of the baked ambient occlusion atlas
+    void setAmbientOcclusion(GLuint aoTexture, const AmbientOcclusionBaker &baker, int boxIndex) {
+        // UNORM16, the atlas needs more precision than half floats have near 1
+        uint16_t ao_uv_buffer_data[48];
+        for (int i = 0; i < 24; ++i) {
+            int face = i / 4;
+            glm::vec3 corner(vertex_buffer_data[3 * i], vertex_buffer_data[3 * i + 1], vertex_buffer_data[3 * i + 2]);
+            glm::vec2 st = AmbientOcclusionBaker::faceCoordinates(face, corner);
+            glm::vec4 tile = baker.faceTile(boxIndex, face);
+            ao_uv_buffer_data[2 * i] = glm::packUnorm1x16(tile.x + st.x * tile.z);
+            ao_uv_buffer_data[2 * i + 1] = glm::packUnorm1x16(tile.y + st.y * tile.w);
+        }
+
+        aoTextureID = aoTexture;
+        glGenBuffers(1, &aoUVBufferID);
+        glBindBuffer(GL_ARRAY_BUFFER, aoUVBufferID);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(ao_uv_buffer_data), ao_uv_buffer_data, GL_STATIC_DRAW);
     }
 
     void render(glm::mat4 cameraMatrix, glm::mat4 lightSpaceMatrix, GLuint depthMap) {
         glUseProgram(programID);
 
+        glBindVertexArray(vertexArrayID);
+
         glEnableVertexAttribArray(0);
         glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, 4 * sizeof(uint16_t), 0);
 
         glEnableVertexAttribArray(1);
         glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
@@ -748,27 +637,32 @@ struct Building {
 
         // -----------------------
 
-        // Set model-view-projection matrix
-        glm::mat4 mvp = cameraMatrix * modelMatrix;
-
-
-        glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
-
+        // Normals are not quantized, only positions go through the dequantize matrix
         glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelMatrix)));
-        glUniformMatrix4fv(glGetUniformLocation(programID, "modelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
+        glm::mat4 positionMatrix = modelMatrix * positionDequantize;
+        glm::mat4 mvp = cameraMatrix * positionMatrix;
+        glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(programID, "modelMatrix"), 1, GL_FALSE, &positionMatrix[0][0]);
         glUniformMatrix3fv(glGetUniformLocation(programID, "normalMatrix"), 1, GL_FALSE, &normalMatrix[0][0]);
 
 
         glEnableVertexAttribArray(2);
         glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, 0, 0);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, textureID);
         glUniform1i(textureSamplerID, 0);
 
         glEnableVertexAttribArray(3);
         glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, 0, 0);
+
+        glEnableVertexAttribArray(4);
+        glBindBuffer(GL_ARRAY_BUFFER, aoUVBufferID);
+        glVertexAttribPointer(4, 2, GL_UNSIGNED_SHORT, GL_TRUE, 0, 0);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, aoTextureID);
+        glUniform1i(aoMapID, 2);
 
 
         glUniform3fv(lightPositionID, 1, &lightPosition[0]);
@@ -778,6 +672,7 @@ struct Building {
 
         // Pass light direction to the shader
         glUniform3fv(glGetUniformLocation(programID, "lightDirection"), 1, &lightDirection[0]);
+        lightClusters.applyUniforms(programID);
 
 
         // Draw the box
@@ -790,26 +685,26 @@ struct Building {
 
         glDisableVertexAttribArray(0);
         glDisableVertexAttribArray(1);
+        glDisableVertexAttribArray(4);
     }
 
     void renderDepth(GLuint shaderProgramID, glm::mat4 lightSpaceMatrix) {
         glUseProgram(shaderProgramID);
 
-        // Set uniforms
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "lightSpaceMatrix"), 1, GL_FALSE,
-                           &lightSpaceMatrix[0][0]);
-
         glm::mat4 modelMatrix = glm::mat4(1.0f);
         modelMatrix = glm::translate(modelMatrix, position);
         modelMatrix = glm::scale(modelMatrix, scale);
+        modelMatrix = modelMatrix * positionDequantize;
 
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "modelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
+        // Built like the MVP of render, so the depth pre-pass matches it exactly
+        glm::mat4 mvp = lightSpaceMatrix * modelMatrix;
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "MVP"), 1, GL_FALSE, &mvp[0][0]);
 
         glBindVertexArray(vertexArrayID);
 
         glEnableVertexAttribArray(0);
         glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, 4 * sizeof(uint16_t), 0);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
 
@@ -824,6 +719,7 @@ struct Building {
         glDeleteBuffers(1, &indexBufferID);
         glDeleteVertexArrays(1, &vertexArrayID);
         glDeleteProgram(programID);
+        glDeleteBuffers(1, &aoUVBufferID);
     }
 };
 
@@ -859,6 +755,7 @@ void updateSandChunks(const glm::vec3 &cameraPosition) {
                 newChunk.initialize(chunkPosition,
                                     glm::vec3(chunkSize, 1.0f, chunkSize),
                                     "../street/sand.jpg");
+                newChunk.setAmbientOcclusion(aoTextureID, sandAOTile);
                 sandChunks.push_back(newChunk);
             }
         }
@@ -866,7 +763,43 @@ void updateSandChunks(const glm::vec3 &cameraPosition) {
 }
 
 
+// Street lamps are spot lights pointing down at every intersection of the city grid
+static void addStreetLamps(std::vector<PointLight> &lights) {
+    for (int row = 0; row < 7; ++row) {
+        for (int col = 0; col < 7; ++col) {
+            glm::vec3 lampPosition(-475.0f + col * 150.0f, -30.0f, -475.0f + row * 150.0f);
+            PointLight lamp(lampPosition, 180.0f, glm::vec3(1.0f, 0.8f, 0.5f), 1.5f);
+            lamp.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+            lamp.spotInnerCos = 0.8f;
+            lamp.spotOuterCos = 0.5f;
+            lights.push_back(lamp);
+        }
+    }
+}
 
+// Scatters neon point lights just outside the side faces of each building
+static void addNeonLights(std::vector<PointLight> &lights, const std::vector<Building> &buildings, int perBuilding) {
+    const glm::vec3 neonColors[] = {
+        glm::vec3(1.0f, 0.1f, 0.8f), glm::vec3(0.1f, 0.9f, 1.0f), glm::vec3(1.0f, 0.3f, 0.5f),
+        glm::vec3(1.0f, 0.9f, 0.2f), glm::vec3(0.3f, 0.3f, 1.0f)
+    };
+    const glm::vec3 faceNormals[] = {
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+    };
+
+    for (const Building &building: buildings) {
+        for (int i = 0; i < perBuilding; ++i) {
+            glm::vec3 normal = faceNormals[rand() % 4];
+            float bottom = std::max(building.position.y - building.scale.y, -130.0f);
+            float top = building.position.y + building.scale.y;
+            float height = bottom + static_cast<float>(rand()) / RAND_MAX * (top - bottom);
+            glm::vec3 lightPos = building.position + normal * (glm::dot(glm::abs(normal), building.scale) + 5.0f);
+            lightPos.y = height;
+            lights.push_back(PointLight(lightPos, 80.0f, neonColors[rand() % 5], 2.0f));
+        }
+    }
+}
 
 
 int main(void) {
@@ -904,6 +837,8 @@ int main(void) {
         std::cerr << "Failed to initialize OpenGL context." << std::endl;
         return -1;
     }
+    StreamBuffer::loadExtensions();
+    JobSystem::initialize();
 
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
@@ -930,8 +865,12 @@ int main(void) {
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     GLuint depthShaderProgramID = LoadShadersFromFile("../street/depth.vert", "../street/depth.frag");
+    GLuint overdrawShaderProgramID = LoadShadersFromFile("../street/depth.vert", "../street/overdraw.frag");
 
     GLuint particleShaderProgram = LoadShadersFromFile("../street/particle.vert", "../street/particle.frag");
+    const char *particleStateVaryings[] = {"outState"};
+    GLuint particleSimulationProgram = LoadTransformFeedbackShaderFromFile("../street/particleSimulate.vert",
+                                                                           particleStateVaryings, 1);
 
     std::vector<Building> buildings3;
     std::vector<Building> walls;
@@ -940,7 +879,7 @@ int main(void) {
 
 
     Skybox skybox;
-    skybox.initialize(glm::vec3(0, 0, 0), glm::vec3(1200, 1200, 1200), "../street/sky.png");
+    skybox.initialize("../street/sky.png");
 
 
     float floorSize = 1000.0f;
@@ -955,6 +894,13 @@ int main(void) {
 
     Bot bot;
     bot.initialize();
+    BotCrowd crowd;
+    GLuint crowdShaderProgram = LoadShadersFromFile("../street/botCrowd.vert", "../street/bot.frag",
+                                                    "../street/clusterLighting.glsl");
+    GLuint crowdBakedShaderProgram = LoadShadersFromFile("../street/botCrowdBaked.vert", "../street/bot.frag",
+                                                         "../street/clusterLighting.glsl");
+    crowd.initialize(bot, CROWD_SIZES[crowdSizeIndex], crowdShaderProgram, crowdBakedShaderProgram);
+    int crowdShownIndex = crowdSizeIndex;
     static double lastTime = glfwGetTime();
     float time = 0.0f;
 
@@ -1037,17 +983,27 @@ int main(void) {
 
 
 
-    // Create particle systems for each corner
-    ParticleSystem particleSystem1(200, particleShaderProgram);
-    ParticleSystem particleSystem2(200, particleShaderProgram);
-    ParticleSystem particleSystem3(200, particleShaderProgram);
-    ParticleSystem particleSystem4(200, particleShaderProgram);
+    // One particle pool with an emitter on top of each corner building
+    ParticleManager particleManager;
+    particleManager.initialize(PARTICLE_POOL_SIZE, particleShaderProgram);
+    for (glm::vec3 cornerPos: {corner1Pos, corner2Pos, corner3Pos, corner4Pos}) {
+        ParticleEmitter emitter;
+        emitter.start = cornerPos;
+        emitter.end = cornerPos + glm::vec3(0.0f, 50.0f, 0.0f);
+        particleManager.addEmitter(emitter);
+    }
+
+    // Falls from above the skyline to the floor, spread over the whole floor
+    const glm::vec3 snowStart(0.0f, 600.0f, 0.0f), snowEnd(0.0f, -130.0f, 0.0f);
+    ParticleSystem snow(SNOW_PARTICLES, particleShaderProgram, particleSimulationProgram);
+    snow.initialize(snowStart, snowEnd, glm::vec3(2.0f * floorSize, 0.0f, 2.0f * floorSize),
+                    glm::vec4(0.9f, 0.95f, 1.0f, 0.8f), 2.0f, 4.0f);
 
-    // Initialize each particle system at corner building positions
-    particleSystem1.initialize(corner1Pos, corner1Pos + glm::vec3(0.0f, 50.0f, 0.0f));
-    particleSystem2.initialize(corner2Pos, corner2Pos + glm::vec3(0.0f, 50.0f, 0.0f));
-    particleSystem3.initialize(corner3Pos, corner3Pos + glm::vec3(0.0f, 50.0f, 0.0f));
-    particleSystem4.initialize(corner4Pos, corner4Pos + glm::vec3(0.0f, 50.0f, 0.0f));
+    Flock flock;
+    FlockSettings flockSettings;
+    flockSettings.boundsMin = glm::vec3(-800.0f, 300.0f, -800.0f);
+    flockSettings.boundsMax = glm::vec3(800.0f, 550.0f, 800.0f);
+    flock.initialize(FLOCK_BIRDS, flockSettings, particleShaderProgram);
 
 
 
@@ -1106,6 +1062,101 @@ int main(void) {
     }
 
 
+    // Bake ambient occlusion of the static boxes onto themselves and the street
+    AmbientOcclusionBaker aoBaker;
+    std::vector<Building *> staticBoxes;
+    for (std::vector<Building> *group: {&buildings3, &walls, &edgeBuildings, &cornerBuildings}) {
+        for (Building &building: *group) {
+            staticBoxes.push_back(&building);
+        }
+    }
+    staticBoxes.push_back(&sign);
+    for (Building *box: staticBoxes) {
+        aoBaker.addBox(box->position, box->scale);
+    }
+    aoBaker.setGround(floor.position, glm::vec2(floor.scale.x, floor.scale.z));
+    aoBaker.bake(32, 256, 48, 200.0f, "ao_cache.bin");
+
+    aoTextureID = aoBaker.createTexture();
+    for (size_t i = 0; i < staticBoxes.size(); ++i) {
+        staticBoxes[i]->setAmbientOcclusion(aoTextureID, aoBaker, static_cast<int>(i));
+    }
+    floor.setAmbientOcclusion(aoTextureID, aoBaker.groundTile());
+
+    // Same boxes as distance grid for particle collision, covering the snow volume
+    SignedDistanceGrid collisionGrid;
+    for (Building *box: staticBoxes) {
+        collisionGrid.addBox(box->position, box->scale);
+    }
+    collisionGrid.setGround(floor.position.y);
+    collisionGrid.build(glm::vec3(-floorSize, floor.position.y - 20.0f, -floorSize),
+                        glm::vec3(floorSize, snowStart.y + 20.0f, floorSize), 20.0f, 60.0f);
+    GLuint collisionTextureID = collisionGrid.createTexture();
+    sandAOTile = aoBaker.unoccludedTile();
+    for (auto &chunk: sandChunks) {
+        chunk.setAmbientOcclusion(aoTextureID, sandAOTile);
+    }
+
+    // Position-only draw of every building, wall and the sign, shared by the
+    // shadow pass and the camera depth pre-pass
+    auto renderBuildingsDepth = [&](GLuint programID, glm::mat4 matrix) {
+        for (Building &building: buildings3) {
+            building.renderDepth(programID, matrix);
+        }
+        for (Building &wall: walls) {
+            wall.renderDepth(programID, matrix);
+        }
+        for (Building &building: edgeBuildings) {
+            building.renderDepth(programID, matrix);
+        }
+        for (Building &building: cornerBuildings) {
+            building.renderDepth(programID, matrix);
+        }
+        sign.renderDepth(programID, matrix);
+    };
+
+    glm::mat4 botTransform = glm::mat4(1.0f);
+    botTransform = glm::translate(botTransform, glm::vec3(0.0f, -330.0f, 0.0f));
+    botTransform = glm::scale(botTransform, glm::vec3(8.0f, 6.0f, 8.0f));
+
+    // All opaque geometry seen by the camera, the bot from this frame's skinned buffers
+    auto renderOpaqueDepth = [&](GLuint programID, glm::mat4 matrix) {
+        floor.renderDepth(programID, matrix);
+        for (auto &chunk: sandChunks) {
+            chunk.renderDepth(programID, matrix);
+        }
+        renderBuildingsDepth(programID, matrix);
+        bot.renderDepth(programID, matrix, botTransform);
+    };
+
+    OverdrawMonitor overdrawMonitor;
+    overdrawMonitor.initialize();
+
+    // Local lights
+    addStreetLamps(pointLights);
+    addNeonLights(pointLights, buildings3, 3);
+    addNeonLights(pointLights, edgeBuildings, 3);
+    addNeonLights(pointLights, cornerBuildings, 6);
+    std::cout << "Point lights: " << pointLights.size() << std::endl;
+    std::cout << "Vertex data: " << VertexFormatStats::vertexCount() << " vertices, "
+              << VertexFormatStats::floatBytes() / 1024.0 << " KB unpacked, "
+              << VertexFormatStats::packedBytes() / 1024.0 << " KB packed" << std::endl;
+    const Bot::VertexPackingReport &botPacking = bot.vertexPacking();
+    std::cout << "Bot vertices: " << botPacking.loadedBytesPerVertex << " -> " << botPacking.packedBytesPerVertex
+              << " bytes, max error " << botPacking.maxPositionError << " position, " << botPacking.maxNormalError
+              << " degrees normal" << std::endl;
+    for (const Bot::MeshOptimizationReport &mesh : bot.meshOptimization()) {
+        std::cout << "Bot mesh " << mesh.mesh << ", " << mesh.triangleCount << " triangles: ACMR "
+                  << mesh.before.acmr << " -> " << mesh.after.acmr << ", ATVR " << mesh.before.atvr << " -> "
+                  << mesh.after.atvr << (mesh.overdrawSorted ? ", sorted for overdraw" : "") << std::endl;
+    }
+    for (const Bot::MeshLodReport &lod : bot.meshLods()) {
+        std::cout << "Bot mesh " << lod.mesh << " LOD " << lod.level << ": " << lod.triangleCount
+                  << " triangles, error " << lod.error << std::endl;
+    }
+    std::cout << "Bot LOD chain built in " << bot.lodBuildMs() << " ms" << std::endl;
+
+
     // Camera setup
     glm::mat4 viewMatrix, projectionMatrix;
     glm::float32 FoV = 90;
@@ -1113,10 +1164,52 @@ int main(void) {
     glm::float32 zFar = 2000.0f;
     projectionMatrix = glm::perspective(glm::radians(FoV), (float) windowWidth / windowHeight, zNear, zFar);
 
+    lightClusters.initialize(MAX_POINT_LIGHTS, zNear, zFar);
+    dynamicResolution.initialize(windowWidth, windowHeight, TARGET_FRAME_MS);
+
     float fTime = 0.0f;			// Time for measuring fps
     unsigned long frames = 0;
 
     do {
+        double currentTime = glfwGetTime();
+        float deltaTime = float(currentTime - lastTime);
+        lastTime = currentTime;
+
+        // CPU simulation runs on the job system while this thread submits the
+        // shadow and opaque passes, and is waited for right before its results are drawn
+        JobCounter simulationJobs;
+        // The bot is skinned before the shadow pass, so its update is waited for first
+        JobCounter animationJobs;
+        if (playAnimation) {
+            time += deltaTime * playbackSpeed;
+            JobSystem::run(animationJobs, [&]() { bot.update(time); });
+        }
+        if (crowdShownIndex != crowdSizeIndex) {
+            crowdShownIndex = crowdSizeIndex;
+            crowd.reserve(bot, CROWD_SIZES[crowdSizeIndex]);
+        }
+        crowd.setBaked(crowdBaked);
+        crowd.setLod(crowdLod);
+        crowd.setMeshLod(crowdMeshLod);
+        bot.setPackedVertices(packedBotVertices);
+        crowd.setView(projectionMatrix, cameraPosition);
+        if (crowd.count() > 0) {
+            JobSystem::run(simulationJobs, [&]() { crowd.simulate(time); });
+        }
+        const SignedDistanceGrid *collision = particleCollision ? &collisionGrid : nullptr;
+        particleManager.setCollision(collision, PARTICLE_RADIUS);
+        snow.setCollision(collision, collisionTextureID, PARTICLE_RADIUS);
+        glm::vec3 sortPosition = cameraPosition, sortDirection = cameraFront;
+        particleManager.setView(projectionMatrix * glm::lookAt(cameraPosition, cameraPosition + cameraFront, cameraUp),
+                                cameraPosition);
+        JobSystem::run(simulationJobs, [&]() {
+            particleManager.simulate(deltaTime);
+            particleManager.sortByDepth(sortPosition, sortDirection);
+        });
+        if (showFlock) {
+            JobSystem::run(simulationJobs, [&]() { flock.simulate(deltaTime); });
+        }
+
         // Shadow mapping pass
         float near_plane = 10.0f, far_plane = 1800.0f;
         float orthoSize = 1000.0f;
@@ -1131,118 +1224,145 @@ int main(void) {
         sunLightInfo.intensity = lightIntensity;
         sunLightInfo.direction = lightDirection;
 
+        dynamicResolution.beginFrame();
+
+        // Skin the bot once, the shadow, depth pre-pass and main passes all draw the result
+        JobSystem::wait(animationJobs);
+        bot.skin();
+
         // First render pass - shadow mapping
         glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
         glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
         glClear(GL_DEPTH_BUFFER_BIT);
-        glUseProgram(depthShaderProgramID);
-
-        // Set the uniform for the light space matrix
-        glUniformMatrix4fv(glGetUniformLocation(depthShaderProgramID, "lightSpaceMatrix"), 1, GL_FALSE,
-                           &lightSpaceMatrix[0][0]);
-        for (Building &building: buildings3) {
-            building.renderDepth(depthShaderProgramID, lightSpaceMatrix);
-        }
-
-        for (Building &wall: walls) {
-            wall.renderDepth(depthShaderProgramID, lightSpaceMatrix);
-        }
-
-        for (Building &building: edgeBuildings) {
-            building.renderDepth(depthShaderProgramID, lightSpaceMatrix);
-        }
-        for (Building &building: cornerBuildings) {
-            building.renderDepth(depthShaderProgramID, lightSpaceMatrix);
-        }
-
-        sign.renderDepth(depthShaderProgramID, lightSpaceMatrix);
+        renderBuildingsDepth(depthShaderProgramID, lightSpaceMatrix);
+        bot.renderDepth(depthShaderProgramID, lightSpaceMatrix, botTransform);
 
 
-        // Main rendering pass
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0, 0, windowWidth, windowHeight);
+        // Main rendering pass, into the offscreen target at the current resolution scale
+        dynamicResolution.bindSceneTarget();
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        int renderWidth = dynamicResolution.renderWidth();
+        int renderHeight = dynamicResolution.renderHeight();
 
         // Update view and projection matrices
         viewMatrix = glm::lookAt(cameraPosition, cameraPosition + cameraFront, cameraUp);
         glm::mat4 vp = projectionMatrix * viewMatrix;
 
-        glm::mat4 skybox2Matrix = glm::mat4(1.0f);
-        skybox2Matrix = glm::translate(skybox2Matrix, cameraPosition);
-        skybox2Matrix = glm::scale(skybox2Matrix, glm::vec3(2000, 2000, 2000));
+        // Assign the local lights to the view clusters
+        lightClusters.update(pointLights, viewMatrix, projectionMatrix, renderWidth, renderHeight);
 
-        // Modify the view matrix to remove translation
-        glm::mat4 viewWithoutTranslation = glm::mat4(glm::mat3(viewMatrix));
-        glm::mat4 skyboxVP = projectionMatrix * viewWithoutTranslation;
+        updateSandChunks(cameraPosition);
 
-        // Render skybox
-        glDisable(GL_DEPTH_TEST);
-        skybox.render(skyboxVP);
-        glEnable(GL_DEPTH_TEST);
+        bool useDepthPrepass = depthPrepassMode == PREPASS_ON ||
+                               (depthPrepassMode == PREPASS_AUTO && overdrawMonitor.prepassWanted());
+        int pixelCount = renderWidth * renderHeight;
+
+        // The fragments passing the depth test of whichever pass runs first
+        // are the ones the full shader would pay for without a pre-pass
+        overdrawMonitor.beginCount();
+        if (useDepthPrepass) {
+            // Depth pre-pass: lay down the nearest opaque depth so the PCF and
+            // Phong shading below runs at most once per pixel
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            renderOpaqueDepth(depthShaderProgramID, vp);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            overdrawMonitor.endCount(pixelCount);
+
+            glDepthFunc(GL_LEQUAL);
+            glDepthMask(GL_FALSE);
+        }
 
+        if (showOverdraw) {
+            // Every shaded fragment adds a constant, brighter means more overdraw
+            glClear(GL_COLOR_BUFFER_BIT);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+            renderOpaqueDepth(overdrawShaderProgramID, vp);
+            glDisable(GL_BLEND);
+        } else {
+            // Render floor and buildings
+            floor.render(vp, lightSpaceMatrix, depthMap, sunLightInfo, cameraPosition, lightClusters);
+            for (auto &chunk: sandChunks) {
+                chunk.render(vp, lightSpaceMatrix, depthMap, sunLightInfo, cameraPosition, lightClusters);
+            }
 
-        // Render floor and buildings
-        floor.render(vp, lightSpaceMatrix, depthMap, sunLightInfo, cameraPosition);
-        updateSandChunks(cameraPosition);
-        for (auto &chunk: sandChunks) {
-            chunk.render(vp, lightSpaceMatrix, depthMap, sunLightInfo, cameraPosition);
-        }
 
+            for (Building &building: buildings3) {
+                building.render(vp, lightSpaceMatrix, depthMap);
+            }
 
-        for (Building &building: buildings3) {
-            building.render(vp, lightSpaceMatrix, depthMap);
-        }
+            for (Building &wall: walls) {
+                wall.render(vp, lightSpaceMatrix, depthMap);
+            }
 
-        for (Building &wall: walls) {
-            wall.render(vp, lightSpaceMatrix, depthMap);
-        }
+            for (Building &building: edgeBuildings) {
+                building.render(vp, lightSpaceMatrix, depthMap);
+            }
+            for (Building &building: cornerBuildings) {
+                building.render(vp, lightSpaceMatrix, depthMap);
+            }
 
-        for (Building &building: edgeBuildings) {
-            building.render(vp, lightSpaceMatrix, depthMap);
-        }
-        for (Building &building: cornerBuildings) {
-            building.render(vp, lightSpaceMatrix, depthMap);
+            sign.render(vp, lightSpaceMatrix, depthMap);
+
+            bot.render(vp, botTransform, lightClusters, cameraPosition);
         }
 
-        sign.render(vp, lightSpaceMatrix, depthMap);
+        if (useDepthPrepass) {
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+        } else {
+            overdrawMonitor.endCount(pixelCount);
+        }
 
 
-        double currentTime = glfwGetTime();
-        float deltaTime = float(currentTime - lastTime);
-        lastTime = currentTime;
+        JobSystem::wait(simulationJobs);
 
-        if (playAnimation) {
-            time += deltaTime * playbackSpeed;
-            bot.update(time);
-        }
+        crowd.upload();
+        crowd.render(vp, lightClusters, cameraPosition);
 
-        glm::mat4 botTransform = glm::mat4(1.0f);
-        botTransform = glm::translate(botTransform, glm::vec3(0.0f, -330.0f, 0.0f));
-        botTransform = glm::scale(botTransform, glm::vec3(8.0f, 6.0f, 8.0f));
-        bot.render(vp * botTransform);
+        // Render skybox after all opaque geometry, using the view matrix without translation
+        glm::mat4 viewWithoutTranslation = glm::mat4(glm::mat3(viewMatrix));
+        glm::mat4 skyboxVP = projectionMatrix * viewWithoutTranslation;
+        skybox.render(skyboxVP);
 
 
         // Update particles
-        particleSystem1.update(deltaTime, corner1Pos, corner1Pos + glm::vec3(0.0f, 50.0f, 0.0f));
-        particleSystem2.update(deltaTime, corner2Pos, corner2Pos + glm::vec3(0.0f, 50.0f, 0.0f));
-        particleSystem3.update(deltaTime, corner3Pos, corner3Pos + glm::vec3(0.0f, 50.0f, 0.0f));
-        particleSystem4.update(deltaTime, corner4Pos, corner4Pos + glm::vec3(0.0f, 50.0f, 0.0f));
+        particleManager.upload();
+        if (showFlock) {
+            flock.upload();
+        }
+        if (showSnow) {
+            snow.update(deltaTime, snowStart, snowEnd);
+        }
 
+        // Translucent pass: particles are sorted back to front and test depth without writing it
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
         glEnable(GL_PROGRAM_POINT_SIZE);
+        glDepthMask(GL_FALSE);
+
+        // Point sizes are in pixels, keep them constant on screen at any resolution scale
+        glUseProgram(particleShaderProgram);
+        glUniform1f(glGetUniformLocation(particleShaderProgram, "pointSizeScale"), dynamicResolution.scale());
 
         // Render particles
-        particleSystem1.render(projectionMatrix * viewMatrix);
-        particleSystem2.render(projectionMatrix * viewMatrix);
-        particleSystem3.render(projectionMatrix * viewMatrix);
-        particleSystem4.render(projectionMatrix * viewMatrix);
+        particleManager.render(projectionMatrix * viewMatrix);
+        if (showFlock) {
+            flock.render(projectionMatrix * viewMatrix);
+        }
+        if (showSnow) {
+            snow.render(projectionMatrix * viewMatrix);
+        }
 
+        glDepthMask(GL_TRUE);
         glDisable(GL_BLEND);
         glDisable(GL_PROGRAM_POINT_SIZE);
 
 
 
+        // Upscale the scene to the window
+        dynamicResolution.present();
+
         // FPS tracking
         // Count number of frames over a few seconds and take average
         frames++;
@@ -1253,7 +1373,35 @@ int main(void) {
             fTime = 0;
 
             std::stringstream stream;
-            stream << std::fixed << std::setprecision(2) << "JaedonPaget | Frames per second (FPS): " << fps;
+            stream << std::fixed << std::setprecision(2) << "JaedonPaget | Frames per second (FPS): " << fps
+                   << " | Overdraw: " << overdrawMonitor.ratio()
+                   << (useDepthPrepass ? " (depth pre-pass)" : "")
+                   << " | GPU: " << dynamicResolution.gpuFrameMs() << " ms"
+                   << " | Resolution: " << static_cast<int>(dynamicResolution.scale() * 100.0f) << "%"
+                   << " | Upload stalls: " << StreamBuffer::totalStalls()
+                   << " | Particle sort: " << particleManager.sortMs() << " ms"
+                   << " | Emitters: " << particleManager.visibleEmitterCount() << "/" << particleManager.emitterCount()
+                   << " visible, " << particleManager.simulatedCount() << " simulated"
+                   << " | Bot: " << bot.skinnedVertexCount() << " vertices skinned once for "
+                   << bot.skinnedPassCount() << " passes, "
+                   << (bot.isPackedVertices() ? bot.vertexPacking().packedBytesPerVertex
+                                              : bot.vertexPacking().loadedBytesPerVertex) << " B/vertex"
+                   << " | Triangles: " << bot.lodTriangleCount(0) + crowd.triangleCount() << " drawn, "
+                   << bot.lodTriangleCount(0) + crowd.fullTriangleCount() << " without LOD";
+            if (showFlock) {
+                stream << " | Flock: " << flock.stepMs() << " ms";
+            }
+            if (crowd.count() > 0) {
+                stream << " | Crowd: " << crowd.count() << " bots, " << crowd.evaluatedCount() << " evaluated ("
+                       << crowd.lodCount(BotCrowd::LOD_FULL) << "/" << crowd.lodCount(BotCrowd::LOD_HALF) << "/"
+                       << crowd.lodCount(BotCrowd::LOD_QUARTER) << "/" << crowd.lodCount(BotCrowd::LOD_BAKED)
+                       << " full/half/quarter/baked), " << crowd.animationMs() << " ms, bake "
+                       << crowd.animationBake().byteSize() / 1024 << " KB, mesh LOD";
+                for (int level = 0; level < bot.lodLevelCount(); ++level) {
+                    stream << (level == 0 ? " " : "/") << crowd.meshLodCount(level);
+                }
+                stream << ", draw " << crowd.drawMs(true) << " ms packed / " << crowd.drawMs(false) << " ms loaded";
+            }
             glfwSetWindowTitle(window, stream.str().c_str());
         }
 
@@ -1278,17 +1426,27 @@ int main(void) {
     skybox.cleanup();
     floor.cleanup();
     bot.cleanup();
+    crowd.cleanup();
+    glDeleteProgram(crowdShaderProgram);
+    glDeleteProgram(crowdBakedShaderProgram);
     for (auto &chunk: sandChunks) {
         chunk.cleanup();
     }
     sign.cleanup();
-    particleSystem1.cleanup();
-    particleSystem2.cleanup();
-    particleSystem3.cleanup();
-    particleSystem4.cleanup();
+    lightClusters.cleanup();
+    glDeleteTextures(1, &aoTextureID);
+    glDeleteTextures(1, &collisionTextureID);
+    overdrawMonitor.cleanup();
+    dynamicResolution.cleanup();
+    glDeleteProgram(overdrawShaderProgramID);
+    particleManager.cleanup();
+    snow.cleanup();
+    flock.cleanup();
+    glDeleteProgram(particleSimulationProgram);
 
 
 
+    JobSystem::shutdown();
     glfwTerminate();
     return 0;
 }
@@ -1309,6 +1467,49 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
             cameraPosition += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
     }
 
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        depthPrepassMode = static_cast<DepthPrepassMode>((depthPrepassMode + 1) % 3);
+        const char *modeNames[] = {"auto", "on", "off"};
+        std::cout << "Depth pre-pass: " << modeNames[depthPrepassMode] << std::endl;
+    }
+    if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+        showOverdraw = !showOverdraw;
+    }
+    if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+        dynamicResolution.setEnabled(!dynamicResolution.isEnabled());
+        std::cout << "Dynamic resolution: " << (dynamicResolution.isEnabled() ? "on" : "off") << std::endl;
+    }
+    if (key == GLFW_KEY_N && action == GLFW_PRESS) {
+        showSnow = !showSnow;
+    }
+    if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+        showFlock = !showFlock;
+    }
+    if (key == GLFW_KEY_K && action == GLFW_PRESS) {
+        crowdSizeIndex = (crowdSizeIndex + 1) % 3;
+        std::cout << "Crowd: " << CROWD_SIZES[crowdSizeIndex] << " bots" << std::endl;
+    }
+    if (key == GLFW_KEY_J && action == GLFW_PRESS) {
+        crowdBaked = !crowdBaked;
+        std::cout << "Crowd animation: " << (crowdBaked ? "baked" : "evaluated") << std::endl;
+    }
+    if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+        crowdLod = !crowdLod;
+        std::cout << "Crowd animation LOD: " << (crowdLod ? "on" : "off") << std::endl;
+    }
+    if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+        crowdMeshLod = !crowdMeshLod;
+        std::cout << "Crowd mesh LOD: " << (crowdMeshLod ? "on" : "off") << std::endl;
+    }
+    if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+        packedBotVertices = !packedBotVertices;
+        std::cout << "Bot vertices: " << (packedBotVertices ? "packed" : "as loaded") << std::endl;
+    }
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        particleCollision = !particleCollision;
+        std::cout << "Particle collision: " << (particleCollision ? "on" : "off") << std::endl;
+    }
+
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, GL_TRUE);
 }
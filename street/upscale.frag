@@ -0,0 +1,51 @@
+#version 330 core
+
+in vec2 uv;
+
+out vec4 FragColor;
+
+uniform sampler2D textureSampler;
+uniform vec2 sourceSize; // Size of the whole offscreen texture
+uniform vec2 uvScale;    // Part of the texture covered by this frame's render
+
+// Keeps taps inside the rendered sub-rectangle
+vec2 clampToRendered(vec2 texelPosition) {
+    return clamp(texelPosition, vec2(0.5), uvScale * sourceSize - 0.5) / sourceSize;
+}
+
+// Catmull-Rom filter from 9 bilinear taps instead of 16 point taps. The
+// negative lobes of the kernel sharpen the upscaled image.
+vec3 sampleCatmullRom(vec2 sourceUV) {
+    vec2 samplePosition = sourceUV * sourceSize;
+    vec2 texPos1 = floor(samplePosition - 0.5) + 0.5;
+    vec2 f = samplePosition - texPos1;
+
+    vec2 w0 = f * (-0.5 + f * (1.0 - 0.5 * f));
+    vec2 w1 = 1.0 + f * f * (-2.5 + 1.5 * f);
+    vec2 w2 = f * (0.5 + f * (2.0 - 1.5 * f));
+    vec2 w3 = f * f * (-0.5 + 0.5 * f);
+
+    // The two middle taps are merged into one bilinear fetch
+    vec2 w12 = w1 + w2;
+    vec2 pos0 = clampToRendered(texPos1 - 1.0);
+    vec2 pos12 = clampToRendered(texPos1 + w2 / w12);
+    vec2 pos3 = clampToRendered(texPos1 + 2.0);
+
+    vec3 result = vec3(0.0);
+    result += texture(textureSampler, vec2(pos0.x, pos0.y)).rgb * w0.x * w0.y;
+    result += texture(textureSampler, vec2(pos12.x, pos0.y)).rgb * w12.x * w0.y;
+    result += texture(textureSampler, vec2(pos3.x, pos0.y)).rgb * w3.x * w0.y;
+
+    result += texture(textureSampler, vec2(pos0.x, pos12.y)).rgb * w0.x * w12.y;
+    result += texture(textureSampler, vec2(pos12.x, pos12.y)).rgb * w12.x * w12.y;
+    result += texture(textureSampler, vec2(pos3.x, pos12.y)).rgb * w3.x * w12.y;
+
+    result += texture(textureSampler, vec2(pos0.x, pos3.y)).rgb * w0.x * w3.y;
+    result += texture(textureSampler, vec2(pos12.x, pos3.y)).rgb * w12.x * w3.y;
+    result += texture(textureSampler, vec2(pos3.x, pos3.y)).rgb * w3.x * w3.y;
+    return max(result, vec3(0.0));
+}
+
+void main() {
+    FragColor = vec4(sampleCatmullRom(uv * uvScale), 1.0);
+}
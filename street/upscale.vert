@@ -0,0 +1,10 @@
+#version 330 core
+
+out vec2 uv;
+
+void main() {
+    // Fullscreen triangle from the vertex ID: (-1,-1), (3,-1), (-1,3)
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    gl_Position = vec4(position, 0.0, 1.0);
+    uv = position * 0.5 + 0.5;
+}
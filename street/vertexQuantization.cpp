@@ -0,0 +1,57 @@
+#include "vertexQuantization.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+
+long long VertexFormatStats::vertices = 0;
+long long VertexFormatStats::floatTotal = 0;
+long long VertexFormatStats::packedTotal = 0;
+
+PositionQuantization PositionQuantization::fromBounds(glm::vec3 minimum, glm::vec3 maximum) {
+    PositionQuantization quantization;
+    quantization.offset = minimum;
+    quantization.scale = glm::max(maximum - minimum, glm::vec3(0.0f));
+    return quantization;
+}
+
+glm::mat4 PositionQuantization::dequantize() const {
+    return glm::scale(glm::translate(glm::mat4(1.0f), offset), scale);
+}
+
+void PositionQuantization::encode(glm::vec3 position, uint16_t *out) const {
+    for (int i = 0; i < 3; ++i) {
+        // Flat axes, like the y of a floor quad, keep 0 and decode to the offset
+        out[i] = scale[i] > 0.0f ? glm::packUnorm1x16((position[i] - offset[i]) / scale[i]) : 0;
+    }
+    out[3] = 0;
+}
+
+glm::vec3 PositionQuantization::decode(const uint16_t *in) const {
+    return offset + scale * glm::vec3(in[0], in[1], in[2]) / 65535.0f;
+}
+
+void packWeights(glm::vec4 weights, uint8_t *out) {
+    float total = weights.x + weights.y + weights.z + weights.w;
+    if (total <= 0.0f) {
+        out[0] = 255;
+        out[1] = out[2] = out[3] = 0;
+        return;
+    }
+    int sum = 0, largest = 0;
+    for (int i = 0; i < 4; ++i) {
+        out[i] = static_cast<uint8_t>(std::lround(glm::clamp(weights[i] / total, 0.0f, 1.0f) * 255.0f));
+        sum += out[i];
+        if (weights[i] > weights[largest]) {
+            largest = i;
+        }
+    }
+    // Rounding error goes to the largest weight, where it matters least
+    out[largest] = static_cast<uint8_t>(out[largest] + 255 - sum);
+}
+
+void VertexFormatStats::add(int vertexCount, int floatBytesPerVertex, int packedBytesPerVertex) {
+    vertices += vertexCount;
+    floatTotal += static_cast<long long>(vertexCount) * floatBytesPerVertex;
+    packedTotal += static_cast<long long>(vertexCount) * packedBytesPerVertex;
+}
@@ -0,0 +1,41 @@
+#ifndef VERTEXQUANTIZATION_H
+#define VERTEXQUANTIZATION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <cstddef>
+#include <cstdint>
+
+// Compact vertex attribute encodings shared by every mesh, all of them read
+// natively by GL 3.3 vertex fetch. Positions are UNORM16 inside the mesh
+// bounds and a dequantize matrix, folded into the model matrix or applied in
+// the shader, maps them back. Normals are GL_INT_2_10_10_10_REV, texture
+// coordinates half floats and skinning weights UNORM8. Single values are
+// packed with glm: packUnorm1x16, packSnorm3x10_1x2 and packHalf1x16.
+struct PositionQuantization {
+    glm::vec3 offset = glm::vec3(0.0f);
+    glm::vec3 scale = glm::vec3(1.0f);
+
+    static PositionQuantization fromBounds(glm::vec3 minimum, glm::vec3 maximum);
+    glm::mat4 dequantize() const;
+    // Four UNORM16 components, the last one is padding
+    void encode(glm::vec3 position, uint16_t *out) const;
+    glm::vec3 decode(const uint16_t *in) const;
+};
+
+// Rounds normalized weights to UNORM8 so that the four bytes still sum to 255
+void packWeights(glm::vec4 weights, uint8_t *out);
+
+// Vertex bytes of every mesh as they would be in 32 bit floats and as uploaded
+class VertexFormatStats {
+public:
+    static void add(int vertexCount, int floatBytesPerVertex, int packedBytesPerVertex);
+    static long long vertexCount() { return vertices; }
+    static long long floatBytes() { return floatTotal; }
+    static long long packedBytes() { return packedTotal; }
+
+private:
+    static long long vertices, floatTotal, packedTotal;
+};
+
+#endif // VERTEXQUANTIZATION_H